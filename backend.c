@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "backend.h"
+#include "proto.h"
+
+#define MAX_REPLY_SIZE (1024 * 1024) // Largest reply buffered per connection
+
+// Close a connection and fail everything still waiting on it
+static void backend_close(BackendSet *set, BackendConn *conn) {
+    BackendConn **link = &set->conns;
+    while (*link && *link != conn) link = &(*link)->next;
+    if (*link) *link = conn->next;
+
+    epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+
+    // Detach the queue first: callbacks may queue new requests elsewhere
+    BackendRequest *req = conn->head;
+    conn->head = conn->tail = NULL;
+    while (req) {
+        BackendRequest *next = req->next;
+        set->on_reply(req, NULL, 0);
+        req = next;
+    }
+
+    netbuf_free(&conn->in);
+    netbuf_free(&conn->out);
+    conn->next = set->closed;
+    set->closed = conn;
+}
+
+void backend_collect(BackendSet *set) {
+    while (set->closed) {
+        BackendConn *conn = set->closed;
+        set->closed = conn->next;
+        free(conn);
+    }
+}
+
+static BackendConn *backend_open(BackendSet *set, const char *address) {
+    char ip[256];
+    int port;
+    if (sscanf(address, "%255[^:]:%d", ip, &port) != 2) return NULL;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return NULL;
+    set_nonblocking(sock);
+
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &server_addr.sin_addr);
+
+    int connected = 1;
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            close(sock);
+            return NULL;
+        }
+        connected = 0;
+    }
+
+    BackendConn *conn = (BackendConn *)calloc(1, sizeof(BackendConn));
+    conn->kind = EVENT_SOURCE_BACKEND;
+    snprintf(conn->address, sizeof(conn->address), "%s", address);
+    conn->fd = sock;
+    conn->connected = connected;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    if (epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        close(sock);
+        free(conn);
+        return NULL;
+    }
+
+    conn->next = set->conns;
+    set->conns = conn;
+    return conn;
+}
+
+BackendConn *backend_get(BackendSet *set, const char *address) {
+    for (BackendConn *conn = set->conns; conn; conn = conn->next) {
+        if (strcmp(conn->address, address) == 0) return conn;
+    }
+    return backend_open(set, address);
+}
+
+int backend_send(BackendSet *set, BackendConn *conn, const char *request, size_t len, BackendRequest *req) {
+    req->next = NULL;
+    if (conn->tail) {
+        conn->tail->next = req;
+    } else {
+        conn->head = req;
+    }
+    conn->tail = req;
+
+    netbuf_append(&conn->out, request, len);
+    if (!req->binary) netbuf_append(&conn->out, "\n", 1);
+
+    // Until the connect completes, EPOLLOUT will flush the queued bytes
+    if (conn->connected && netbuf_flush_fd(&conn->out, conn->fd) < 0) {
+        backend_close(set, conn);
+        return -1;
+    }
+    return 0;
+}
+
+// Hand every complete reply to the request at the head of the queue. The
+// head request's type says how its reply is framed.
+static int dispatch_replies(BackendSet *set, BackendConn *conn) {
+    while (conn->in.len > 0) {
+        BackendRequest *req = conn->head;
+        if (!req) return -1; // Reply nobody asked for: stream is out of sync
+
+        size_t len, consumed;
+        if (req->binary) {
+            ProtoMessage msg;
+            ssize_t size = proto_parse(NETBUF_PTR(&conn->in), conn->in.len, &msg);
+            if (size < 0) return -1;
+            if (size == 0) break;
+            len = consumed = size;
+        } else {
+            char *nl = memchr(NETBUF_PTR(&conn->in), '\n', conn->in.len);
+            if (!nl) break;
+            len = nl - NETBUF_PTR(&conn->in);
+            consumed = len + 1;
+        }
+
+        conn->head = req->next;
+        if (!conn->head) conn->tail = NULL;
+        set->on_reply(req, NETBUF_PTR(&conn->in), len);
+        netbuf_consume(&conn->in, consumed);
+    }
+    return conn->in.len >= MAX_REPLY_SIZE ? -1 : 0;
+}
+
+void backend_handle_event(BackendSet *set, BackendConn *conn, uint32_t events) {
+    if (conn->fd < 0) return; // Closed earlier in this batch of events
+
+    if (events & EPOLLERR) {
+        backend_close(set, conn);
+        return;
+    }
+
+    if (!conn->connected && (events & EPOLLOUT)) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            backend_close(set, conn);
+            return;
+        }
+        conn->connected = 1;
+    }
+    if (!conn->connected) return;
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        ssize_t n = netbuf_read_fd(&conn->in, conn->fd, MAX_REPLY_SIZE);
+        if (dispatch_replies(set, conn) < 0 || n < 0) {
+            backend_close(set, conn);
+            return;
+        }
+    }
+
+    if (netbuf_flush_fd(&conn->out, conn->fd) < 0) {
+        backend_close(set, conn);
+    }
+}
+
+void backend_drop_unless(BackendSet *set, int (*keep)(const char *address)) {
+    BackendConn *conn = set->conns;
+    while (conn) {
+        BackendConn *next = conn->next;
+        if (!keep(conn->address)) {
+            printf("Closing connections to '%s'\n", conn->address);
+            backend_close(set, conn);
+        }
+        conn = next;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include "netbuf.h"
+
+#define EVENT_SOURCE_CLIENT 1
+#define EVENT_SOURCE_BACKEND 2
+
+// A request waiting for its reply on a backend connection. Embedded as
+// the first member of the caller's own request structure.
+typedef struct BackendRequest {
+    struct BackendRequest *next;  // Next request awaiting a reply on the same connection
+    int binary;                   // Set by the caller for binary protocol requests
+} BackendRequest;
+
+/**
+ * Called once per request with the backend's reply: a text line without
+ * the trailing newline, or a whole binary protocol message. reply is NULL
+ * if the connection failed first.
+ */
+typedef void (*backend_reply_cb)(BackendRequest *request, const char *reply, size_t len);
+
+// One non-blocking persistent connection to a cache server. Requests are
+// pipelined: replies come back in the order the requests were sent.
+typedef struct BackendConn {
+    int kind;                      // EVENT_SOURCE_BACKEND (epoll data tag)
+    char address[256];             // "ip:port"
+    int fd;                        // Socket, -1 once closed
+    int connected;                 // 0 while the non-blocking connect is in progress
+    NetBuf in;                     // Reply bytes not yet parsed
+    NetBuf out;                    // Request bytes not yet sent
+    BackendRequest *head;          // Oldest request awaiting a reply
+    BackendRequest *tail;          // Newest request awaiting a reply
+    struct BackendConn *next;      // Next connection in the same BackendSet
+} BackendConn;
+
+// Backend connections owned by one event loop thread. Each loop keeps at
+// most one connection per server, so no locking is needed.
+typedef struct BackendSet {
+    int epoll_fd;                  // Event loop the connections are registered with
+    BackendConn *conns;            // All open connections
+    BackendConn *closed;           // Closed connections, freed by backend_collect()
+    backend_reply_cb on_reply;     // Reply callback
+} BackendSet;
+
+/**
+ * Find the connection to a server, starting a non-blocking connect if
+ * there is none yet.
+ * @return The connection, or NULL if the connect failed immediately.
+ */
+BackendConn *backend_get(BackendSet *set, const char *address);
+
+/**
+ * Queue a request on a connection: a text command without trailing
+ * newline, or a whole binary protocol message if req->binary is set.
+ * @return 0 on success, -1 if the connection failed (the callback has then
+ *         been invoked with NULL for every pending request, including this one).
+ */
+int backend_send(BackendSet *set, BackendConn *conn, const char *request, size_t len, BackendRequest *req);
+
+/**
+ * Handle an epoll event for a backend connection.
+ */
+void backend_handle_event(BackendSet *set, BackendConn *conn, uint32_t events);
+
+/**
+ * Free connections closed since the last call. Closed connections are kept
+ * until then because epoll events already fetched may still point at them.
+ */
+void backend_collect(BackendSet *set);
+
+/**
+ * Close every connection whose server fails the keep predicate, failing
+ * their pending requests.
+ */
+void backend_drop_unless(BackendSet *set, int (*keep)(const char *address));
+
+#endif // BACKEND_H
@@ -3,140 +3,487 @@
 #include <string.h>
 #include <time.h>
 #include "cache.h"
+#include "clock.h"
+#include "hash.h"
 
-#define MAX_CACHE_SIZE 3
+#define HT_INITIAL_SIZE 16
+#define REHASH_STEP_BUCKETS 1   // Buckets migrated per cache operation
+#define REHASH_MAX_EMPTY_VISITS 10
+#define EXPIRE_STEP_ITEMS 4     // Expired items reclaimed per cache_set
 
-Cache *create_cache() {
-    Cache *cache = (Cache *)malloc(sizeof(Cache));
-    cache->head = cache->tail = NULL;
-    cache->size = 0;
-    return cache;
+// Hash of a NUL-terminated key. The high bits pick the shard and the low
+// bits the bucket, so fold both halves of the 64-bit hash in.
+static uint32_t key_hash(const char *key) {
+    uint64_t h = hash_xxh64(key, strlen(key), 0);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static int ht_init(HashTable *ht, size_t size) {
+    ht->buckets = (CacheItem **)calloc(size, sizeof(CacheItem *));
+    if (!ht->buckets) return -1;
+    ht->size = size;
+    ht->used = 0;
+    return 0;
+}
+
+static void ht_reset(HashTable *ht) {
+    free(ht->buckets);
+    ht->buckets = NULL;
+    ht->size = 0;
+    ht->used = 0;
 }
 
-void move_to_head(Cache *cache, CacheItem *item) {
-    if (cache->head == item) {
-        return;
+static int is_rehashing(CacheShard *shard) {
+    return shard->rehash_idx != -1;
+}
+
+// Migrate up to n buckets from ht[0] to ht[1]. Spreading the work over
+// many operations keeps a resize from stalling the server.
+static void rehash_step(CacheShard *shard, int n) {
+    int empty_visits = n * REHASH_MAX_EMPTY_VISITS;
+    HashTable *from = &shard->ht[0];
+    HashTable *to = &shard->ht[1];
+
+    while (n-- && from->used != 0) {
+        while (from->buckets[shard->rehash_idx] == NULL) {
+            shard->rehash_idx++;
+            if (--empty_visits == 0) return;
+        }
+
+        CacheItem *item = from->buckets[shard->rehash_idx];
+        while (item) {
+            CacheItem *next = item->hnext;
+            size_t idx = item->hash & (to->size - 1);
+            item->hnext = to->buckets[idx];
+            to->buckets[idx] = item;
+            from->used--;
+            to->used++;
+            item = next;
+        }
+        from->buckets[shard->rehash_idx] = NULL;
+        shard->rehash_idx++;
+    }
+
+    // Rehash finished: ht[1] becomes the main table
+    if (from->used == 0) {
+        free(from->buckets);
+        *from = *to;
+        to->buckets = NULL;
+        to->size = 0;
+        to->used = 0;
+        shard->rehash_idx = -1;
     }
+}
 
-    // Remove from current position
-    if (item->prev) item->prev->next = item->next;
-    if (item->next) item->next->prev = item->prev;
-    if (cache->tail == item) cache->tail = item->prev;
+// Start an incremental rehash into a table twice the size once the load
+// factor reaches 1.
+static void maybe_grow(CacheShard *shard) {
+    if (is_rehashing(shard)) return;
+    if (shard->ht[0].used < shard->ht[0].size) return;
+    if (ht_init(&shard->ht[1], shard->ht[0].size * 2) < 0) return; // Keep chaining on OOM
+    shard->rehash_idx = 0;
+}
 
-    // Move to head
-    item->prev = NULL;
-    item->next = cache->head;
-    if (cache->head) cache->head->prev = item;
-    cache->head = item;
+static CacheItem *ht_find(CacheShard *shard, const char *key, uint32_t h) {
+    if (is_rehashing(shard)) rehash_step(shard, REHASH_STEP_BUCKETS);
 
-    if (!cache->tail) cache->tail = item;
+    for (int t = 0; t <= 1; t++) {
+        HashTable *ht = &shard->ht[t];
+        if (ht->size == 0) break;
+        CacheItem *item = ht->buckets[h & (ht->size - 1)];
+        while (item) {
+            if (item->hash == h && strcmp(ITEM_KEY(item), key) == 0) return item;
+            item = item->hnext;
+        }
+        if (!is_rehashing(shard)) break;
+    }
+    return NULL;
 }
 
-void evict_lru(Cache *cache) {
-    if (!cache->tail) return;
+static void ht_insert(CacheShard *shard, CacheItem *item) {
+    maybe_grow(shard);
+    if (is_rehashing(shard)) rehash_step(shard, REHASH_STEP_BUCKETS);
 
-    CacheItem *to_remove = cache->tail;
-    if (cache->tail->prev) {
-        cache->tail = cache->tail->prev;
-        cache->tail->next = NULL;
-    } else {
-        cache->head = cache->tail = NULL;
+    // New items go straight into the new table while rehashing
+    HashTable *ht = is_rehashing(shard) ? &shard->ht[1] : &shard->ht[0];
+    size_t idx = item->hash & (ht->size - 1);
+    item->hnext = ht->buckets[idx];
+    ht->buckets[idx] = item;
+    ht->used++;
+}
+
+static void ht_remove(CacheShard *shard, CacheItem *item) {
+    for (int t = 0; t <= 1; t++) {
+        HashTable *ht = &shard->ht[t];
+        if (ht->size == 0) break;
+        CacheItem **link = &ht->buckets[item->hash & (ht->size - 1)];
+        while (*link) {
+            if (*link == item) {
+                *link = item->hnext;
+                ht->used--;
+                return;
+            }
+            link = &(*link)->hnext;
+        }
     }
+}
+
+// Put an item in the wheel slot for its expiry time. The level is chosen by
+// how far away the expiry is; items beyond the top level's reach wait in
+// its furthest slot and are placed again when that slot is redistributed.
+static void wheel_insert(TimingWheel *wheel, CacheItem *item) {
+    uint64_t due = (item->expiry + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    if (due < wheel->tick) due = wheel->tick; // Already due: goes in the current slot
+    uint64_t delta = due - wheel->tick;
 
-    free(to_remove);
-    cache->size--;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_SLOT_BITS * (level + 1))) level++;
+    if (delta >> (WHEEL_SLOT_BITS * WHEEL_LEVELS)) {
+        due = wheel->tick + (1ULL << (WHEEL_SLOT_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    CacheItem **slot = &wheel->slots[level][(due >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)];
+    item->tnext = *slot;
+    if (item->tnext) item->tnext->tlink = &item->tnext;
+    item->tlink = slot;
+    *slot = item;
+    wheel->count++;
+}
+
+static void wheel_remove(TimingWheel *wheel, CacheItem *item) {
+    *item->tlink = item->tnext;
+    if (item->tnext) item->tnext->tlink = item->tlink;
+    item->tlink = NULL;
+    wheel->count--;
 }
 
-void cache_set(Cache *cache, const char *key, const char *value, int ttl) {
-    // Check if the key already exists
-    CacheItem *current = cache->head;
-    while (current) {
-        if (strcmp(current->key, key) == 0) {
-            strncpy(current->value, value, MAX_VALUE_LENGTH);
-            current->expiry = ttl > 0 ? time(NULL) + ttl : 0;
-            move_to_head(cache, current);
-            return;
+// Called when the wheel enters a new tick: every level whose turn starts
+// now hands its slot down to the levels below
+static void wheel_cascade(TimingWheel *wheel) {
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (wheel->tick & ((1ULL << (WHEEL_SLOT_BITS * level)) - 1)) break;
+
+        CacheItem **slot = &wheel->slots[level][(wheel->tick >> (WHEEL_SLOT_BITS * level)) &
+                                                (WHEEL_SLOTS - 1)];
+        CacheItem *item = *slot;
+        *slot = NULL;
+        while (item) {
+            CacheItem *next = item->tnext;
+            wheel->count--;
+            wheel_insert(wheel, item);
+            item = next;
         }
-        current = current->next;
     }
+}
 
-    // Add a new item
-    CacheItem *new_item = (CacheItem *)malloc(sizeof(CacheItem));
-    strncpy(new_item->key, key, MAX_KEY_LENGTH);
-    strncpy(new_item->value, value, MAX_VALUE_LENGTH);
-    new_item->expiry = ttl > 0 ? time(NULL) + ttl : 0;
-    new_item->next = cache->head;
-    new_item->prev = NULL;
+// The first tick after the current one with work to do: a level 0 slot
+// that comes due, or a slot of a higher level that is handed down. The
+// ticks in between have empty slots and can be skipped. Each level's slots
+// cover the next WHEEL_SLOTS of its boundaries, so one turn of every level
+// is scanned. Returns UINT64_MAX if the wheel is empty.
+static uint64_t wheel_next_tick(const TimingWheel *wheel) {
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_SLOT_BITS * level;
+        uint64_t t = ((wheel->tick >> shift) + 1) << shift; // Next boundary of this level
+        for (int i = 0; i < WHEEL_SLOTS && t < next; i++, t += 1ULL << shift) {
+            if (wheel->slots[level][(t >> shift) & (WHEEL_SLOTS - 1)]) {
+                next = t;
+                break;
+            }
+        }
+    }
+    return next;
+}
 
-    if (cache->head) cache->head->prev = new_item;
-    cache->head = new_item;
-    if (!cache->tail) cache->tail = new_item;
+size_t item_size(size_t key_len, size_t value_len) {
+    return sizeof(CacheItem) + key_len + 1 + value_len + 1;
+}
 
-    cache->size++;
+// Bytes an item actually occupies: the chunk size of its slab class
+static size_t item_footprint(CacheShard *shard, CacheItem *item) {
+    return shard->slabs->classes[slab_class_of(item)].chunk_size;
+}
 
-    // Evict the least recently used item if the cache is full
-    if (cache->size > MAX_CACHE_SIZE) {
-        evict_lru(cache);
+// Unlink an item from the policy lists and the index and free its chunk
+static void remove_item(CacheShard *shard, CacheItem *item) {
+    shard->policy->removed(shard, item);
+    if (item->tlink) wheel_remove(&shard->wheel, item);
+    ht_remove(shard, item);
+    shard->mem_used -= item_footprint(shard, item);
+    slab_free(shard->slabs, item);
+    shard->size--;
+}
+
+// Evict every item on the slab page holding item, so the page can go to
+// a class that has none left. Otherwise a class short of memory only gets
+// a page once evictions in policy order happen to free every chunk of one,
+// which after a shift in value sizes empties most of the shard first.
+// Returns -1 if the page could not be scanned.
+static int empty_page(CacheShard *shard, CacheItem *item) {
+    SlabClass *cls = &shard->slabs->classes[slab_class_of(item)];
+    void **chunks = (void **)malloc(cls->per_page * sizeof(void *));
+    if (!chunks) return -1;
+    int count = slab_page_chunks(shard->slabs, item, chunks);
+    for (int i = 0; i < count; i++) remove_item(shard, (CacheItem *)chunks[i]);
+    free(chunks);
+    return count < 0 ? -1 : 0;
+}
+
+// Advance the timing wheel to now, removing items as their slots come due.
+// Runs of empty ticks are skipped in one step. Stops once budget items are
+// gone; the rest of the current slot is picked up by the next call.
+// Returns the number of items removed.
+static size_t shard_expire(CacheShard *shard, uint64_t now, size_t budget) {
+    TimingWheel *wheel = &shard->wheel;
+    uint64_t target = now / WHEEL_TICK_MS;
+    size_t removed = 0;
+
+    while (1) {
+        if (wheel->count == 0) {
+            if (wheel->tick < target) wheel->tick = target; // Nothing to visit on the way
+            return removed;
+        }
+
+        CacheItem **due = &wheel->slots[0][wheel->tick & (WHEEL_SLOTS - 1)];
+        while (*due) {
+            if (removed == budget) return removed;
+            remove_item(shard, *due);
+            shard->expired++;
+            removed++;
+        }
+        if (wheel->tick >= target) return removed;
+        uint64_t next = wheel_next_tick(wheel);
+        wheel->tick = next < target ? next : target;
+        wheel_cascade(wheel);
     }
 }
 
-char *cache_get(Cache *cache, const char *key) {
-    CacheItem *current = cache->head;
-    time_t now = time(NULL);
+static int shard_init(CacheShard *shard, size_t mem_limit, int use_huge_pages,
+                      const EvictionPolicy *policy) {
+    shard->slabs = slab_create(mem_limit, use_huge_pages);
+    if (!shard->slabs) return -1;
+    pthread_mutex_init(&shard->lock, NULL);
+    memset(shard->lists, 0, sizeof(shard->lists));
+    shard->hand = NULL;
+    shard->size = 0;
+    shard->mem_used = 0;
+    shard->mem_limit = shard->slabs->arena_size;
+    memset(shard->ht, 0, sizeof(shard->ht));
+    if (ht_init(&shard->ht[0], HT_INITIAL_SIZE) < 0) {
+        slab_destroy(shard->slabs);
+        pthread_mutex_destroy(&shard->lock);
+        return -1;
+    }
+    shard->rehash_idx = -1;
+    memset(&shard->wheel, 0, sizeof(shard->wheel));
+    shard->wheel.tick = clock_now_ms() / WHEEL_TICK_MS;
+    shard->expired = 0;
 
-    while (current) {
-        if (strcmp(current->key, key) == 0) {
-            // Check if the item has expired
-            if (current->expiry != 0 && current->expiry <= now) {
-                cache_delete(cache, key); // Remove expired item
-                return NULL;
-            }
+    shard->policy = policy;
+    if (policy->init && policy->init(shard) < 0) {
+        slab_destroy(shard->slabs);
+        ht_reset(&shard->ht[0]);
+        pthread_mutex_destroy(&shard->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void shard_destroy(CacheShard *shard) {
+    if (shard->policy->destroy) shard->policy->destroy(shard);
+    // Item memory lives in the slab arena and goes away with it
+    slab_destroy(shard->slabs);
+    ht_reset(&shard->ht[0]);
+    ht_reset(&shard->ht[1]);
+    pthread_mutex_destroy(&shard->lock);
+}
+
+static int shard_set(CacheShard *shard, const char *key, uint32_t h, const char *value,
+                     uint32_t ttl_ms) {
+    uint64_t now = clock_now_ms();
+    size_t key_len = strlen(key);
+    size_t value_len = strlen(value);
+    int class_id = slab_class_for(shard->slabs, item_size(key_len, value_len));
+    if (class_id < 0) return -1;
+
+    // Replace any existing item; the new one may have a different size
+    CacheItem *current = ht_find(shard, key, h);
+    if (current) remove_item(shard, current);
+
+    // Reclaim a few expired items before considering live ones for eviction
+    shard_expire(shard, now, EXPIRE_STEP_ITEMS);
+
+    // Evict until the item's size class has a free chunk. A victim of
+    // another class gives up its whole page, which then moves to this class.
+    CacheItem *new_item;
+    while (!(new_item = (CacheItem *)slab_alloc(shard->slabs, class_id))) {
+        CacheItem *victim = shard->policy->victim(shard, class_id);
+        if (!victim) return -1;
+        if (slab_class_of(victim) == class_id || empty_page(shard, victim) < 0) remove_item(shard, victim);
+    }
+
+    new_item->key_len = key_len;
+    new_item->value_len = value_len;
+    memcpy(ITEM_KEY(new_item), key, key_len + 1);
+    memcpy(ITEM_VALUE(new_item), value, value_len + 1);
+    new_item->expiry = ttl_ms > 0 ? now + ttl_ms : 0;
+    new_item->tlink = NULL;
+    if (new_item->expiry) wheel_insert(&shard->wheel, new_item);
+    new_item->hash = h;
+
+    ht_insert(shard, new_item);
+    shard->size++;
+    shard->mem_used += shard->slabs->classes[class_id].chunk_size;
+    shard->policy->inserted(shard, new_item);
+    return 0;
+}
+
+static ssize_t shard_get(CacheShard *shard, const char *key, uint32_t h, char *buf, size_t buf_size) {
+    if (shard->policy->record) shard->policy->record(shard, h);
+    CacheItem *current = ht_find(shard, key, h);
+    if (!current) return -1; // Key not found
+
+    // Check if the item has expired
+    if (current->expiry != 0 && current->expiry <= clock_now_ms()) {
+        remove_item(shard, current); // Remove expired item
+        shard->expired++;
+        return -1;
+    }
+
+    shard->policy->accessed(shard, current);
+
+    if (buf_size > 0) {
+        size_t n = current->value_len < buf_size - 1 ? current->value_len : buf_size - 1;
+        memcpy(buf, ITEM_VALUE(current), n);
+        buf[n] = '\0';
+    }
+    return current->value_len;
+}
+
+static void shard_delete(CacheShard *shard, const char *key, uint32_t h) {
+    CacheItem *current = ht_find(shard, key, h);
+    if (current) remove_item(shard, current);
+}
+
+// Shards are picked by the high bits of the hash; the index uses the low bits
+static CacheShard *shard_for(Cache *cache, uint32_t h) {
+    return &cache->shards[((uint64_t)h * cache->shard_count) >> 32];
+}
+
+Cache *create_cache(size_t mem_limit, int shard_count, int use_huge_pages,
+                    const EvictionPolicy *policy) {
+    if (shard_count < 1) shard_count = 1;
+    if (!policy) policy = find_eviction_policy(DEFAULT_EVICTION_POLICY);
 
-            // Move the accessed item to the head
-            move_to_head(cache, current);
-            return current->value;
+    Cache *cache = (Cache *)malloc(sizeof(Cache));
+    if (!cache) return NULL;
+    cache->shards = (CacheShard *)calloc(shard_count, sizeof(CacheShard));
+    cache->shard_count = 0;
+    if (!cache->shards) {
+        free(cache);
+        return NULL;
+    }
+
+    for (int i = 0; i < shard_count; i++) {
+        if (shard_init(&cache->shards[i], mem_limit / shard_count, use_huge_pages, policy) < 0) {
+            free_cache(cache);
+            return NULL;
         }
-        current = current->next;
+        cache->shard_count++;
     }
+    return cache;
+}
+
+int cache_set(Cache *cache, const char *key, const char *value, uint32_t ttl_ms) {
+    uint32_t h = key_hash(key);
+    CacheShard *shard = shard_for(cache, h);
 
-    return NULL; // Key not found
+    pthread_mutex_lock(&shard->lock);
+    int result = shard_set(shard, key, h, value, ttl_ms);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+ssize_t cache_get(Cache *cache, const char *key, char *buf, size_t buf_size) {
+    uint32_t h = key_hash(key);
+    CacheShard *shard = shard_for(cache, h);
+
+    pthread_mutex_lock(&shard->lock);
+    ssize_t result = shard_get(shard, key, h, buf, buf_size);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
 }
 
 void cache_delete(Cache *cache, const char *key) {
-    CacheItem *current = cache->head;
-
-    while (current) {
-        if (strcmp(current->key, key) == 0) {
-            // Unlink the item from the list
-            if (current->prev) {
-                current->prev->next = current->next;
-            } else {
-                cache->head = current->next;
-            }
+    uint32_t h = key_hash(key);
+    CacheShard *shard = shard_for(cache, h);
 
-            if (current->next) {
-                current->next->prev = current->prev;
-            } else {
-                cache->tail = current->prev;
-            }
+    pthread_mutex_lock(&shard->lock);
+    shard_delete(shard, key, h);
+    pthread_mutex_unlock(&shard->lock);
+}
 
-            // Free the memory and update the size
-            free(current);
-            cache->size--;
-            return;
+size_t cache_expire(Cache *cache, size_t budget) {
+    uint64_t now = clock_now_ms();
+    size_t removed = 0;
+
+    for (int i = 0; i < cache->shard_count; i++) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        removed += shard_expire(shard, now, budget);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return removed;
+}
+
+void cache_foreach_shard(Cache *cache, int index, cache_visit_fn visit, void *arg) {
+    CacheShard *shard = &cache->shards[index];
+    uint64_t now = clock_now_ms();
+
+    pthread_mutex_lock(&shard->lock);
+    for (int l = 0; l < POLICY_LISTS; l++) {
+        for (CacheItem *item = shard->lists[l].tail; item; item = item->prev) {
+            if (item->expiry != 0 && item->expiry <= now) continue;
+            uint64_t ttl = item->expiry ? item->expiry - now : 0;
+            visit(item, ttl > UINT32_MAX ? UINT32_MAX : (uint32_t)ttl, arg);
         }
-        current = current->next;
     }
+    pthread_mutex_unlock(&shard->lock);
 }
 
-void free_cache(Cache *cache) {
-    CacheItem *current = cache->head;
+size_t cache_stats(Cache *cache, char *buf, size_t len) {
+    SlabAllocator *slabs[cache->shard_count];
+    size_t items = 0, mem_used = 0, mem_limit = 0, ttl_items = 0;
+    unsigned long long expired = 0;
 
-    while (current) {
-        CacheItem *to_free = current;
-        current = current->next;
-        free(to_free);
+    // Shards are locked one at a time, so totals are not an atomic snapshot
+    for (int i = 0; i < cache->shard_count; i++) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        items += shard->size;
+        mem_used += shard->mem_used;
+        mem_limit += shard->mem_limit;
+        ttl_items += shard->wheel.count;
+        expired += shard->expired;
+        pthread_mutex_unlock(&shard->lock);
+        slabs[i] = shard->slabs;
     }
 
+    int n = snprintf(buf, len, "items %zu bytes %zu/%zu shards %d ttl_items %zu expired %llu\n",
+                     items, mem_used, mem_limit, cache->shard_count, ttl_items, expired);
+    if (n < 0 || (size_t)n >= len) return len ? strlen(buf) : 0;
+
+    for (int i = 0; i < cache->shard_count; i++) pthread_mutex_lock(&cache->shards[i].lock);
+    n += slab_stats(slabs, cache->shard_count, buf + n, len - n);
+    for (int i = 0; i < cache->shard_count; i++) pthread_mutex_unlock(&cache->shards[i].lock);
+    return n;
+}
+
+void free_cache(Cache *cache) {
+    for (int i = 0; i < cache->shard_count; i++) {
+        shard_destroy(&cache->shards[i]);
+    }
+    free(cache->shards);
     free(cache);
 }
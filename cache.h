@@ -1,49 +1,162 @@
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "sketch.h"
+#include "slab.h"
 
-#define MAX_KEY_LENGTH 256
-#define MAX_VALUE_LENGTH 256
-
-// Cache item structure
+// Cache item structure. Key and value are stored inline after the header
+// as two NUL-terminated strings in a slab chunk of the smallest class that
+// holds item_size() bytes.
 typedef struct CacheItem {
-    char key[MAX_KEY_LENGTH];          // Key of the cache item
-    char value[MAX_VALUE_LENGTH];      // Value of the cache item
-    time_t expiry;                     // Expiry time (0 if no expiry)
-    struct CacheItem *next;            // Pointer to the next item (for LRU)
-    struct CacheItem *prev;            // Pointer to the previous item (for LRU)
+    uint64_t expiry;                   // Expiry time in clock_now_ms() milliseconds (0 if no expiry)
+    struct CacheItem *next;            // Next (older) item in its eviction policy list
+    struct CacheItem *prev;            // Previous (newer) item in its eviction policy list
+    struct CacheItem *hnext;           // Next item in the same hash bucket
+    struct CacheItem *tnext;           // Next item in the same timing wheel slot
+    struct CacheItem **tlink;          // Link pointing at this item in its wheel slot, NULL if none
+    uint32_t hash;                     // Cached hash of the key
+    uint32_t key_len;                  // Key length, excluding the NUL
+    uint32_t value_len;                // Value length, excluding the NUL
+    uint8_t list;                      // Index of the policy list holding the item
+    uint8_t referenced;                // CLOCK: hit since the hand last passed
+    char data[];                       // key '\0' value '\0'
 } CacheItem;
 
-// Cache structure
-typedef struct Cache {
+#define ITEM_KEY(item) ((item)->data)
+#define ITEM_VALUE(item) ((item)->data + (item)->key_len + 1)
+
+// Hash index table (chained buckets, power-of-two sized)
+typedef struct HashTable {
+    CacheItem **buckets;  // Bucket array
+    size_t size;          // Number of buckets (0 if unallocated)
+    size_t used;          // Number of items stored in this table
+} HashTable;
+
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_TICK_MS 1  // Resolution of active expiry
+
+// Hierarchical timing wheel of items with a TTL. Level 0 has one slot per
+// tick; each slot of level n covers a whole turn of level n - 1 and is
+// redistributed into the level below when that turn begins. Insertion,
+// removal and expiry are O(1) per item.
+typedef struct TimingWheel {
+    CacheItem *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t tick;     // Current tick; its level 0 slot holds items already due
+    size_t count;      // Items in the wheel
+} TimingWheel;
+
+// Items in recency order. Eviction policies keep one or more per shard.
+typedef struct ItemList {
     CacheItem *head;   // Most recently used item
     CacheItem *tail;   // Least recently used item
-    int size;          // Current size of the cache
+    size_t bytes;      // Bytes of slab chunks used by the items
+} ItemList;
+
+#define POLICY_LISTS 3
+
+typedef struct EvictionPolicy EvictionPolicy;
+
+// One independently locked partition of the cache
+typedef struct CacheShard {
+    pthread_mutex_t lock;  // Protects everything in the shard
+    const EvictionPolicy *policy;
+    ItemList lists[POLICY_LISTS]; // Policy lists; which are used depends on the policy
+    CacheItem *hand;   // CLOCK: next item the hand inspects
+    CountMinSketch sketch; // W-TinyLFU: access frequency of recently seen keys
+    int size;          // Number of items in the shard
+    size_t mem_used;   // Bytes of slab chunks used by items
+    size_t mem_limit;  // Memory budget in bytes
+    SlabAllocator *slabs;  // Allocator for item memory
+    HashTable ht[2];   // Hash index; ht[1] is only used while rehashing
+    long rehash_idx;   // Next ht[0] bucket to migrate, -1 if not rehashing
+    TimingWheel wheel; // Items with a TTL, by expiry time
+    uint64_t expired;  // Items removed because their TTL ran out
+} CacheShard;
+
+// An eviction policy. All hooks run with the shard lock held; cache.c
+// keeps the index and the memory accounting, the policy only orders items.
+struct EvictionPolicy {
+    const char *name;
+    // Set up and tear down per-shard state (optional)
+    int (*init)(CacheShard *shard);
+    void (*destroy)(CacheShard *shard);
+    // A key with this hash was looked up, hit or miss (optional)
+    void (*record)(CacheShard *shard, uint32_t hash);
+    // Link a newly stored item
+    void (*inserted)(CacheShard *shard, CacheItem *item);
+    // The item was read
+    void (*accessed)(CacheShard *shard, CacheItem *item);
+    // Unlink an item about to be freed
+    void (*removed)(CacheShard *shard, CacheItem *item);
+    // Next item to evict, preferably of slab class class_id; NULL if none.
+    // A victim of another class has its whole slab page evicted.
+    CacheItem *(*victim)(CacheShard *shard, int class_id);
+};
+
+// Default eviction policy
+#define DEFAULT_EVICTION_POLICY "lru"
+
+// All eviction policies ("lru", "slru", "clock", "tinylfu"), terminated by NULL
+extern const EvictionPolicy *const eviction_policies[];
+
+/**
+ * Look up an eviction policy by name.
+ * @return The policy, or NULL if the name is unknown.
+ */
+const EvictionPolicy *find_eviction_policy(const char *name);
+
+// Cache structure. Keys are spread over shards by hash so threads working
+// on different keys rarely contend on the same lock.
+typedef struct Cache {
+    CacheShard *shards;  // Array of shards
+    int shard_count;     // Number of shards
 } Cache;
 
 /**
  * Create a new cache.
- * @return Pointer to the newly created cache.
+ * @param mem_limit Memory budget for items in bytes, split evenly between
+ *        shards (each shard gets at least one slab page).
+ * @param shard_count Number of independently locked shards.
+ * @param use_huge_pages Try to back item memory with huge pages.
+ * @param policy Eviction policy, or NULL for the default.
+ * @return Pointer to the newly created cache, or NULL if its memory cannot be reserved.
+ */
+Cache *create_cache(size_t mem_limit, int shard_count, int use_huge_pages,
+                    const EvictionPolicy *policy);
+
+/**
+ * Number of bytes an item with the given key and value lengths occupies.
  */
-Cache *create_cache();
+size_t item_size(size_t key_len, size_t value_len);
 
 /**
  * Set a key-value pair in the cache.
  * @param cache Pointer to the cache.
  * @param key The key to set.
  * @param value The value to set.
- * @param ttl Time-to-live in seconds (0 for no expiry).
+ * @param ttl_ms Time-to-live in milliseconds (0 for no expiry).
+ * @return 0 if stored, -1 if the item is larger than the largest slab chunk.
  */
-void cache_set(Cache *cache, const char *key, const char *value, int ttl);
+int cache_set(Cache *cache, const char *key, const char *value, uint32_t ttl_ms);
 
 /**
  * Get the value associated with a key from the cache.
+ * The value is copied out under the shard lock, snprintf-style: at most
+ * buf_size - 1 bytes are written and the result is always NUL-terminated.
  * @param cache Pointer to the cache.
  * @param key The key to retrieve.
- * @return Pointer to the value if found and not expired; NULL otherwise.
+ * @param buf Buffer receiving the value.
+ * @param buf_size Size of buf.
+ * @return Full length of the value if found and not expired; -1 otherwise.
  */
-char *cache_get(Cache *cache, const char *key);
+ssize_t cache_get(Cache *cache, const char *key, char *buf, size_t buf_size);
 
 /**
  * Delete a key from the cache.
@@ -52,6 +165,35 @@ char *cache_get(Cache *cache, const char *key);
  */
 void cache_delete(Cache *cache, const char *key);
 
+/**
+ * Reclaim expired items. Each shard's timing wheel is advanced to the
+ * current time, removing at most budget items per shard so the shard lock
+ * is never held for long; call it periodically to keep up.
+ * @param cache Pointer to the cache.
+ * @param budget Most items removed per shard in this call.
+ * @return Number of items removed.
+ */
+size_t cache_expire(Cache *cache, size_t budget);
+
+// Called for each live item; ttl_ms is its remaining time to live (0 if none)
+typedef void (*cache_visit_fn)(const CacheItem *item, uint32_t ttl_ms, void *arg);
+
+/**
+ * Visit the live items of one shard, least recently used first: the
+ * policy lists in index order, each from tail to head. The shard is locked
+ * throughout, so the visitor should only copy what it needs.
+ * @param index Shard index, below cache->shard_count.
+ */
+void cache_foreach_shard(Cache *cache, int index, cache_visit_fn visit, void *arg);
+
+/**
+ * Format item counts and slab occupancy summed over all shards.
+ * @param buf Output buffer.
+ * @param len Size of the output buffer.
+ * @return Number of bytes written (excluding the NUL).
+ */
+size_t cache_stats(Cache *cache, char *buf, size_t len);
+
 /**
  * Free all memory associated with the cache.
  * @param cache Pointer to the cache.
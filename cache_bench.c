@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "cache.h"
+
+// Cache contention benchmark: runs a 90% get / 10% set workload against one
+// shared Cache with 1, 2, 4, ... threads and reports throughput scaling.
+
+#define VALUE_LENGTH 100
+#define GET_PERCENT 90
+
+typedef struct BenchThread {
+    Cache *cache;
+    int key_count;
+    unsigned long long ops;
+    unsigned int seed;
+} BenchThread;
+
+static atomic_int running;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_worker(void *arg) {
+    BenchThread *t = (BenchThread *)arg;
+    char key[32], value[VALUE_LENGTH + 1], buf[VALUE_LENGTH + 1];
+    unsigned long long ops = 0;
+
+    memset(value, 'v', VALUE_LENGTH);
+    value[VALUE_LENGTH] = '\0';
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        // Check the stop flag only every 256 operations
+        for (int i = 0; i < 256; i++) {
+            snprintf(key, sizeof(key), "key:%d", rand_r(&t->seed) % t->key_count);
+            if (rand_r(&t->seed) % 100 < GET_PERCENT) {
+                cache_get(t->cache, key, buf, sizeof(buf));
+            } else {
+                cache_set(t->cache, key, value, 0);
+            }
+        }
+        ops += 256;
+    }
+
+    t->ops = ops;
+    return NULL;
+}
+
+static double run(Cache *cache, int threads, int key_count, double seconds) {
+    pthread_t tids[threads];
+    BenchThread args[threads];
+
+    atomic_store(&running, 1);
+    for (int i = 0; i < threads; i++) {
+        args[i].cache = cache;
+        args[i].key_count = key_count;
+        args[i].ops = 0;
+        args[i].seed = 12345 + i;
+        pthread_create(&tids[i], NULL, bench_worker, &args[i]);
+    }
+
+    double start = now_seconds();
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&running, 0);
+
+    unsigned long long total = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        total += args[i].ops;
+    }
+    return total / (now_seconds() - start);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t <max_threads>] [-s <shards>] [-k <keys>] [-m <memory_mb>] [-d <seconds>] [-e <policy>]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int shard_count = 16;
+    int key_count = 100000;
+    size_t memory_mb = 64;
+    double seconds = 2.0;
+    const EvictionPolicy *policy = find_eviction_policy(DEFAULT_EVICTION_POLICY);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:k:m:d:e:")) != -1) {
+        switch (opt) {
+        case 't': max_threads = atoi(optarg); break;
+        case 's': shard_count = atoi(optarg); break;
+        case 'k': key_count = atoi(optarg); break;
+        case 'm': memory_mb = strtoul(optarg, NULL, 10); break;
+        case 'd': seconds = atof(optarg); break;
+        case 'e': policy = find_eviction_policy(optarg); break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (max_threads < 1 || key_count < 1 || shard_count < 1 || !policy) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Cache *cache = create_cache(memory_mb * 1024 * 1024, shard_count, 0, policy);
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate cache memory\n");
+        return EXIT_FAILURE;
+    }
+
+    // Preload so gets mostly hit
+    char key[32], value[VALUE_LENGTH + 1];
+    memset(value, 'v', VALUE_LENGTH);
+    value[VALUE_LENGTH] = '\0';
+    for (int i = 0; i < key_count; i++) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        cache_set(cache, key, value, 0);
+    }
+
+    printf("shards %d keys %d get%% %d duration %.1fs policy %s\n", shard_count, key_count,
+           GET_PERCENT, seconds, policy->name);
+    printf("%8s %14s %10s\n", "threads", "ops/s", "speedup");
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads != max_threads ? max_threads : threads * 2) {
+        double rate = run(cache, threads, key_count, seconds);
+        if (threads == 1) base = rate;
+        printf("%8d %14.0f %9.2fx\n", threads, rate, rate / base);
+        if (threads == max_threads) break;
+    }
+
+    free_cache(cache);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cachedump.h"
+#include "netbuf.h"
+
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER; // One dump at a time per process
+
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Items of one shard, copied under its lock and written to the file after
+typedef struct DumpBuffer {
+    NetBuf buf;
+    uint64_t count;
+    int failed;
+} DumpBuffer;
+
+static void copy_item(const CacheItem *item, uint32_t ttl_ms, void *arg) {
+    DumpBuffer *dump = (DumpBuffer *)arg;
+    CacheDumpRecord record = {item->key_len, item->value_len, ttl_ms};
+    if (netbuf_append(&dump->buf, &record, sizeof(record)) < 0 ||
+        netbuf_append(&dump->buf, item->data, item->key_len + 1 + item->value_len + 1) < 0) {
+        dump->failed = 1;
+        return;
+    }
+    dump->count++;
+}
+
+// fsync the directory holding path so a rename into it is durable
+static void sync_parent(const char *path) {
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", path);
+    int dir_fd = open(dirname(copy), O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+long cache_dump(Cache *cache, const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    pthread_mutex_lock(&dump_lock);
+    FILE *file = fopen(tmp, "w");
+    if (!file) {
+        perror("Failed to create cache dump");
+        pthread_mutex_unlock(&dump_lock);
+        return -1;
+    }
+
+    CacheDumpHeader header = {CACHEDUMP_MAGIC, wall_clock_ms(), 0, cache->shard_count};
+    DumpBuffer dump = {{0}, 0, 0};
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+    for (int i = 0; i < cache->shard_count && !failed; i++) {
+        dump.count = 0;
+        cache_foreach_shard(cache, i, copy_item, &dump);
+        CacheDumpSection section = {dump.count, dump.buf.len};
+        if (dump.failed || fwrite(&section, sizeof(section), 1, file) != 1 ||
+            (dump.buf.len > 0 && fwrite(NETBUF_PTR(&dump.buf), dump.buf.len, 1, file) != 1)) {
+            failed = 1;
+        }
+        header.count += dump.count;
+        netbuf_consume(&dump.buf, dump.buf.len);
+    }
+    netbuf_free(&dump.buf);
+
+    if (!failed) {
+        rewind(file);
+        if (fwrite(&header, sizeof(header), 1, file) != 1 || fflush(file) != 0 ||
+            fsync(fileno(file)) < 0) {
+            failed = 1;
+        }
+    }
+    if (fclose(file) != 0) failed = 1;
+    if (failed || rename(tmp, path) < 0) {
+        perror("Failed to write cache dump");
+        unlink(tmp);
+        pthread_mutex_unlock(&dump_lock);
+        return -1;
+    }
+    sync_parent(path);
+    pthread_mutex_unlock(&dump_lock);
+    return (long)header.count;
+}
+
+// Read position in one section of a mapped dump
+typedef struct SectionCursor {
+    const char *next;
+    const char *end;
+    uint64_t done;
+    uint64_t count;
+} SectionCursor;
+
+// Section that is furthest behind, relative to its length; NULL once all
+// are done. Shards hold keys spread by hash, so taking records from each
+// at the same relative pace approximates the cache-wide recency order.
+static SectionCursor *next_section(SectionCursor *cursors, uint64_t sections) {
+    SectionCursor *pick = NULL;
+    for (uint64_t i = 0; i < sections; i++) {
+        SectionCursor *c = &cursors[i];
+        if (c->done == c->count) continue;
+        if (!pick || c->done * pick->count < pick->done * c->count) pick = c;
+    }
+    return pick;
+}
+
+long cache_restore(Cache *cache, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CacheDumpHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map cache dump");
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED); // Sections are read in parallel
+
+    const char *data = (const char *)map;
+    size_t size = st.st_size;
+    CacheDumpHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CACHEDUMP_MAGIC, sizeof(header.magic)) != 0 ||
+        header.sections > size / sizeof(CacheDumpSection)) {
+        fprintf(stderr, "Ignoring invalid cache dump %s\n", path);
+        munmap(map, size);
+        return -1;
+    }
+
+    // Records are unaligned, so section and record headers are copied out
+    SectionCursor *cursors = (SectionCursor *)calloc(header.sections ? header.sections : 1,
+                                                     sizeof(SectionCursor));
+    size_t offset = sizeof(header);
+    int corrupt = 0;
+    for (uint64_t i = 0; i < header.sections; i++) {
+        CacheDumpSection section;
+        if (size - offset < sizeof(section)) {
+            corrupt = 1;
+            break;
+        }
+        memcpy(&section, data + offset, sizeof(section));
+        offset += sizeof(section);
+        if (size - offset < section.bytes) {
+            corrupt = 1;
+            break;
+        }
+        cursors[i].next = data + offset;
+        cursors[i].end = data + offset + section.bytes;
+        cursors[i].count = section.count;
+        offset += section.bytes;
+    }
+
+    uint64_t now = wall_clock_ms();
+    uint64_t elapsed = now > header.saved_at ? now - header.saved_at : 0;
+    long restored = 0;
+    SectionCursor *c;
+
+    // Keys and values are NUL-terminated in the file and go to the cache
+    // straight from the map
+    while ((c = next_section(cursors, header.sections))) {
+        CacheDumpRecord record;
+        size_t body = 0;
+        if ((size_t)(c->end - c->next) >= sizeof(record)) {
+            memcpy(&record, c->next, sizeof(record));
+            body = (size_t)record.key_len + 1 + record.value_len + 1;
+        }
+        const char *key = c->next + sizeof(record);
+        if (body == 0 || (size_t)(c->end - key) < body || key[record.key_len] != '\0' ||
+            key[body - 1] != '\0') {
+            c->done = c->count; // Give up on the rest of this section
+            corrupt = 1;
+            continue;
+        }
+        c->next = key + body;
+        c->done++;
+
+        if (record.ttl_ms != 0 && record.ttl_ms <= elapsed) continue; // Ran out while down
+        uint32_t ttl_ms = record.ttl_ms ? record.ttl_ms - (uint32_t)elapsed : 0;
+        if (cache_set(cache, key, key + record.key_len + 1, ttl_ms) == 0) restored++;
+    }
+    if (corrupt) fprintf(stderr, "Cache dump %s is truncated or corrupt\n", path);
+
+    free(cursors);
+    munmap(map, size);
+    return restored;
+}
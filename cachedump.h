@@ -0,0 +1,50 @@
+#ifndef CACHEDUMP_H
+#define CACHEDUMP_H
+
+#include <stdint.h>
+#include "cache.h"
+
+#define CACHEDUMP_MAGIC "CACHED1"
+
+// Warm-restart file of a cache server, in native byte order:
+//   CacheDumpHeader
+//   CacheDumpSection                      One per shard, followed by the
+//   CacheDumpRecord key '\0' value '\0'   shard's items, unpadded, least
+//   ...                                   recently used first
+typedef struct CacheDumpHeader {
+    char magic[8];
+    uint64_t saved_at;     // CLOCK_REALTIME milliseconds when the dump was taken
+    uint64_t count;        // Number of records in all sections
+    uint64_t sections;     // Number of sections
+} CacheDumpHeader;
+
+typedef struct CacheDumpSection {
+    uint64_t count;        // Records in the section
+    uint64_t bytes;        // Size of the records
+} CacheDumpSection;
+
+typedef struct CacheDumpRecord {
+    uint32_t key_len;
+    uint32_t value_len;
+    uint32_t ttl_ms;       // Time to live left at saved_at, 0 for no expiry
+} CacheDumpRecord;
+
+/**
+ * Write every live item of a cache to a dump file. The file is written
+ * next to path and renamed into place once synced, so a crash midway
+ * leaves the previous dump intact. Shards are copied one at a time.
+ * @return Number of items written, or -1 on failure.
+ */
+long cache_dump(Cache *cache, const char *path);
+
+/**
+ * Store the items of a dump file in a cache, least recently used first so
+ * the recency order survives, even with a different shard count: sections
+ * are merged in proportion to their length. TTLs are shortened by the time
+ * since the dump was taken and items that have run out meanwhile are
+ * skipped.
+ * @return Number of items restored, or -1 if the file is missing or invalid.
+ */
+long cache_restore(Cache *cache, const char *path);
+
+#endif // CACHEDUMP_H
@@ -3,12 +3,115 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <getopt.h>
 #include <pthread.h>
+#include "netbuf.h"
+#include "proto.h"
 
 #define BUFFER_SIZE 1024
 #define LOAD_BALANCER_ADDRESS "127.0.0.1"
 #define LOAD_BALANCER_PORT 9090
 
+int binary_mode = 0; // Speak the binary protocol instead of text commands
+
+// Encode "mget <key>..." or "mset <key> <value>..." as a binary request
+static int encode_multi(uint8_t opcode, const char *args, NetBuf *out) {
+    NetBuf body = {0};
+    int count = 0;
+    while (*args) {
+        size_t len = strcspn(args, " ");
+        if (len > 0) {
+            if (opcode == PROTO_OP_MSET && count % 2 == 1) {
+                proto_put_value(&body, args, len);
+            } else {
+                proto_put_key(&body, args, len);
+            }
+            count++;
+        }
+        args += len + (args[len] == ' ');
+    }
+
+    int valid = count > 0 && (opcode == PROTO_OP_MGET || count % 2 == 0);
+    if (valid) valid = proto_write(out, PROTO_MAGIC_REQUEST, opcode, 0, 0, NULL, 0, NETBUF_PTR(&body), body.len) == 0;
+    netbuf_free(&body);
+    return valid ? 0 : -1;
+}
+
+// Encode a text command ("get <key>", "set <key> <value>", "delete <key>",
+// "mget <key>...", "mset <key> <value>...", "ping" or "stats") as a binary
+// request. The value of a set is the rest of the line, so it may contain
+// spaces. Returns -1 for an unknown command or one too large to send.
+static int encode_binary(const char *command, NetBuf *out) {
+    char name[16] = {0};
+    int skip = 0;
+    sscanf(command, " %15s %n", name, &skip);
+    if (strcmp(name, "mget") == 0) return encode_multi(PROTO_OP_MGET, command + skip, out);
+    if (strcmp(name, "mset") == 0) return encode_multi(PROTO_OP_MSET, command + skip, out);
+
+    const char *key = command + skip;
+    size_t key_len = strcspn(key, " ");
+    const char *value = key + key_len + (key[key_len] == ' ');
+
+    uint8_t opcode;
+    if (strcmp(name, "get") == 0) {
+        opcode = PROTO_OP_GET;
+    } else if (strcmp(name, "set") == 0) {
+        opcode = PROTO_OP_SET;
+    } else if (strcmp(name, "delete") == 0) {
+        opcode = PROTO_OP_DELETE;
+    } else if (strcmp(name, "ping") == 0) {
+        opcode = PROTO_OP_NOOP;
+    } else if (strcmp(name, "stats") == 0) {
+        opcode = PROTO_OP_STATS;
+    } else {
+        return -1;
+    }
+    if (opcode != PROTO_OP_SET) value = "";
+
+    return proto_write(out, PROTO_MAGIC_REQUEST, opcode, 0, 0, key, key_len, value, strlen(value));
+}
+
+// Send one binary request and print its response
+static void send_binary(int sock, const char *command) {
+    NetBuf request = {0}, reply = {0};
+    if (encode_binary(command, &request) < 0) {
+        printf("Response to '%s': Invalid command\n", command);
+        netbuf_free(&request);
+        return;
+    }
+    send(sock, NETBUF_PTR(&request), request.len, 0);
+    netbuf_free(&request);
+
+    ProtoMessage msg;
+    ssize_t size;
+    while ((size = proto_parse(NETBUF_PTR(&reply), reply.len, &msg)) == 0) {
+        char buffer[BUFFER_SIZE];
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        netbuf_append(&reply, buffer, n);
+    }
+
+    if (size <= 0) {
+        printf("Response to '%s': Error: Incomplete response\n", command);
+    } else if (msg.status != PROTO_STATUS_OK) {
+        printf("Response to '%s': %s\n", command, proto_status_name(msg.status));
+    } else if (msg.opcode == PROTO_OP_MGET) {
+        ProtoCursor cursor = {msg.value, msg.value + msg.value_len};
+        const char *value;
+        size_t len;
+        printf("Response to '%s':", command);
+        while (proto_next_value(&cursor, &value, &len) == 1) {
+            printf(" %.*s", value ? (int)len : 4, value ? value : "null");
+        }
+        printf("\n");
+    } else if (msg.value_len > 0) {
+        printf("Response to '%s': %.*s\n", command, (int)msg.value_len, msg.value);
+    } else {
+        printf("Response to '%s': OK\n", command);
+    }
+    netbuf_free(&reply);
+}
+
 // Function to send a single command to the load balancer
 void send_to_load_balancer(const char *command) {
     int sock;
@@ -30,6 +133,12 @@ void send_to_load_balancer(const char *command) {
         return;
     }
 
+    if (binary_mode) {
+        send_binary(sock, command);
+        close(sock);
+        return;
+    }
+
     send(sock, command, strlen(command), 0);
     int bytes_received = recv(sock, buffer, BUFFER_SIZE - 1, 0);
     if (bytes_received > 0) {
@@ -113,9 +222,20 @@ void process_batch_file(const char *filename) {
     fclose(file);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     char input[BUFFER_SIZE];
 
+    int opt;
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        if (opt == 'b') {
+            binary_mode = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+            fprintf(stderr, "  -b  Use the binary protocol\n");
+            return EXIT_FAILURE;
+        }
+    }
+
     while (1) {
         printf("Enter command (use '&&' for concurrency, 'exit' to quit): ");
         fgets(input, BUFFER_SIZE, stdin);
@@ -0,0 +1,47 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "clock.h"
+
+static _Atomic uint64_t cached_ms;  // Last value published by the clock thread
+static atomic_int running;          // Clock thread is publishing cached_ms
+static int tick_ms;
+
+static uint64_t read_clock(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *clock_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        usleep(tick_ms * 1000);
+        atomic_store_explicit(&cached_ms, read_clock(CLOCK_MONOTONIC), memory_order_relaxed);
+    }
+    return NULL;
+}
+
+int clock_start(int resolution_ms) {
+    if (atomic_load(&running)) return 0;
+    tick_ms = resolution_ms > 0 ? resolution_ms : 1;
+    atomic_store(&cached_ms, read_clock(CLOCK_MONOTONIC));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, clock_thread, NULL) != 0) {
+        perror("Failed to create clock thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    atomic_store(&running, 1);
+    return 0;
+}
+
+uint64_t clock_now_ms(void) {
+    if (atomic_load_explicit(&running, memory_order_relaxed)) {
+        return atomic_load_explicit(&cached_ms, memory_order_relaxed);
+    }
+    return read_clock(CLOCK_MONOTONIC_COARSE);
+}
@@ -0,0 +1,21 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * Start a thread that refreshes the coarse clock every resolution_ms
+ * milliseconds. Until it runs, clock_now_ms() reads the kernel's coarse
+ * monotonic clock directly.
+ * @return 0 on success, -1 if the thread cannot be created.
+ */
+int clock_start(int resolution_ms);
+
+/**
+ * Milliseconds on a monotonic clock, at most one resolution step stale.
+ * Cheap enough to call on every cache operation: once the clock thread
+ * runs this is a single atomic load.
+ */
+uint64_t clock_now_ms(void);
+
+#endif // CLOCK_H
@@ -2,67 +2,230 @@
 #include <stdlib.h>
 #include <string.h>
 #include <openssl/evp.h>  // For EVP interface
+#include "hash.h"
 #include "conhash.h"
 
-// Hash a string using EVP for MD5
-uint32_t hash(const char *key) {
+// Hash a string using EVP for MD5. The value is the first 8 digest bytes,
+// read big-endian. Its high 32 bits are the first 4 bytes, which older
+// versions used as the whole position, so points keep their old order
+// except where the old positions were equal.
+static uint64_t hash_md5(const char *data, size_t len) {
     unsigned char digest[EVP_MAX_MD_SIZE];
     unsigned int digest_len;
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
-    if (mdctx == NULL) {
-        perror("EVP_MD_CTX_new");
+    if (EVP_Digest(data, len, digest, &digest_len, EVP_md5(), NULL) != 1) {
+        perror("EVP_Digest");
         exit(EXIT_FAILURE);
     }
 
-    if (EVP_DigestInit_ex(mdctx, EVP_md5(), NULL) != 1) {
-        perror("EVP_DigestInit_ex");
-        exit(EXIT_FAILURE);
+    uint64_t hash_value = 0;
+    for (int i = 0; i < 8; i++) {
+        hash_value = (hash_value << 8) | digest[i];
     }
 
-    if (EVP_DigestUpdate(mdctx, key, strlen(key)) != 1) {
-        perror("EVP_DigestUpdate");
-        exit(EXIT_FAILURE);
+    return hash_value;
+}
+
+static uint64_t ring_xxh64(const char *data, size_t len) {
+    return hash_xxh64(data, len, 0);
+}
+
+static uint64_t ring_fnv1a(const char *data, size_t len) {
+    return hash_fnv1a(data, len);
+}
+
+const RingHash ring_hashes[] = {
+    {"xxh64", ring_xxh64},
+    {"md5", hash_md5},
+    {"fnv1a", ring_fnv1a},
+    {NULL, NULL},
+};
+
+const RingHash *find_ring_hash(const char *name) {
+    for (const RingHash *h = ring_hashes; h->name; h++) {
+        if (strcmp(h->name, name) == 0) return h;
     }
+    return NULL;
+}
 
-    if (EVP_DigestFinal_ex(mdctx, digest, &digest_len) != 1) {
-        perror("EVP_DigestFinal_ex");
-        exit(EXIT_FAILURE);
+static const Placement ring_placement;
+
+const Placement *const placements[] = {
+    &ring_placement,
+    &maglev_placement,
+    &jump_placement,
+    &rendezvous_placement,
+    NULL,
+};
+
+const Placement *find_placement(const char *name) {
+    for (int i = 0; placements[i]; i++) {
+        if (strcmp(placements[i]->name, name) == 0) return placements[i];
     }
+    return NULL;
+}
 
-    EVP_MD_CTX_free(mdctx);
+void init_ring(HashRing *ring, int vnodes, const RingHash *hash, const Placement *placement) {
+    memset(ring, 0, sizeof(*ring));
+    ring->vnodes = vnodes > 0 ? vnodes : DEFAULT_VNODES;
+    ring->hash = (hash ? hash : find_ring_hash(DEFAULT_RING_HASH))->fn;
+    ring->placement = placement ? placement : find_placement(DEFAULT_PLACEMENT);
+}
 
-    uint32_t hash_value = 0;
-    for (int i = 0; i < 4; i++) {
-        hash_value = (hash_value << 8) | digest[i];
+static void *copy_array(const void *src, size_t size) {
+    if (!src || size == 0) return NULL;
+    void *dst = malloc(size);
+    if (dst) memcpy(dst, src, size);
+    return dst;
+}
+
+int copy_ring(HashRing *dst, const HashRing *src) {
+    *dst = *src;
+    dst->nodes = copy_array(src->nodes, src->node_capacity * sizeof(Node));
+    dst->points = copy_array(src->points, src->point_capacity * sizeof(VirtualNode));
+    dst->table = copy_array(src->table, src->table_size * sizeof(int));
+    if ((src->nodes && src->node_capacity && !dst->nodes) ||
+        (src->points && src->point_capacity && !dst->points) ||
+        (src->table && src->table_size && !dst->table)) {
+        free(dst->nodes);
+        free(dst->points);
+        free(dst->table);
+        return -1;
     }
+    return 0;
+}
 
-    return hash_value;
+static int find_node(const HashRing *ring, const char *address) {
+    for (int i = 0; i < ring->node_count; i++) {
+        if (strcmp(ring->nodes[i].address, address) == 0) return i;
+    }
+    return -1;
 }
 
-// Add a node to the hash ring
-void add_node(HashRing *ring, const char *address) {
-    if (ring->node_count >= MAX_NODES) {
-        fprintf(stderr, "Max nodes reached\n");
-        return;
+static int compare_points(const void *a, const void *b) {
+    const VirtualNode *pa = (const VirtualNode *)a, *pb = (const VirtualNode *)b;
+    if (pa->hash != pb->hash) return pa->hash < pb->hash ? -1 : 1;
+    return pa->node - pb->node;
+}
+
+// Ring: hash "address#i" for each virtual node, sort just the new points
+// and merge them into the sorted ring
+static int ring_node_added(HashRing *ring, int index) {
+    int total = ring->point_count + ring->vnodes;
+    if (total > ring->point_capacity) {
+        int capacity = ring->point_capacity ? ring->point_capacity : ring->vnodes;
+        while (capacity < total) capacity *= 2;
+        VirtualNode *points = (VirtualNode *)realloc(ring->points, capacity * sizeof(VirtualNode));
+        if (!points) return -1;
+        ring->points = points;
+        ring->point_capacity = capacity;
     }
 
-    Node node;
-    strncpy(node.address, address, sizeof(node.address) - 1);
-    node.hash = hash(address);
+    VirtualNode *added = (VirtualNode *)malloc(ring->vnodes * sizeof(VirtualNode));
+    if (!added) return -1;
+    char label[300];
+    for (int i = 0; i < ring->vnodes; i++) {
+        int len = snprintf(label, sizeof(label), "%s#%d", ring->nodes[index].address, i);
+        added[i].hash = ring->hash(label, len);
+        added[i].node = index;
+    }
+    qsort(added, ring->vnodes, sizeof(VirtualNode), compare_points);
 
-    ring->nodes[ring->node_count++] = node;
+    // Merge from the back, in place
+    int i = ring->point_count - 1, j = ring->vnodes - 1, k = total - 1;
+    while (j >= 0) {
+        if (i >= 0 && compare_points(&ring->points[i], &added[j]) > 0) {
+            ring->points[k--] = ring->points[i--];
+        } else {
+            ring->points[k--] = added[j--];
+        }
+    }
+    ring->point_count = total;
+    free(added);
+    return 0;
+}
 
-    // Sort nodes by hash for consistent hashing
-    for (int i = 0; i < ring->node_count - 1; i++) {
-        for (int j = 0; j < ring->node_count - i - 1; j++) {
-            if (ring->nodes[j].hash > ring->nodes[j + 1].hash) {
-                Node temp = ring->nodes[j];
-                ring->nodes[j] = ring->nodes[j + 1];
-                ring->nodes[j + 1] = temp;
-            }
+// Ring: drop the removed server's virtual nodes and renumber the moved
+// server's; the relative order of the remaining points does not change
+static void ring_node_removed(HashRing *ring, int index, int moved_from) {
+    int kept = 0;
+    for (int i = 0; i < ring->point_count; i++) {
+        VirtualNode point = ring->points[i];
+        if (point.node == index) continue;
+        if (point.node == moved_from) point.node = index;
+        ring->points[kept++] = point;
+    }
+    ring->point_count = kept;
+}
+
+// Ring: the first virtual node clockwise from the key, then the servers
+// of the following virtual nodes
+static int ring_candidates(const HashRing *ring, uint64_t key_hash, int *out, int max) {
+    if (ring->point_count == 0) return 0;
+
+    // Binary search for the first virtual node with hash >= the key's hash
+    int lo = 0, hi = ring->point_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < key_hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Wrap around to the first node if no match is found
+    int count = 0;
+    for (int step = 0; step < ring->point_count && count < max; step++) {
+        int node = ring->points[(lo + step) % ring->point_count].node;
+        int seen = 0;
+        for (int i = 0; i < count && !seen; i++) seen = out[i] == node;
+        if (!seen) out[count++] = node;
+        if (count == ring->node_count) break;
+    }
+    return count;
+}
+
+static const Placement ring_placement = {
+    "ring", ring_node_added, ring_node_removed, ring_candidates,
+};
+
+// Add a node to the hash ring
+int add_node(HashRing *ring, const char *address) {
+    if (ring->vnodes <= 0) ring->vnodes = DEFAULT_VNODES;
+    if (!ring->hash) ring->hash = find_ring_hash(DEFAULT_RING_HASH)->fn;
+    if (!ring->placement) ring->placement = find_placement(DEFAULT_PLACEMENT);
+    if (find_node(ring, address) >= 0) return 0; // Servers re-announce themselves
+
+    if (ring->node_count == ring->node_capacity) {
+        int capacity = ring->node_capacity ? ring->node_capacity * 2 : 8;
+        Node *nodes = (Node *)realloc(ring->nodes, capacity * sizeof(Node));
+        if (!nodes) {
+            perror("Failed to grow hash ring");
+            return 0;
         }
+        ring->nodes = nodes;
+        ring->node_capacity = capacity;
+    }
+
+    int index = ring->node_count++;
+    Node *node = &ring->nodes[index];
+    memset(node, 0, sizeof(*node));
+    strncpy(node->address, address, sizeof(node->address) - 1);
+    node->seed = ring->hash(node->address, strlen(node->address));
+
+    if (ring->placement->node_added && ring->placement->node_added(ring, index) < 0) {
+        perror("Failed to grow hash ring");
+        ring->node_count--;
+        return 0;
     }
+    return 1;
+}
+
+int get_candidates(const HashRing *ring, const char *key, size_t key_len, int *out, int max) {
+    if (ring->node_count == 0 || max <= 0) return 0;
+    uint64_t key_hash = ring->hash(key, key_len);
+    return ring->placement->candidates(ring, key_hash, out, max);
 }
 
 // Find the node for a given key
@@ -72,40 +235,132 @@ const char *get_node(HashRing *ring, const char *key) {
         return NULL;
     }
 
-    uint32_t key_hash = hash(key);
+    int node;
+    if (get_candidates(ring, key, strlen(key), &node, 1) < 1) return NULL;
+    return ring->nodes[node].address;
+}
 
-    // Find the first node with a hash greater than the key's hash
-    for (int i = 0; i < ring->node_count; i++) {
-        if (key_hash <= ring->nodes[i].hash) {
-            return ring->nodes[i].address;
-        }
+static int in_candidates(const HashRing *ring, const int *set, int count, const char *address) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(ring->nodes[set[i]].address, address) == 0) return 1;
     }
+    return 0;
+}
 
-    // Wrap around to the first node if no match is found
-    return ring->nodes[0].address;
+// Add a move, extending one of the previous range if it continues it
+static int add_move(RingMove **moves, int *count, int *capacity, RingMove move) {
+    for (int m = *count - 1; m >= 0 && ((*moves)[m].first == move.first ||
+                                       (*moves)[m].last + 1 == move.first); m--) {
+        RingMove *prev = &(*moves)[m];
+        if (prev->last + 1 == move.first && prev->from == move.from && prev->to == move.to &&
+            prev->keep == move.keep) {
+            prev->last = move.last;
+            return 0;
+        }
+    }
+    if (*count == *capacity) {
+        int grown_capacity = *capacity ? *capacity * 2 : 16;
+        RingMove *grown = (RingMove *)realloc(*moves, grown_capacity * sizeof(RingMove));
+        if (!grown) return -1;
+        *moves = grown;
+        *capacity = grown_capacity;
+    }
+    (*moves)[(*count)++] = move;
+    return 0;
 }
 
-// Remove a node from the hash ring
-void remove_node(HashRing *ring, const char *address) {
-    int found = 0;
+// Every position where the candidates can change is a virtual node of one
+// of the two rings. Between two such positions both candidate lists are
+// constant: range [previous + 1, position] is served from position on.
+int ring_diff(const HashRing *before, const HashRing *after, int copies, RingMove **out) {
+    *out = NULL;
+    if (before->placement != &ring_placement || after->placement != &ring_placement ||
+        before->hash != after->hash) {
+        return -1;
+    }
+    if (before->point_count == 0 || after->point_count == 0) return 0;
 
-    // Find the node by address
-    for (int i = 0; i < ring->node_count; i++) {
-        if (strcmp(ring->nodes[i].address, address) == 0) {
-            found = 1;
+    // Merge the two sorted point lists into one list of distinct positions
+    int total = before->point_count + after->point_count;
+    uint64_t *bounds = (uint64_t *)malloc(total * sizeof(uint64_t));
+    if (!bounds) return -1;
+    int n = 0, i = 0, j = 0;
+    while (i < before->point_count || j < after->point_count) {
+        uint64_t next;
+        if (j == after->point_count ||
+            (i < before->point_count && before->points[i].hash <= after->points[j].hash)) {
+            next = before->points[i++].hash;
+        } else {
+            next = after->points[j++].hash;
+        }
+        if (n == 0 || bounds[n - 1] != next) bounds[n++] = next;
+    }
 
-            // Shift all subsequent nodes left
-            for (int j = i; j < ring->node_count - 1; j++) {
-                ring->nodes[j] = ring->nodes[j + 1];
-            }
+    int count = 0, capacity = 0;
+    RingMove *moves = NULL;
+    uint64_t first = 0;
+    int old_set[copies], new_set[copies], leaving[copies];
+    // The last range, above the highest position, wraps to the first node
+    for (int k = 0; k <= n; k++) {
+        if (k == n && bounds[n - 1] == UINT64_MAX) break;
+        uint64_t last = k < n ? bounds[k] : UINT64_MAX;
+        int old_count = ring_candidates(before, last, old_set, copies);
+        int new_count = ring_candidates(after, last, new_set, copies);
 
-            ring->node_count--;
-            printf("Node '%s' removed from the hash ring\n", address);
-            break;
+        int leaving_count = 0, staying = -1, next_leaving = 0;
+        for (int i = 0; i < old_count; i++) {
+            const char *address = before->nodes[old_set[i]].address;
+            if (!in_candidates(after, new_set, new_count, address)) {
+                if (find_node(after, address) >= 0) leaving[leaving_count++] = old_set[i];
+            } else if (staying < 0) {
+                staying = old_set[i];
+            }
         }
+        for (int i = 0; i < new_count; i++) {
+            if (in_candidates(before, old_set, old_count, after->nodes[new_set[i]].address)) continue;
+            RingMove move = {old_set[0], new_set[i], 0, first, last};
+            if (next_leaving < leaving_count) {
+                move.from = leaving[next_leaving++];
+            } else if (staying >= 0) {
+                move.from = staying;
+                move.keep = 1;
+            }
+            if (add_move(&moves, &count, &capacity, move) < 0) {
+                free(moves);
+                free(bounds);
+                return -1;
+            }
+        }
+        first = last + 1;
     }
+    free(bounds);
+    *out = moves;
+    return count;
+}
 
-    if (!found) {
+// Remove a node from the hash ring
+void remove_node(HashRing *ring, const char *address) {
+    int index = find_node(ring, address);
+    if (index < 0) {
         fprintf(stderr, "Node '%s' not found in the hash ring\n", address);
+        return;
     }
+
+    // Move the last node into the hole so that only its index changes
+    int last = --ring->node_count;
+    ring->nodes[index] = ring->nodes[last];
+    if (ring->placement->node_removed) ring->placement->node_removed(ring, index, last);
+}
+
+void free_ring(HashRing *ring) {
+    free(ring->nodes);
+    free(ring->points);
+    free(ring->table);
+    int vnodes = ring->vnodes;
+    ring_hash_fn hash = ring->hash;
+    const Placement *placement = ring->placement;
+    memset(ring, 0, sizeof(*ring));
+    ring->vnodes = vnodes;
+    ring->hash = hash;
+    ring->placement = placement;
 }
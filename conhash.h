@@ -1,37 +1,114 @@
 #ifndef HASH_RING_H
 #define HASH_RING_H
 
-#include <stdint.h>  // For uint32_t
-#include <openssl/evp.h>  // For EVP interface
+#include <stddef.h>
+#include <stdint.h>  // For uint64_t
 
-// Maximum number of nodes in the hash ring
-#define MAX_NODES 10
+// Default number of points each server gets on the ring
+#define DEFAULT_VNODES 160
+
+// Hash placing servers and keys on the ring
+#define DEFAULT_RING_HASH "xxh64"
+
+typedef uint64_t (*ring_hash_fn)(const char *data, size_t len);
+
+// A selectable ring hash function
+typedef struct RingHash {
+    const char *name;   // "xxh64", "md5" or "fnv1a"
+    ring_hash_fn fn;
+} RingHash;
+
+// All ring hash functions, terminated by an entry with a NULL name
+extern const RingHash ring_hashes[];
+
+// Default placement strategy
+#define DEFAULT_PLACEMENT "ring"
 
 // Node structure representing a server in the hash ring
 typedef struct Node {
     char address[256];  // Server address (e.g., "127.0.0.1:8080")
-    uint32_t hash;      // Hash of the server's address
+    uint64_t seed;      // Hash of the address
 } Node;
 
-// HashRing structure representing the consistent hash ring
+// One of a server's points on the ring
+typedef struct VirtualNode {
+    uint64_t hash;      // Position on the ring
+    int node;           // Index of the owning server in HashRing.nodes
+} VirtualNode;
+
+typedef struct Placement Placement;
+
+// HashRing structure: the set of servers plus the lookup structure of the
+// placement strategy in use
 typedef struct HashRing {
-    Node nodes[MAX_NODES];  // Array of nodes
-    int node_count;         // Number of nodes currently in the ring
+    Node *nodes;            // Servers
+    int node_count;         // Number of servers currently in the ring
+    int node_capacity;
+    VirtualNode *points;    // Ring: virtual nodes sorted by hash
+    int point_count;
+    int point_capacity;
+    int vnodes;             // Ring: virtual nodes per server
+    int *table;             // Maglev: lookup table of node indices
+    int table_size;
+    ring_hash_fn hash;      // Hash for server and key positions
+    const Placement *placement;
 } HashRing;
 
+// A placement strategy. Hooks run after the nodes array has changed:
+// node_added after appending nodes[index], node_removed after the last
+// node was moved into the removed node's slot at index.
+struct Placement {
+    const char *name;
+    int (*node_added)(HashRing *ring, int index);
+    void (*node_removed)(HashRing *ring, int index, int moved_from);
+    // Fill out with up to max distinct node indices in order of preference
+    int (*candidates)(const HashRing *ring, uint64_t key_hash, int *out, int max);
+};
+
+// All placement strategies, terminated by an entry with a NULL name
+extern const Placement *const placements[];
+
+// Strategies other than the ring (placement.c)
+extern const Placement maglev_placement;
+extern const Placement jump_placement;
+extern const Placement rendezvous_placement;
+
+/**
+ * Look up a ring hash function by name.
+ * @return The hash, or NULL if the name is unknown.
+ */
+const RingHash *find_ring_hash(const char *name);
+
 /**
- * Hash a string using EVP for MD5.
- * @param key The key to be hashed.
- * @return A 32-bit hash value of the key.
+ * Look up a placement strategy by name ("ring", "maglev", "jump" or
+ * "rendezvous").
+ * @return The strategy, or NULL if the name is unknown.
+ */
+const Placement *find_placement(const char *name);
+
+/**
+ * Initialize an empty hash ring. A zeroed HashRing is also valid and uses
+ * DEFAULT_VNODES, DEFAULT_RING_HASH and DEFAULT_PLACEMENT.
+ * @param ring Pointer to the HashRing.
+ * @param vnodes Number of virtual nodes per server.
+ * @param hash Hash function, or NULL for the default.
+ * @param placement Placement strategy, or NULL for the default.
  */
-uint32_t hash(const char *key);
+void init_ring(HashRing *ring, int vnodes, const RingHash *hash, const Placement *placement);
+
+/**
+ * Make dst an independent copy of src.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int copy_ring(HashRing *dst, const HashRing *src);
 
 /**
  * Add a node to the hash ring.
  * @param ring Pointer to the HashRing.
  * @param address The address of the node to add (e.g., "127.0.0.1:8080").
+ * @return 1 if the node was added, 0 if it was already in the ring.
  */
-void add_node(HashRing *ring, const char *address);
+int add_node(HashRing *ring, const char *address);
 
 /**
  * Find the appropriate node for a given key.
@@ -41,6 +118,47 @@ void add_node(HashRing *ring, const char *address);
  */
 const char *get_node(HashRing *ring, const char *key);
 
+/**
+ * List the nodes that may serve a key, most preferred first.
+ * @param key The key; need not be NUL-terminated.
+ * @param key_len Length of the key.
+ * @param out Receives up to max distinct indices into ring->nodes.
+ * @return Number of indices written.
+ */
+int get_candidates(const HashRing *ring, const char *key, size_t key_len, int *out, int max);
+
+/**
+ * Remove a node and all of its virtual nodes from the hash ring.
+ * @param ring Pointer to the HashRing.
+ * @param address The address of the node to remove.
+ */
 void remove_node(HashRing *ring, const char *address);
 
+// Key hashes that a server gains between two versions of a ring
+typedef struct RingMove {
+    int from;          // Server in the old ring that has the keys (index into its nodes)
+    int to;            // Server in the new ring that gains them (index into its nodes)
+    int keep;          // from still serves them too: copy rather than move
+    uint64_t first;    // First key hash of the range
+    uint64_t last;     // Last key hash of the range (inclusive)
+} RingMove;
+
+/**
+ * List the key hash ranges that servers gain between two versions of a
+ * ring, with keys served by the first copies candidates. A server that
+ * joins a range's candidates takes over from one that leaves them and is
+ * still on the ring, or else copies from one that stays. If every old
+ * candidate has left the ring, from is the first of them. Only the ring
+ * placement gives each server contiguous ranges.
+ * @param out Receives a malloc'd array of moves in hash order (NULL if none).
+ * @return Number of moves, or -1 if either ring uses another placement or
+ *         the two rings hash differently.
+ */
+int ring_diff(const HashRing *before, const HashRing *after, int copies, RingMove **out);
+
+/**
+ * Free the ring's memory, leaving it empty.
+ */
+void free_ring(HashRing *ring);
+
 #endif // HASH_RING_H
@@ -1,54 +1,456 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "mockdb.h"
+#include "netbuf.h"
+#include "proto.h"
+#include "snapshot.h"
+#include "wal.h"
 
 #define BUFFER_SIZE 1024
-#define MAX_KEY_LENGTH 200
-#define MAX_VALUE_LENGTH 200
+#define MAX_REQUEST_SIZE (1024 * 1024) // Largest request buffered per connection
 #define DB_PORT 9092
+#define DEFAULT_SNAPSHOT_LOG_MB 64  // Log growth that triggers a snapshot
+#define SNAPSHOT_CHECK_SECONDS 1
 
-void handle_client(int client_socket, MockDB *db) {
-    char buffer[BUFFER_SIZE];
+MockDB *db = NULL;      // Shared by all connection threads
+pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+Wal *wal = NULL;        // Write log; NULL when running without a data directory
+const char *data_dir = NULL;
+size_t snapshot_log_bytes = (size_t)DEFAULT_SNAPSHOT_LOG_MB * 1024 * 1024;
+static __thread uint64_t commit_lsn; // Log position this thread's replies wait for
 
-    while (1) {
-        memset(buffer, 0, BUFFER_SIZE);
+// Apply a write and log it. Called with db_lock held, so the log order is
+// the order writes were applied in.
+static void store_set(const char *key, const char *value) {
+    db_set(db, key, value);
+    if (wal) commit_lsn = wal_append(wal, WAL_OP_SET, key, value);
+}
 
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received <= 0) break;
+static void store_delete(const char *key) {
+    db_delete(db, key);
+    if (wal) commit_lsn = wal_append(wal, WAL_OP_DELETE, key, NULL);
+}
+
+// Execute one request and queue its reply. Requests terminated by '\n'
+// get '\n'-terminated replies.
+static void handle_request(NetBuf *out, char *request, int line_mode) {
+    char *saveptr = NULL;
+    char *command = strtok_r(request, " \t\r", &saveptr);
+    char *key = strtok_r(NULL, " \t\r", &saveptr);
+    char *value = strtok_r(NULL, " \t\r", &saveptr);
+    if (!command) command = "";
+
+    // Values are copied into the reply under the lock, whatever their length
+    pthread_mutex_lock(&db_lock);
+    if (strcmp(command, "set") == 0 && key && value) {
+        store_set(key, value);
+        netbuf_printf(out, "OK");
+    } else if (strcmp(command, "get") == 0 && key) {
+        char *result = db_get(db, key);
+        netbuf_printf(out, "%s", result ? result : "null");
+    } else if (strcmp(command, "delete") == 0 && key) {
+        store_delete(key);
+        netbuf_printf(out, "OK");
+    } else {
+        netbuf_printf(out, "Invalid command");
+    }
+    pthread_mutex_unlock(&db_lock);
+
+    if (line_mode) netbuf_append(out, "\n", 1);
+}
+
+// Copy a key or value out of a message as a malloc'd C string. Keys and
+// values are stored as C strings, so embedded NULs are rejected.
+static char *copy_string(const char *src, size_t len) {
+    if (memchr(src, '\0', len)) return NULL;
+    return strndup(src, len);
+}
 
-        char command[10], key[MAX_KEY_LENGTH], value[MAX_VALUE_LENGTH];
-        sscanf(buffer, "%s %s %s", command, key, value);
+// Execute a batched get or set. Called with db_lock held; the response
+// value is packed into result.
+static uint16_t execute_multi(const ProtoMessage *msg, NetBuf *result) {
+    ProtoCursor cursor = {msg->value, msg->value + msg->value_len};
+    const char *data;
+    size_t len;
+    int rc;
 
-        char response[BUFFER_SIZE] = {0};
+    while ((rc = proto_next_key(&cursor, &data, &len)) == 1) {
+        char *key = copy_string(data, len);
+        if (!key) return PROTO_STATUS_INVALID;
 
-        if (strcmp(command, "set") == 0) {
-            db_set(db, key, value);
-            snprintf(response, BUFFER_SIZE, "OK");
-        } else if (strcmp(command, "get") == 0) {
-            char *result = db_get(db, key);
-            snprintf(response, BUFFER_SIZE, "%s", result ? result : "null");
-        } else if (strcmp(command, "delete") == 0) {
-            db_delete(db, key);
-            snprintf(response, BUFFER_SIZE, "OK");
+        if (msg->opcode == PROTO_OP_MGET) {
+            char *found = db_get(db, key);
+            proto_put_value(result, found, found ? strlen(found) : 0);
+            free(key);
+            continue;
+        }
+        char *value = NULL;
+        if (proto_next_value(&cursor, &data, &len) != 1 || !data || !(value = copy_string(data, len))) {
+            free(key);
+            return PROTO_STATUS_INVALID;
+        }
+        store_set(key, value);
+        free(key);
+        free(value);
+    }
+    return rc < 0 ? PROTO_STATUS_INVALID : PROTO_STATUS_OK;
+}
+
+// Execute one binary request and queue its response
+static void handle_binary_request(NetBuf *out, const ProtoMessage *msg) {
+    NetBuf result = {0};
+    uint16_t status = PROTO_STATUS_OK;
+    int multi = msg->opcode == PROTO_OP_MGET || msg->opcode == PROTO_OP_MSET;
+    char *key = copy_string(msg->key, msg->key_len);
+    char *value = multi ? NULL : copy_string(msg->value, msg->value_len);
+
+    if (msg->magic != PROTO_MAGIC_REQUEST || !key || (!multi && !value)) {
+        status = PROTO_STATUS_INVALID;
+    }
+
+    pthread_mutex_lock(&db_lock);
+    if (status != PROTO_STATUS_OK) {
+        // Rejected above
+    } else if (multi) {
+        status = execute_multi(msg, &result);
+    } else if (msg->opcode == PROTO_OP_SET && msg->key_len > 0) {
+        store_set(key, value);
+    } else if (msg->opcode == PROTO_OP_GET && msg->key_len > 0) {
+        char *found = db_get(db, key);
+        if (found) {
+            netbuf_append(&result, found, strlen(found)); // Copy out under the lock
         } else {
-            snprintf(response, BUFFER_SIZE, "Invalid command");
+            status = PROTO_STATUS_KEY_NOT_FOUND;
         }
+    } else if (msg->opcode == PROTO_OP_DELETE && msg->key_len > 0) {
+        store_delete(key);
+    } else if (msg->opcode != PROTO_OP_NOOP) {
+        status = PROTO_STATUS_UNKNOWN_COMMAND;
+    }
+    pthread_mutex_unlock(&db_lock);
+
+    if (status != PROTO_STATUS_OK) netbuf_consume(&result, result.len);
+    proto_write(out, PROTO_MAGIC_RESPONSE, msg->opcode, status, msg->opaque, NULL, 0,
+                NETBUF_PTR(&result), result.len);
+    netbuf_free(&result);
+    free(key);
+    free(value);
+}
 
-        send(client_socket, response, strlen(response), 0);
+// Send and consume everything queued in out
+static int send_all(int fd, NetBuf *out) {
+    while (out->len > 0) {
+        ssize_t n = send(fd, NETBUF_PTR(out), out->len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        netbuf_consume(out, n);
     }
+    return 0;
+}
+
+// Serve one connection. Connections stay open for many requests. Binary
+// requests are framed by their header; a text request ends at '\n', or at
+// the end of a read for clients that never send one. Replies to all the
+// requests in one read go out in a single send.
+void *handle_client(void *client_socket_ptr) {
+    int client_socket = *(int *)client_socket_ptr;
+    free(client_socket_ptr);
+
+    NetBuf in = {0}, out = {0};
+    char buffer[BUFFER_SIZE];
+    int line_mode = 0;
+
+    while (1) {
+        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+        if (bytes_received <= 0) break;
+        netbuf_append(&in, buffer, bytes_received);
+
+        while (in.len > 0) {
+            if (proto_is_binary(NETBUF_PTR(&in), in.len)) {
+                ProtoMessage msg;
+                ssize_t size = proto_parse(NETBUF_PTR(&in), in.len, &msg);
+                if (size < 0) goto done;
+                if (size == 0) break;
+                handle_binary_request(&out, &msg);
+                netbuf_consume(&in, size);
+                continue;
+            }
 
+            char *nl = memchr(NETBUF_PTR(&in), '\n', in.len);
+            if (nl) {
+                *nl = '\0';
+                size_t consumed = nl - NETBUF_PTR(&in) + 1;
+                line_mode = 1;
+                handle_request(&out, NETBUF_PTR(&in), 1);
+                netbuf_consume(&in, consumed);
+            } else if (!line_mode) {
+                netbuf_append(&in, "", 1);
+                handle_request(&out, NETBUF_PTR(&in), 0);
+                netbuf_consume(&in, in.len);
+            } else {
+                break;
+            }
+        }
+
+        // Acknowledge writes only once they are on disk
+        if (wal) wal_wait(wal, commit_lsn);
+        if (send_all(client_socket, &out) < 0) break;
+        if (in.len >= MAX_REQUEST_SIZE) {
+            fprintf(stderr, "Request too large, closing connection\n");
+            break;
+        }
+    }
+
+done:
+    netbuf_free(&in);
+    netbuf_free(&out);
     close(client_socket);
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_generations(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Generations of the log files in the data directory, oldest first
+static uint64_t *list_logs(const char *dir, int *count) {
+    DIR *d = opendir(dir);
+    if (!d) return NULL;
+    int capacity = 16;
+    uint64_t *gens = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+    struct dirent *entry;
+    unsigned long long gen;
+    char tail;
+
+    *count = 0;
+    while ((entry = readdir(d))) {
+        if (sscanf(entry->d_name, "log.%llu%c", &gen, &tail) != 1) continue;
+        if (*count == capacity) {
+            capacity *= 2;
+            gens = (uint64_t *)realloc(gens, capacity * sizeof(uint64_t));
+        }
+        gens[(*count)++] = gen;
+    }
+    closedir(d);
+    qsort(gens, *count, sizeof(uint64_t), compare_generations);
+    return gens;
 }
 
-int main() {
+// Map the latest snapshot, replay the logs written after it and start a
+// new log. The snapshot is used in place rather than loaded, so restart
+// time depends on the size of the log tail, not of the data set.
+// *found is set if there was a snapshot or any log record.
+static int recover(const char *dir, int *found) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("Failed to create data directory");
+        return -1;
+    }
+    double start = now_seconds();
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/snapshot", dir);
+    uint64_t covered = 0;
+    Snapshot *snap = snapshot_open(path);
+    if (snap) {
+        db_load_snapshot(db, snap);
+        covered = snap->header->generation;
+    }
+
+    int count;
+    uint64_t *gens = list_logs(dir, &count);
+    if (!gens) {
+        perror("Failed to read data directory");
+        return -1;
+    }
+    uint64_t last = covered;
+    long replayed = 0;
+    for (int i = 0; i < count; i++) {
+        wal_path(path, sizeof(path), dir, gens[i]);
+        if (gens[i] <= covered) {
+            unlink(path); // Left over from a snapshot that finished
+            continue;
+        }
+        long applied = wal_replay(path, db);
+        if (applied < 0) {
+            free(gens);
+            return -1;
+        }
+        replayed += applied;
+        last = gens[i];
+    }
+    free(gens);
+    *found = snap != NULL || replayed > 0;
+
+    wal = wal_open(dir, last + 1);
+    if (!wal) return -1;
+    printf("Recovered %zu keys in %.3fs: snapshot generation %llu, %ld log records replayed\n",
+           db->count, now_seconds() - start, (unsigned long long)covered, replayed);
+    return 0;
+}
+
+// Write a snapshot from a forked child. The child sees a copy-on-write
+// image of memory frozen at the fork, so the server keeps serving while it
+// is written. Only the forking thread exists in the child, and another may
+// have held the allocator or stdio locks at the fork, so the writer is
+// allocated here and the child only makes system calls. The logs it covers
+// are deleted once it is in place.
+static void take_snapshot(void) {
+    char path[512], tmp[512];
+    snprintf(path, sizeof(path), "%s/snapshot", data_dir);
+    snprintf(tmp, sizeof(tmp), "%s/snapshot.tmp", data_dir);
+
+    pthread_mutex_lock(&db_lock);
+    SnapshotWriter *writer = snapshot_writer_create(db->count);
+    if (!writer) {
+        pthread_mutex_unlock(&db_lock);
+        fprintf(stderr, "Failed to allocate snapshot writer\n");
+        return;
+    }
+    uint64_t covered = wal->generation;
+    if (wal_rotate(wal) < 0) {
+        pthread_mutex_unlock(&db_lock);
+        snapshot_writer_free(writer);
+        return;
+    }
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid == 0) _exit(snapshot_writer_run(writer, db, tmp, covered) == 0 ? 0 : 1);
+    size_t keys = db->count;
+    pthread_mutex_unlock(&db_lock);
+
+    if (pid < 0) {
+        perror("Failed to fork snapshot writer");
+        snapshot_writer_free(writer);
+        return;
+    }
+    int status;
+    pid_t waited;
+    while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+    }
+    snapshot_writer_free(writer);
+    if (waited < 0) return;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || rename(tmp, path) < 0) {
+        fprintf(stderr, "Snapshot of generation %llu failed\n", (unsigned long long)covered);
+        unlink(tmp);
+        return;
+    }
+    int dir_fd = open(data_dir, O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd); // Make the rename durable before dropping the logs
+        close(dir_fd);
+    }
+
+    for (uint64_t gen = covered; gen > 0; gen--) {
+        wal_path(path, sizeof(path), data_dir, gen);
+        if (unlink(path) < 0) break;
+    }
+    printf("Snapshot of %zu keys (generation %llu) written in %.3fs\n", keys,
+           (unsigned long long)covered, now_seconds() - start);
+    fflush(stdout);
+}
+
+void *snapshot_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        sleep(SNAPSHOT_CHECK_SECONDS);
+        pthread_mutex_lock(&wal->lock);
+        uint64_t size = wal->file_size;
+        pthread_mutex_unlock(&wal->lock);
+        if (size >= snapshot_log_bytes) take_snapshot();
+    }
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n <keys>] [-d <dir>] [-s <log_mb>]\n", prog);
+    fprintf(stderr, "  -n <keys>    Preload keys key0..key<keys-1> with values value0..\n");
+    fprintf(stderr, "               (skipped if -d recovers existing data)\n");
+    fprintf(stderr, "  -d <dir>     Persist data in <dir>: log every write before acknowledging\n");
+    fprintf(stderr, "               it, snapshot in the background, recover on startup\n");
+    fprintf(stderr, "  -s <log_mb>  Snapshot once the log has grown this much (default %d)\n",
+            DEFAULT_SNAPSHOT_LOG_MB);
+}
+
+
+int main(int argc, char *argv[]) {
     int server_socket, client_socket;
     struct sockaddr_in server_addr, client_addr;
     socklen_t addr_len = sizeof(client_addr);
+    long preload = 0;
+    int recovered = 0;
+    int opt;
 
-    MockDB *db = create_mockdb();
+    while ((opt = getopt(argc, argv, "n:d:s:")) != -1) {
+        switch (opt) {
+        case 'd':
+            data_dir = optarg;
+            break;
+        case 's':
+            snapshot_log_bytes = strtoul(optarg, NULL, 10) * 1024 * 1024;
+            if (snapshot_log_bytes == 0) {
+                fprintf(stderr, "Invalid snapshot threshold: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            preload = atol(optarg);
+            if (preload < 1) {
+                fprintf(stderr, "Invalid key count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    db = create_mockdb();
+    if (!db) {
+        fprintf(stderr, "Failed to allocate the database\n");
+        return EXIT_FAILURE;
+    }
+    if (data_dir && recover(data_dir, &recovered) < 0) {
+        fprintf(stderr, "Failed to recover from %s\n", data_dir);
+        return EXIT_FAILURE;
+    }
+    // Preloading over recovered data would overwrite what was persisted
+    if (preload > 0 && recovered) {
+        printf("Not preloading: %s already holds data\n", data_dir);
+        preload = 0;
+    }
+    char key[32], value[32];
+    for (long i = 0; i < preload; i++) {
+        snprintf(key, sizeof(key), "key%ld", i);
+        snprintf(value, sizeof(value), "value%ld", i);
+        store_set(key, value);
+    }
+    if (wal) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, snapshot_thread, NULL) != 0) {
+            perror("Failed to create snapshot thread");
+            return EXIT_FAILURE;
+        }
+        pthread_detach(thread);
+    }
 
     // Create and bind socket
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -57,6 +459,9 @@ int main() {
         return EXIT_FAILURE;
     }
 
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(DB_PORT);
@@ -66,12 +471,12 @@ int main() {
         return EXIT_FAILURE;
     }
 
-    if (listen(server_socket, 10) < 0) {
+    if (listen(server_socket, SOMAXCONN) < 0) {
         perror("Listen failed");
         return EXIT_FAILURE;
     }
 
-    printf("Central database server listening on port %d\n", DB_PORT);
+    printf("Central database server listening on port %d with %zu keys\n", DB_PORT, db->count);
 
     while (1) {
         client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_len);
@@ -79,7 +484,18 @@ int main() {
             perror("Accept failed");
             continue;
         }
-        handle_client(client_socket, db);
+
+        // Cache servers keep pooled connections open, so each gets its own thread
+        pthread_t thread;
+        int *client_socket_ptr = malloc(sizeof(int));
+        *client_socket_ptr = client_socket;
+        if (pthread_create(&thread, NULL, handle_client, client_socket_ptr) != 0) {
+            perror("Failed to create client thread");
+            free(client_socket_ptr);
+            close(client_socket);
+            continue;
+        }
+        pthread_detach(thread);
     }
 
     free_mockdb(db);
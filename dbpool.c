@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "proto.h"
+#include "dbpool.h"
+
+#define DB_CONNECT_TIMEOUT_MS 1000 // Give up connecting to db_server after this long
+#define DB_IO_TIMEOUT_SEC 2        // Send/receive timeout on pooled connections
+#define DB_HEALTH_CHECK_IDLE_SEC 1 // Probe connections idle at least this long
+
+static void conn_close(DbConn *conn) {
+    if (conn->fd >= 0) close(conn->fd);
+    conn->fd = -1;
+    netbuf_consume(&conn->in, conn->in.len);
+}
+
+static int conn_open(DbPool *pool, DbConn *conn) {
+    struct sockaddr_in db_addr;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Failed to create socket to DB");
+        return -1;
+    }
+
+    db_addr.sin_family = AF_INET;
+    db_addr.sin_port = htons(pool->port);
+    inet_pton(AF_INET, pool->host, &db_addr.sin_addr);
+
+    // Connect without blocking, so an unreachable host fails within the
+    // deadline instead of after the kernel's SYN retries
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    if (connect(sock, (struct sockaddr *)&db_addr, sizeof(db_addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            perror("Connection to DB server failed");
+            close(sock);
+            return -1;
+        }
+        struct pollfd pfd = {sock, POLLOUT, 0};
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        int ready;
+        do {
+            ready = poll(&pfd, 1, DB_CONNECT_TIMEOUT_MS);
+        } while (ready < 0 && errno == EINTR);
+        if (ready == 0) {
+            fprintf(stderr, "Connection to DB server timed out\n");
+            close(sock);
+            return -1;
+        }
+        if (ready < 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error) {
+            if (error) errno = error;
+            perror("Connection to DB server failed");
+            close(sock);
+            return -1;
+        }
+    }
+    fcntl(sock, F_SETFL, flags);
+
+    // Requests are small and latency bound; a dead DB must not hang the caller
+    int one = 1;
+    struct timeval tv = {DB_IO_TIMEOUT_SEC, 0};
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    conn->fd = sock;
+    return 0;
+}
+
+// A pooled connection is healthy if the peer has not closed it and it has
+// no stray unread data
+static int conn_is_healthy(DbConn *conn) {
+    char c;
+    if (conn->fd < 0) return 0;
+
+    ssize_t n = recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+DbPool *dbpool_create(const char *host, int port, int size) {
+    DbPool *pool = (DbPool *)calloc(1, sizeof(DbPool));
+    if (!pool) return NULL;
+    snprintf(pool->host, sizeof(pool->host), "%s", host);
+    pool->port = port;
+    pool->size = size > 0 ? size : 1;
+    pool->conns = (DbConn *)calloc(pool->size, sizeof(DbConn));
+    if (!pool->conns) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+
+    for (int i = 0; i < pool->size; i++) {
+        pool->conns[i].fd = -1;
+        pool->conns[i].next = pool->idle;
+        pool->idle = &pool->conns[i];
+    }
+    return pool;
+}
+
+DbConn *dbpool_acquire(DbPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->idle) {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+    DbConn *conn = pool->idle;
+    pool->idle = conn->next;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (conn->fd >= 0 && time(NULL) - conn->last_used >= DB_HEALTH_CHECK_IDLE_SEC &&
+        !conn_is_healthy(conn)) {
+        conn_close(conn);
+    }
+    return conn;
+}
+
+void dbpool_release(DbPool *pool, DbConn *conn) {
+    pthread_mutex_lock(&pool->lock);
+    conn->next = pool->idle;
+    pool->idle = conn;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read one binary reply into the connection's buffer
+static int read_reply(DbConn *conn, ProtoMessage *msg) {
+    char chunk[4096];
+
+    while (1) {
+        ssize_t size = proto_parse(NETBUF_PTR(&conn->in), conn->in.len, msg);
+        if (size < 0) return -1;
+        if (size > 0) return 0;
+
+        ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (netbuf_append(&conn->in, chunk, n) < 0) return -1;
+    }
+}
+
+static int try_request(DbPool *pool, DbConn *conn, NetBuf *request, ProtoMessage *msg) {
+    if (conn->fd < 0 && conn_open(pool, conn) < 0) return -1;
+
+    netbuf_consume(&conn->in, conn->in.len); // Drop the previous reply
+    if (send_all(conn->fd, NETBUF_PTR(request), request->len) < 0) return -1;
+    return read_reply(conn, msg);
+}
+
+int dbpool_request(DbPool *pool, DbConn *conn, uint8_t opcode, const char *key, size_t key_len,
+                   const char *value, size_t value_len, NetBuf *reply) {
+    NetBuf request = {0};
+    if (proto_write(&request, PROTO_MAGIC_REQUEST, opcode, 0, 0, key, key_len, value, value_len) < 0) {
+        return PROTO_STATUS_TOO_LARGE;
+    }
+
+    ProtoMessage msg;
+    int rc = try_request(pool, conn, &request, &msg);
+    if (rc < 0) {
+        // The connection may have gone stale: reconnect and retry once
+        conn_close(conn);
+        rc = try_request(pool, conn, &request, &msg);
+        if (rc < 0) conn_close(conn);
+    }
+    netbuf_free(&request);
+    if (rc < 0) return -1;
+
+    conn->last_used = time(NULL);
+    if (reply) {
+        netbuf_append(reply, msg.value, msg.value_len);
+        netbuf_append(reply, "", 1);
+        reply->len--; // NUL-terminated, but not counted
+    }
+    return msg.status;
+}
+
+void dbpool_destroy(DbPool *pool) {
+    for (int i = 0; i < pool->size; i++) {
+        conn_close(&pool->conns[i]);
+        netbuf_free(&pool->conns[i].in);
+    }
+    free(pool->conns);
+    pthread_cond_destroy(&pool->available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
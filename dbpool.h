@@ -0,0 +1,67 @@
+#ifndef DBPOOL_H
+#define DBPOOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "netbuf.h"
+
+// One persistent connection to db_server
+typedef struct DbConn {
+    int fd;                // Socket, -1 if not connected
+    NetBuf in;             // Reply buffer, owned by this connection
+    time_t last_used;      // When the connection last completed a request
+    struct DbConn *next;   // Next idle connection
+} DbConn;
+
+// Fixed-size pool of reusable connections to db_server
+typedef struct DbPool {
+    char host[64];         // db_server address
+    int port;              // db_server port
+    DbConn *conns;         // All connections
+    int size;              // Number of connections
+    DbConn *idle;          // Stack of connections not checked out
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+} DbPool;
+
+/**
+ * Create a connection pool. Connections are opened lazily on first use;
+ * an attempt to connect gives up after a second.
+ * @param host db_server IP address.
+ * @param port db_server port.
+ * @param size Maximum number of connections.
+ * @return Pointer to the pool, or NULL if it cannot be allocated.
+ */
+DbPool *dbpool_create(const char *host, int port, int size);
+
+/**
+ * Check a connection out of the pool, waiting if all are in use.
+ */
+DbConn *dbpool_acquire(DbPool *pool);
+
+/**
+ * Return a connection to the pool.
+ */
+void dbpool_release(DbPool *pool, DbConn *conn);
+
+/**
+ * Send one binary protocol request on a checked-out connection and wait
+ * for its reply. A broken connection is reopened and the request retried once.
+ * @param opcode PROTO_OP_GET, PROTO_OP_SET, PROTO_OP_DELETE, or PROTO_OP_MGET
+ *               and PROTO_OP_MSET with the keys packed in the value.
+ * @param key The key (may be empty).
+ * @param value The value (may be empty).
+ * @param reply If not NULL, receives the reply value (NUL-terminated).
+ * @return The reply status (PROTO_STATUS_*), PROTO_STATUS_TOO_LARGE if the request
+ *         cannot be framed, or -1 if db_server cannot be reached.
+ */
+int dbpool_request(DbPool *pool, DbConn *conn, uint8_t opcode, const char *key, size_t key_len,
+                   const char *value, size_t value_len, NetBuf *reply);
+
+/**
+ * Close all connections and free the pool.
+ */
+void dbpool_destroy(DbPool *pool);
+
+#endif // DBPOOL_H
@@ -0,0 +1,21 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * XXH64 (in-tree implementation of the xxHash 64-bit algorithm).
+ * @param data Bytes to hash.
+ * @param len Number of bytes.
+ * @param seed Seed value; 0 gives the reference XXH64 results.
+ * @return 64-bit hash.
+ */
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed);
+
+/**
+ * 64-bit FNV-1a.
+ */
+uint64_t hash_fnv1a(const void *data, size_t len);
+
+#endif // HASH_H
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "conhash.h"
+
+// Hash microbenchmark: ns per key for every ring hash at typical key
+// lengths.
+
+#define KEYS_PER_LENGTH 4096
+#define ROUNDS 200
+
+static const int key_lengths[] = {8, 16, 32, 64, 128};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    int length_count = sizeof(key_lengths) / sizeof(key_lengths[0]);
+    char *keys = (char *)malloc(KEYS_PER_LENGTH * 129);
+    volatile uint64_t sink = 0;
+
+    printf("%-8s", "hash");
+    for (int l = 0; l < length_count; l++) printf("%10dB", key_lengths[l]);
+    printf("   (ns/key)\n");
+
+    for (const RingHash *h = ring_hashes; h->name; h++) {
+        printf("%-8s", h->name);
+        for (int l = 0; l < length_count; l++) {
+            int len = key_lengths[l];
+            for (int i = 0; i < KEYS_PER_LENGTH; i++) {
+                char *key = keys + i * 129;
+                for (int j = 0; j < len; j++) key[j] = 'a' + (i * 31 + j * 7) % 26;
+                key[len] = '\0';
+            }
+
+            // MD5 is orders of magnitude slower: run it for fewer rounds
+            int rounds = strcmp(h->name, "md5") == 0 ? ROUNDS / 20 : ROUNDS;
+            double start = now_seconds();
+            for (int r = 0; r < rounds; r++) {
+                for (int i = 0; i < KEYS_PER_LENGTH; i++) {
+                    sink += h->fn(keys + i * 129, len);
+                }
+            }
+            double elapsed = now_seconds() - start;
+            printf("%11.1f", elapsed * 1e9 / ((double)rounds * KEYS_PER_LENGTH));
+        }
+        printf("\n");
+    }
+
+    free(keys);
+    return (int)(sink & 0); // Keep the results live
+}
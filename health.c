@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "netbuf.h"
+#include "health.h"
+
+// One in-flight probe
+typedef struct Probe {
+    int fd;          // Socket, -1 once finished
+    int connected;   // Connect completed and ping sent
+    NetBuf in;       // Reply bytes
+} Probe;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int probe_start(Probe *probe, const char *address, int epoll_fd) {
+    char ip[256];
+    int port;
+    if (sscanf(address, "%255[^:]:%d", ip, &port) != 2) return -1;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    set_nonblocking(sock);
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &server_addr.sin_addr);
+
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 &&
+        errno != EINPROGRESS) {
+        close(sock);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = probe;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        close(sock);
+        return -1;
+    }
+    probe->fd = sock;
+    return 0;
+}
+
+static void probe_finish(Probe *probe, int *alive, int result) {
+    close(probe->fd); // Also removes it from the epoll set
+    probe->fd = -1;
+    *alive = result;
+}
+
+// Advance one probe; returns 1 once it has finished
+static int probe_event(Probe *probe, int epoll_fd, uint32_t events, int *alive) {
+    if (events & EPOLLERR) {
+        probe_finish(probe, alive, 0);
+        return 1;
+    }
+
+    if (!probe->connected) {
+        if (!(events & EPOLLOUT)) return 0;
+        if (send(probe->fd, HEALTH_PING, strlen(HEALTH_PING), MSG_NOSIGNAL) < 0) {
+            probe_finish(probe, alive, 0);
+            return 1;
+        }
+        probe->connected = 1;
+
+        // Only the reply matters from now on
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = probe;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, probe->fd, &ev);
+        return 0;
+    }
+
+    ssize_t n = netbuf_read_fd(&probe->in, probe->fd, 256);
+    char *nl = memchr(NETBUF_PTR(&probe->in), '\n', probe->in.len);
+    if (nl) {
+        probe_finish(probe, alive, strncmp(NETBUF_PTR(&probe->in), HEALTH_PONG, strlen(HEALTH_PONG)) == 0);
+        return 1;
+    }
+    if (n < 0 || probe->in.len >= 256) {
+        probe_finish(probe, alive, 0);
+        return 1;
+    }
+    return 0;
+}
+
+void health_probe(const char *const *addresses, int count, int timeout_ms, int *alive) {
+    Probe *probes = (Probe *)calloc(count > 0 ? count : 1, sizeof(Probe));
+    int epoll_fd = epoll_create1(0);
+    int pending = 0;
+
+    for (int i = 0; i < count; i++) {
+        alive[i] = 0;
+        probes[i].fd = -1;
+        if (epoll_fd >= 0 && probe_start(&probes[i], addresses[i], epoll_fd) == 0) pending++;
+    }
+
+    long long deadline = now_ms() + timeout_ms;
+    struct epoll_event events[64];
+    while (pending > 0) {
+        long long remaining = deadline - now_ms();
+        if (remaining <= 0) break;
+
+        int n = epoll_wait(epoll_fd, events, 64, (int)remaining);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            Probe *probe = (Probe *)events[i].data.ptr;
+            if (probe->fd < 0) continue;
+            pending -= probe_event(probe, epoll_fd, events[i].events, &alive[probe - probes]);
+        }
+    }
+
+    // Whatever has not answered by the deadline counts as down
+    for (int i = 0; i < count; i++) {
+        if (probes[i].fd >= 0) close(probes[i].fd);
+        netbuf_free(&probes[i].in);
+    }
+    if (epoll_fd >= 0) close(epoll_fd);
+    free(probes);
+}
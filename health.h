@@ -0,0 +1,17 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#define HEALTH_PING "ping\n"   // Application-level probe request
+#define HEALTH_PONG "PONG"     // Expected reply
+
+/**
+ * Probe servers in parallel: each gets a non-blocking connect followed by
+ * a ping on the cache protocol, all bounded by one deadline.
+ * @param addresses Server addresses ("ip:port").
+ * @param count Number of servers.
+ * @param timeout_ms Time allowed for the whole round, in milliseconds.
+ * @param alive Set to 1 for each server that answered the ping in time, else 0.
+ */
+void health_probe(const char *const *addresses, int count, int timeout_ms, int *alive);
+
+#endif // HEALTH_H
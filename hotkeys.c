@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hotkeys.h"
+
+int hotkeys_init(HotKeys *hot, int capacity, uint32_t threshold, HotSet *shared) {
+    memset(hot, 0, sizeof(*hot));
+    if (sketch_init(&hot->sketch, HOTKEYS_SKETCH_WIDTH) < 0) return -1;
+    hot->heap = (HotKey *)calloc(capacity, sizeof(HotKey));
+    if (!hot->heap) {
+        sketch_free(&hot->sketch);
+        return -1;
+    }
+    hot->capacity = capacity;
+    hot->threshold = threshold;
+    hot->shared = shared;
+    pthread_mutex_init(&hot->lock, NULL);
+    return 0;
+}
+
+static void swap_keys(HotKeys *hot, int a, int b) {
+    HotKey tmp = hot->heap[a];
+    hot->heap[a] = hot->heap[b];
+    hot->heap[b] = tmp;
+}
+
+static void sift_up(HotKeys *hot, int i) {
+    while (i > 0 && hot->heap[(i - 1) / 2].count > hot->heap[i].count) {
+        swap_keys(hot, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(HotKeys *hot, int i) {
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < hot->size && hot->heap[left].count < hot->heap[smallest].count) smallest = left;
+        if (right < hot->size && hot->heap[right].count < hot->heap[smallest].count) smallest = right;
+        if (smallest == i) return;
+        swap_keys(hot, i, smallest);
+        i = smallest;
+    }
+}
+
+static atomic_uint *shared_count(const HotSet *shared, uint64_t hash) {
+    return (atomic_uint *)&shared->counts[hash & (HOTKEYS_SHARED_SLOTS - 1)];
+}
+
+// The set learns of a hot key before the caller acts on it being hot
+static void mark_hot(HotKeys *hot, HotKey *key) {
+    if (key->was_hot) return;
+    key->was_hot = 1;
+    atomic_fetch_add(shared_count(hot->shared, key->hash), 1);
+}
+
+// The heap is small, so a linear scan on the hash beats keeping an index
+static int find_key(const HotKeys *hot, const char *key, size_t key_len, uint64_t hash) {
+    if (key_len >= sizeof(hot->heap[0].key)) return -1;
+    for (int i = 0; i < hot->size; i++) {
+        const char *tracked = hot->heap[i].key;
+        if (hot->heap[i].hash == hash && memcmp(tracked, key, key_len) == 0 && tracked[key_len] == '\0') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int hotkeys_record(HotKeys *hot, const char *key, size_t key_len, uint64_t hash, char *dropped) {
+    dropped[0] = '\0';
+    if (key_len >= sizeof(hot->heap[0].key)) return 0;
+
+    pthread_mutex_lock(&hot->lock);
+    uint32_t count = sketch_add(&hot->sketch, hash);
+    int is_hot = count >= hot->threshold;
+    int i = find_key(hot, key, key_len, hash);
+
+    if (i >= 0) {
+        hot->heap[i].count = count;
+        if (is_hot) mark_hot(hot, &hot->heap[i]);
+        sift_down(hot, i);
+    } else {
+        if (hot->size == hot->capacity) {
+            // Counts in the heap only go stale upwards, as the sketch halves
+            // its counters: bring the top up to date before comparing with it
+            uint32_t fresh;
+            while ((fresh = sketch_estimate(&hot->sketch, hot->heap[0].hash)) < hot->heap[0].count) {
+                hot->heap[0].count = fresh;
+                sift_down(hot, 0);
+            }
+            if (count <= hot->heap[0].count) {
+                pthread_mutex_unlock(&hot->lock);
+                return 0; // Not among the most frequent keys, so not hot
+            }
+            if (hot->heap[0].was_hot) {
+                strcpy(dropped, hot->heap[0].key);
+                atomic_fetch_sub(shared_count(hot->shared, hot->heap[0].hash), 1);
+            }
+            hot->heap[0] = hot->heap[--hot->size];
+            sift_down(hot, 0);
+        }
+        i = hot->size++;
+        memcpy(hot->heap[i].key, key, key_len);
+        hot->heap[i].key[key_len] = '\0';
+        hot->heap[i].hash = hash;
+        hot->heap[i].count = count;
+        hot->heap[i].was_hot = 0;
+        if (is_hot) mark_hot(hot, &hot->heap[i]);
+        sift_up(hot, i);
+    }
+    pthread_mutex_unlock(&hot->lock);
+    return is_hot;
+}
+
+int hotkeys_was_hot(const HotSet *shared, uint64_t hash) {
+    return atomic_load(shared_count(shared, hash)) > 0;
+}
+
+void hotkeys_report(HotKeys *trackers, int count, NetBuf *out) {
+    int capacity = 0;
+    for (int t = 0; t < count; t++) capacity += trackers[t].capacity;
+    HotKey *merged = (HotKey *)malloc((capacity > 0 ? capacity : 1) * sizeof(HotKey));
+    if (!merged) return;
+
+    int size = 0;
+    for (int t = 0; t < count; t++) {
+        HotKeys *hot = &trackers[t];
+        pthread_mutex_lock(&hot->lock);
+        for (int i = 0; i < hot->size; i++) {
+            uint32_t estimate = sketch_estimate(&hot->sketch, hot->heap[i].hash);
+            if (estimate < hot->threshold) continue;
+            int j = 0;
+            while (j < size && strcmp(merged[j].key, hot->heap[i].key) != 0) j++;
+            if (j == size) {
+                merged[size] = hot->heap[i];
+                merged[size++].count = 0;
+            }
+            merged[j].count += estimate;
+        }
+        pthread_mutex_unlock(&hot->lock);
+    }
+    for (int i = 0; i < size; i++) netbuf_printf(out, "\nhot %s count %u", merged[i].key, merged[i].count);
+    free(merged);
+}
+
+void hotkeys_free(HotKeys *hot) {
+    for (int i = 0; i < hot->size; i++) {
+        if (hot->heap[i].was_hot) atomic_fetch_sub(shared_count(hot->shared, hot->heap[i].hash), 1);
+    }
+    sketch_free(&hot->sketch);
+    free(hot->heap);
+    hot->heap = NULL;
+    pthread_mutex_destroy(&hot->lock);
+}
@@ -0,0 +1,92 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "netbuf.h"
+#include "sketch.h"
+
+#define HOTKEYS_DEFAULT_CAPACITY 32   // Most frequent keys tracked
+#define HOTKEYS_DEFAULT_THRESHOLD 32  // Estimate at which a tracked key is hot (at most 255)
+#define HOTKEYS_SKETCH_WIDTH 4096     // Counters per sketch row
+#define HOTKEYS_SHARED_SLOTS 4096     // Counters in a HotSet (power of two)
+
+// Hot-key detection over a stream of reads. A count-min sketch estimates
+// the recent frequency of every key and a min-heap keeps the keys with
+// the highest estimates. A tracked key is hot while its estimate is at
+// least the threshold; the sketch halves its counters as it goes
+// (sketch.h), so keys that cool down sink to the top of the heap and are
+// pushed out by keys that heat up.
+//
+// Each thread keeps its own tracker, so counting a read takes no lock
+// that other threads contend for; the lock only guards against reports.
+// Keys that have been hot on any tracker are counted in a HotSet they
+// share, which threads check without locking.
+typedef struct HotKey {
+    char key[256];
+    uint64_t hash;
+    uint32_t count;      // Estimate when last seen, or when last at the top
+    int was_hot;         // Has been hot since it was tracked
+} HotKey;
+
+typedef struct HotKeys {
+    CountMinSketch sketch;
+    HotKey *heap;        // Min-heap on count
+    int size;
+    int capacity;
+    uint32_t threshold;
+    struct HotSet *shared; // Counts the tracked keys that have been hot
+    pthread_mutex_t lock;
+} HotKeys;
+
+// Keys that have been hot on any of several trackers since they were
+// tracked: a counting filter on the key hash. A key sharing a slot with
+// such a key looks hot too, which costs no more than a needless
+// invalidation.
+typedef struct HotSet {
+    atomic_uint counts[HOTKEYS_SHARED_SLOTS];
+} HotSet;
+
+/**
+ * Initialize a tracker.
+ * @param capacity Number of keys tracked.
+ * @param threshold Estimate at which a tracked key is hot.
+ * @param shared Set the tracker adds its keys to when they become hot.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int hotkeys_init(HotKeys *hot, int capacity, uint32_t threshold, HotSet *shared);
+
+/**
+ * Count one read of a key. Keys of 256 bytes or more are not tracked.
+ * @param key The key; need not be NUL-terminated.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @param dropped Receives a key that was hot and is no longer tracked to
+ *                make room for this one, or "" (at least 256 bytes).
+ * @return 1 if the key is hot.
+ */
+int hotkeys_record(HotKeys *hot, const char *key, size_t key_len, uint64_t hash, char *dropped);
+
+/**
+ * Check, without counting or locking, whether a key has been hot on any
+ * tracker sharing the set since that tracker started tracking it. Such
+ * keys may have copies wherever hot reads went.
+ * @param hash Hash of the key.
+ */
+int hotkeys_was_hot(const HotSet *shared, uint64_t hash);
+
+/**
+ * Append the keys that are hot on any of several trackers to a report,
+ * one line each, with their estimates summed over the trackers.
+ * @param count Number of trackers.
+ */
+void hotkeys_report(HotKeys *trackers, int count, NetBuf *out);
+
+/**
+ * Free a tracker, removing its keys from the shared set.
+ */
+void hotkeys_free(HotKeys *hot);
+
+#endif // HOTKEYS_H
@@ -1,138 +1,1402 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include "conhash.h"
+#include "dbpool.h"
+#include "netbuf.h"
+#include "backend.h"
+#include "health.h"
+#include "hotkeys.h"
+#include "proto.h"
 
 #define BUFFER_SIZE 1024
+#define MAX_REQUEST_SIZE (1024 * 1024) // Largest request buffered per client
+#define MAX_EVENTS 256
+#define WORKER_WAIT_MS 1000 // Longest a worker sleeps before checking for ring changes
 #define LB_PORT 9090       // Port for the load balancer
 #define ANNOUNCE_PORT 9091 // Port for servers to announce themselves
-#define HEALTH_CHECK_INTERVAL 5 // Health check interval in seconds
+// Failure detection. A crashed server refuses connections: once a failed
+// forward reports it, two retry rounds take it off the ring within about
+// 2 * HEALTH_RETRY_INTERVAL_MS; without traffic the next scheduled round
+// finds it. A server that hangs is only noticed by probe timeouts: at
+// worst HEALTH_CHECK_INTERVAL_MS + HEALTH_PROBE_TIMEOUT_MS
+// + (SUSPECT_FAILURES - 1) * (HEALTH_RETRY_INTERVAL_MS + HEALTH_PROBE_TIMEOUT_MS),
+// 170 ms with these values.
+#define HEALTH_CHECK_INTERVAL_MS 100  // Time between probe rounds
+#define HEALTH_RETRY_INTERVAL_MS 5    // Time between rounds while a server is suspect
+#define HEALTH_PROBE_TIMEOUT_MS 20    // Deadline for a whole probe round
+#define SUSPECT_FAILURES 3            // Failures in a row before a server leaves the ring
+#define RECOVERY_SUCCESSES 3          // Successes in a row before it rejoins
+#define MAX_PASSIVE_REPORTS 64        // Failed servers remembered between probe rounds
+#define DEFAULT_LOAD_FACTOR 0         // Bound on a server's in-flight requests relative to the average; 0 = off
+#define MAX_CANDIDATES 8              // Servers tried before giving up on the load bound
+#define DEFAULT_REPLICAS 1            // Servers that may serve reads of any key
 
-HashRing ring = {0}; // Global consistent hash ring
-pthread_mutex_t lock;
+// In-flight accounting for one server, shared by all workers. Never
+// freed: snapshots and pending requests may still point at it after the
+// server has left the ring.
+typedef struct ServerLoad {
+    char address[256];
+    atomic_long inflight;          // Requests sent and not yet answered
+    atomic_ullong requests;        // Requests sent in total
+    atomic_ullong diverted;        // Requests sent here because the first choice was overloaded
+} ServerLoad;
 
-// Function to check server health
-int is_server_alive(const char *server_address) {
-    char ip[256];
-    int port;
-    sscanf(server_address, "%[^:]:%d", ip, &port);
+static atomic_long total_inflight; // Sum of inflight over all servers
+static double load_factor = DEFAULT_LOAD_FACTOR; // 0 disables the bound
+static const char *ring_hash_name = DEFAULT_RING_HASH; // Named in migration requests
+static int verbose = 0; // Log every forwarded request (-v)
 
-    int sock;
-    struct sockaddr_in server_addr;
+// Replication: reads of a key are spread over its first replicas
+// candidates on the ring, or hot_replicas for keys read often enough to
+// be hot. Writes go to the first candidate only; once they are answered
+// the copies the other replicas may hold are invalidated, and they read
+// the new value from db_server on their next miss. The write is only
+// acknowledged once every invalidation has been answered, so a client that
+// sees the acknowledgement cannot read the old value from a replica.
+// Each worker detects hot keys in the reads it routes; a key hot on any
+// worker is in hot_set, so writes through every worker invalidate it.
+static int replicas = DEFAULT_REPLICAS;
+static int hot_replicas;                   // Same as replicas unless set: detection off
+static HotKeys *hot_keys;                  // One per worker, while hot_replicas > replicas
+static HotSet hot_set;
+static __thread unsigned int replica_seed; // Breaks ties between replicas
 
-    // Create socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        return 0; // Server not reachable
+// An immutable version of the hash ring. Workers route with whichever
+// snapshot is current without locking; writers copy it, change the copy
+// and publish that in its place.
+typedef struct RingSnapshot {
+    HashRing ring;
+    ServerLoad **loads;            // Load of each ring.nodes[i]
+    unsigned long version;         // Increases with every published change
+    unsigned long retired_at;      // Version that replaced this one
+    struct RingSnapshot *next_retired;
+} RingSnapshot;
+
+static _Atomic(RingSnapshot *) current_ring;
+pthread_mutex_t lock; // Guards server health and ring publication; never taken by workers
+
+// Retired snapshots are freed once every worker has passed a quiescent
+// point (between two event batches) after the snapshot was replaced
+static atomic_ulong *worker_quiescent; // Per worker: newest version seen while quiescent
+static int worker_count;
+static RingSnapshot *retired_rings;    // Guarded by lock
+
+// Start a change to the ring: returns a private copy of the current
+// snapshot. Called with lock held.
+static RingSnapshot *begin_ring_update(void) {
+    RingSnapshot *current = atomic_load(&current_ring);
+    RingSnapshot *next = (RingSnapshot *)calloc(1, sizeof(RingSnapshot));
+    if (!next || copy_ring(&next->ring, &current->ring) < 0) {
+        perror("Failed to copy hash ring");
+        free(next);
+        return NULL;
+    }
+    next->version = current->version + 1;
+    return next;
+}
+
+static void reclaim_rings(void) {
+    unsigned long oldest = ULONG_MAX;
+    for (int i = 0; i < worker_count; i++) {
+        unsigned long seen = atomic_load(&worker_quiescent[i]);
+        if (seen < oldest) oldest = seen;
+    }
+
+    RingSnapshot **link = &retired_rings;
+    while (*link) {
+        RingSnapshot *snapshot = *link;
+        if (snapshot->retired_at <= oldest) {
+            *link = snapshot->next_retired;
+            free_ring(&snapshot->ring);
+            free(snapshot->loads);
+            free(snapshot);
+        } else {
+            link = &snapshot->next_retired;
+        }
+    }
+}
+
+// Make a snapshot from begin_ring_update() current. Called with lock held.
+static void publish_ring(RingSnapshot *next) {
+    RingSnapshot *old = atomic_exchange(&current_ring, next);
+    old->retired_at = next->version;
+    old->next_retired = retired_rings;
+    retired_rings = old;
+    reclaim_rings();
+}
+
+// Health of every server ever announced, whether or not it is on the
+// ring. Entries are only appended, so indices stay valid. Guarded by lock.
+typedef enum ServerState {
+    SERVER_UP,          // On the ring
+    SERVER_SUSPECT,     // On the ring, failed recently; probed rapidly
+    SERVER_DOWN,        // Off the ring
+    SERVER_RECOVERING,  // Off the ring, answering probes again
+} ServerState;
+
+typedef struct ServerHealth {
+    char address[256];
+    ServerState state;
+    int streak;         // Consecutive failures (suspect) or successes (recovering)
+    ServerLoad *load;
+} ServerHealth;
+
+static ServerHealth *servers;
+static int server_count;
+static int server_capacity;
+
+// Servers whose requests failed since the last probe round
+static pthread_mutex_t passive_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t health_wakeup = PTHREAD_COND_INITIALIZER;
+static char passive_failures[MAX_PASSIVE_REPORTS][256];
+static int passive_count;
+
+static const char *const server_state_names[] = {"up", "suspect", "down", "recovering"};
+
+// Called by workers when a request to a server fails: starts a fast
+// probe round instead of waiting for the next scheduled one
+static void report_server_failure(const char *server_address) {
+    pthread_mutex_lock(&passive_lock);
+    int known = 0;
+    for (int i = 0; i < passive_count && !known; i++) {
+        known = strcmp(passive_failures[i], server_address) == 0;
+    }
+    if (!known && passive_count < MAX_PASSIVE_REPORTS) {
+        snprintf(passive_failures[passive_count++], sizeof(passive_failures[0]), "%s", server_address);
+        pthread_cond_signal(&health_wakeup);
+    }
+    pthread_mutex_unlock(&passive_lock);
+}
+
+static ServerHealth *find_server(const char *server_address) {
+    for (int i = 0; i < server_count; i++) {
+        if (strcmp(servers[i].address, server_address) == 0) return &servers[i];
+    }
+    return NULL;
+}
+
+// Keys that one server hands over to, or copies to, another after a ring change
+typedef struct Handover {
+    char from[256];
+    char to[256];
+    int keep;            // from still serves the keys: copy them
+    int range_count;
+    NetBuf ranges;       // "<ring hash> <first>-<last> ..." as cache servers expect it
+} Handover;
+
+// Group the key ranges that servers gain by the server they come from.
+// Ranges whose replicas have all left are lost with them and not handed over.
+// Returns the number of handovers; *out is malloc'd.
+static int plan_handovers(const HashRing *before, const HashRing *after, Handover **out) {
+    RingMove *moves;
+    int move_count = ring_diff(before, after, replicas, &moves);
+    int count = 0;
+    *out = NULL;
+    if (move_count < 0) {
+        // Maglev, jump and rendezvous do not give servers hash ranges
+        if (before->node_count == 0) return 0; // Nothing cached yet
+        fprintf(stderr, "Keys not handed over: %s placement has no key ranges to migrate; "
+                        "new owners read them from db_server\n", after->placement->name);
+        return 0;
+    }
+
+    for (int i = 0; i < move_count; i++) {
+        const char *from = before->nodes[moves[i].from].address;
+        const char *to = after->nodes[moves[i].to].address;
+        int alive = 0;
+        for (int n = 0; n < after->node_count && !alive; n++) {
+            alive = strcmp(after->nodes[n].address, from) == 0;
+        }
+        if (!alive) continue;
+
+        Handover *handover = NULL;
+        for (int h = 0; h < count && !handover; h++) {
+            if (strcmp((*out)[h].from, from) == 0 && strcmp((*out)[h].to, to) == 0 &&
+                (*out)[h].keep == moves[i].keep) {
+                handover = &(*out)[h];
+            }
+        }
+        if (!handover) {
+            *out = (Handover *)realloc(*out, (count + 1) * sizeof(Handover));
+            handover = &(*out)[count++];
+            memset(handover, 0, sizeof(*handover));
+            snprintf(handover->from, sizeof(handover->from), "%s", from);
+            snprintf(handover->to, sizeof(handover->to), "%s", to);
+            handover->keep = moves[i].keep;
+            netbuf_printf(&handover->ranges, "%s", ring_hash_name);
+        }
+        netbuf_printf(&handover->ranges, " %llx-%llx", (unsigned long long)moves[i].first,
+                      (unsigned long long)moves[i].last);
+        handover->range_count++;
+    }
+    free(moves);
+    return count;
+}
+
+// One persistent connection per cache server for migration requests. A
+// ring change sends several to each server involved; the connection is
+// reopened if the server closed it in between.
+typedef struct ControlConn {
+    char address[256];
+    DbPool *pool;
+    struct ControlConn *next;
+} ControlConn;
+
+static ControlConn *control_conns; // Guarded by change_lock
+
+static DbPool *control_pool(const char *server_address) {
+    ControlConn *control;
+    for (control = control_conns; control; control = control->next) {
+        if (strcmp(control->address, server_address) == 0) return control->pool;
+    }
+
+    char host[64];
+    const char *colon = strrchr(server_address, ':');
+    if (!colon || colon - server_address >= (long)sizeof(host)) return NULL;
+    memcpy(host, server_address, colon - server_address);
+    host[colon - server_address] = '\0';
+
+    control = (ControlConn *)calloc(1, sizeof(ControlConn));
+    if (!control) return NULL;
+    control->pool = dbpool_create(host, atoi(colon + 1), 1);
+    if (!control->pool) {
+        free(control);
+        return NULL;
+    }
+    snprintf(control->address, sizeof(control->address), "%s", server_address);
+    control->next = control_conns;
+    control_conns = control;
+    return control->pool;
+}
+
+// Send a migration request to a cache server and wait for its status, or
+// -1 if the server cannot be reached. Called with change_lock held.
+static int control_request(const char *server_address, uint8_t opcode, const char *key,
+                           const NetBuf *value) {
+    DbPool *pool = control_pool(server_address);
+    if (!pool) return -1;
+    DbConn *conn = dbpool_acquire(pool);
+    int status = dbpool_request(pool, conn, opcode, key, strlen(key), NETBUF_PTR(value),
+                                value->len, NULL);
+    dbpool_release(pool, conn);
+    return status;
+}
+
+// Ring changes decided under lock, applied in order by apply_ring_changes()
+typedef struct RingChange {
+    char address[256];
+    int add;
+    struct RingChange *next;
+} RingChange;
+
+static RingChange *pending_changes;                // Oldest first; guarded by lock
+static RingChange **pending_tail = &pending_changes;
+static pthread_mutex_t change_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes apply_ring_changes()
+
+// Add or remove a server once the caller releases the lock and calls
+// apply_ring_changes(). Called with lock held.
+static void queue_ring_change(const char *server_address, int add) {
+    RingChange *change = (RingChange *)calloc(1, sizeof(RingChange));
+    if (!change) {
+        perror("Failed to queue ring change");
+        return;
+    }
+    snprintf(change->address, sizeof(change->address), "%s", server_address);
+    change->add = add;
+    *pending_tail = change;
+    pending_tail = &change->next;
+}
+
+// Apply one ring change. Keys that change owner are migrated, and new
+// replicas get copies: each new owner is told where its keys are before
+// the new ring sends it any, so its first misses can already be served
+// from the old owner's cache; the old owners start sending once the new
+// ring is in use. Only building the new ring and publishing it take the
+// lock; the requests to cache servers are made without it. Called with
+// change_lock held, so the ring cannot change between the plan and its
+// publication.
+static void change_ring(const char *server_address, int add) {
+    pthread_mutex_lock(&lock);
+    RingSnapshot *current = atomic_load(&current_ring);
+    RingSnapshot *next = begin_ring_update();
+    if (!next) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    if (add) {
+        add_node(&next->ring, server_address);
+    } else {
+        remove_node(&next->ring, server_address);
+    }
+
+    // Node indices may have changed: line the loads up with them again
+    next->loads = (ServerLoad **)calloc(next->ring.node_count + 1, sizeof(ServerLoad *));
+    for (int i = 0; i < next->ring.node_count; i++) {
+        next->loads[i] = find_server(next->ring.nodes[i].address)->load;
+    }
+
+    Handover *handovers;
+    int handover_count = plan_handovers(&current->ring, &next->ring, &handovers);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < handover_count; i++) {
+        Handover *h = &handovers[i];
+        if (control_request(h->to, PROTO_OP_IMPORT, h->from, &h->ranges) != PROTO_STATUS_OK) {
+            fprintf(stderr, "Server '%s' cannot import keys from '%s'\n", h->to, h->from);
+            h->range_count = 0;
+        }
     }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &server_addr.sin_addr);
+    pthread_mutex_lock(&lock);
+    publish_ring(next);
+    pthread_mutex_unlock(&lock);
 
-    // Try to connect to the server
-    int result = connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    close(sock);
+    for (int i = 0; i < handover_count; i++) {
+        Handover *h = &handovers[i];
+        if (h->range_count == 0) {
+            // Not importing: nothing to send
+        } else if (control_request(h->from, h->keep ? PROTO_OP_REPLICATE : PROTO_OP_MIGRATE, h->to,
+                                   &h->ranges) == PROTO_STATUS_OK) {
+            printf("%s %d key ranges from '%s' to '%s'\n", h->keep ? "Copying" : "Migrating",
+                   h->range_count, h->from, h->to);
+        } else {
+            fprintf(stderr, "Server '%s' cannot migrate keys to '%s'\n", h->from, h->to);
+        }
+        netbuf_free(&h->ranges);
+    }
+    free(handovers);
+}
 
-    return result == 0; // Server is alive if connection succeeds
+// Apply the queued ring changes. Called without lock held.
+static void apply_ring_changes(void) {
+    pthread_mutex_lock(&change_lock);
+    while (1) {
+        pthread_mutex_lock(&lock);
+        RingChange *change = pending_changes;
+        if (change) {
+            pending_changes = change->next;
+            if (!pending_changes) pending_tail = &pending_changes;
+        }
+        pthread_mutex_unlock(&lock);
+        if (!change) break;
+
+        change_ring(change->address, change->add);
+        free(change);
+    }
+    pthread_mutex_unlock(&change_lock);
+}
+
+static void set_server_state(ServerHealth *server, ServerState state) {
+    printf("Server '%s': %s -> %s\n", server->address,
+           server_state_names[server->state], server_state_names[state]);
+    server->state = state;
+    server->streak = 0;
 }
 
-// Health check thread function
+// Hysteresis: a server leaves the ring only after SUSPECT_FAILURES
+// failures in a row and rejoins only after RECOVERY_SUCCESSES successes in
+// a row. Called with lock held; the ring changes are queued.
+static void record_probe(ServerHealth *server, int ok) {
+    switch (server->state) {
+    case SERVER_UP:
+        if (!ok) {
+            set_server_state(server, SERVER_SUSPECT);
+            server->streak = 1;
+        }
+        break;
+    case SERVER_SUSPECT:
+        if (ok) {
+            set_server_state(server, SERVER_UP);
+        } else if (++server->streak >= SUSPECT_FAILURES) {
+            printf("Server '%s' is down. Removing from the ring.\n", server->address);
+            set_server_state(server, SERVER_DOWN);
+            queue_ring_change(server->address, 0);
+        }
+        break;
+    case SERVER_DOWN:
+        if (ok) {
+            set_server_state(server, SERVER_RECOVERING);
+            server->streak = 1;
+        }
+        break;
+    case SERVER_RECOVERING:
+        if (!ok) {
+            set_server_state(server, SERVER_DOWN);
+        } else if (++server->streak >= RECOVERY_SUCCESSES) {
+            printf("Server '%s' recovered. Adding it back to the ring.\n", server->address);
+            set_server_state(server, SERVER_UP);
+            queue_ring_change(server->address, 1);
+        }
+        break;
+    }
+}
+
+// Health check thread function. All servers are probed in parallel
+// without holding the lock; suspect servers are re-probed quickly so a
+// dead server leaves the ring within a few retry intervals.
 void *health_check(void *arg) {
+    int interval_ms = HEALTH_CHECK_INTERVAL_MS;
+
     while (1) {
-        sleep(HEALTH_CHECK_INTERVAL); // Wait for the next health check
+        // Wait for the next round, or for a worker to report a failure
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval_ms / 1000;
+        deadline.tv_nsec += (interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
 
-        pthread_mutex_lock(&lock);
+        char failed[MAX_PASSIVE_REPORTS][256];
+        int rc = 0;
+        pthread_mutex_lock(&passive_lock);
+        while (passive_count == 0 && rc == 0) {
+            rc = pthread_cond_timedwait(&health_wakeup, &passive_lock, &deadline);
+        }
+        int failed_count = passive_count;
+        memcpy(failed, passive_failures, failed_count * sizeof(failed[0]));
+        passive_count = 0;
+        pthread_mutex_unlock(&passive_lock);
 
-        // Iterate through the hash ring and check server health
-        for (int i = 0; i < ring.node_count; i++) {
-            const char *server_address = ring.nodes[i].address;
-            if (!is_server_alive(server_address)) {
-                printf("Server '%s' is down. Removing from the ring.\n", server_address);
-                remove_node(&ring, server_address);
-            }
+        pthread_mutex_lock(&lock);
+        reclaim_rings();
+        for (int i = 0; i < failed_count; i++) {
+            ServerHealth *server = find_server(failed[i]);
+            if (server && server->state == SERVER_UP) record_probe(server, 0);
+        }
+        int count = server_count;
+        char (*addresses)[256] = malloc((count > 0 ? count : 1) * sizeof(*addresses));
+        const char **names = (const char **)malloc((count > 0 ? count : 1) * sizeof(char *));
+        int *alive = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+        for (int i = 0; i < count; i++) {
+            memcpy(addresses[i], servers[i].address, sizeof(addresses[i]));
+            names[i] = addresses[i];
         }
+        pthread_mutex_unlock(&lock);
+        apply_ring_changes();
+
+        health_probe(names, count, HEALTH_PROBE_TIMEOUT_MS, alive);
 
+        int suspect = 0;
+        pthread_mutex_lock(&lock);
+        for (int i = 0; i < count; i++) {
+            record_probe(&servers[i], alive[i]);
+            suspect |= servers[i].state == SERVER_SUSPECT;
+        }
         pthread_mutex_unlock(&lock);
+        apply_ring_changes();
+        interval_ms = suspect ? HEALTH_RETRY_INTERVAL_MS : HEALTH_CHECK_INTERVAL_MS;
+
+        free(addresses);
+        free(names);
+        free(alive);
     }
     return NULL;
 }
 
-// Forward request to the appropriate server
-void forward_to_server(const char *server_address, const char *client_request, int client_socket) {
-    char ip[256];
-    int port;
-    sscanf(server_address, "%[^:]:%d", ip, &port);
+// Per-worker-thread state
+typedef struct Worker {
+    int epoll_fd;
+    int listen_fd;
+    BackendSet backends;          // This worker's connections to cache servers
+    atomic_ulong *quiescent;      // This worker's slot in worker_quiescent
+    HotKeys *hot_keys;            // This worker's tracker, or NULL if detection is off
+    unsigned long seen_version;   // Ring version when backends were last pruned
+    struct ClientConn *dirty;     // Clients with replies ready to send
+    struct ClientConn *closed;    // Closed clients, freed after the event batch
+} Worker;
 
-    int server_socket;
-    struct sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE] = {0};
+typedef struct LbRequest LbRequest;
+
+// Per-client state, owned by the worker that accepted it
+typedef struct ClientConn {
+    int kind;                     // EVENT_SOURCE_CLIENT (epoll data tag)
+    int fd;                       // Socket, -1 once closed
+    Worker *worker;
+    NetBuf in;                    // Bytes received but not yet parsed
+    NetBuf out;                   // Replies not yet sent
+    int line_mode;                // Set once the client has sent a '\n'-terminated request
+    int eof;                      // Client finished sending
+    LbRequest *head;              // Oldest request whose reply is not sent yet
+    LbRequest *tail;
+    int dirty;                    // Queued on worker->dirty
+    struct ClientConn *next_dirty;
+    struct ClientConn *next;      // Next client on worker->closed
+} ClientConn;
+
+// A client request forwarded to a cache server
+struct LbRequest {
+    BackendRequest backend;       // Must be first: backend.c hands this pointer back
+    LbRequest *next;              // Next request from the same client
+    ClientConn *client;           // NULL once the client has gone away
+    int line_mode;                // Reply gets a '\n' terminator
+    uint8_t opcode;               // Binary requests: echoed in error responses
+    uint32_t opaque;
+    int done;                     // reply holds the final response
+    NetBuf reply;
+    char server[256];             // Server the request was sent to
+    Worker *worker;               // Worker that sent it
+    ServerLoad *load;             // That server's load, while in flight
+    struct MultiRequest *part_of; // Set on the per-server parts of an mget/mset
+    int *slots;                   // Part: index in the parent of each key it carries
+    int slot_count;
+    NetBuf written;               // Keys to invalidate on other replicas once answered, each '\0'-terminated
+    int uncached;                 // Diverted get sent as PROTO_OP_GET_UNCACHED
+    int text_client;              // Uncached: the client sent a text get
+    int invalidations;            // Write: invalidations not yet answered
+    int replied;                  // Write: reply built, held for the invalidations
+    LbRequest *held;              // Invalidation: the write whose reply waits for it
+};
+
+// An mget or mset split into one batched binary request per server. The
+// parent request sits on the client's queue; the parts are not queued
+// there and complete it once the last one has answered.
+typedef struct MultiRequest {
+    LbRequest *parent;
+    int pending;                  // Parts still waiting for their reply
+    int failed;                   // Some part got no usable reply
+    int count;                    // Keys in the request
+    NetBuf *values;               // mget: value of each key
+    char *found;                  // mget: whether each key has a value
+    NetBuf servers;               // Servers the parts went to
+} MultiRequest;
+
+// One key (and for mset, its value) of a multi-key request
+typedef struct MultiItem {
+    char *key;
+    const char *value;
+    size_t value_len;
+} MultiItem;
+
+static void mark_dirty(ClientConn *client) {
+    if (client->dirty) return;
+    client->dirty = 1;
+    client->next_dirty = client->worker->dirty;
+    client->worker->dirty = client;
+}
 
-    // Create socket for connecting to server
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("Failed to create server socket");
-        send(client_socket, "Error: Unable to connect to server\n", 36, 0);
+static void free_request(LbRequest *req) {
+    netbuf_free(&req->reply);
+    netbuf_free(&req->written);
+    free(req);
+}
+
+// The reply text is complete: terminate it and mark the request done
+static void finish_request(LbRequest *req) {
+    if (req->line_mode) netbuf_append(&req->reply, "\n", 1);
+    req->done = 1;
+}
+
+// The reply to a request is built. It is sent, or dropped if the client
+// has gone away, once the invalidations of its write are answered.
+static void reply_built(LbRequest *req) {
+    req->replied = 1;
+    if (req->invalidations > 0) return;
+    if (!req->client) {
+        free_request(req);
         return;
     }
+    finish_request(req);
+    mark_dirty(req->client);
+}
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &server_addr.sin_addr);
+// An invalidation sent for a write has been answered
+static void invalidation_answered(LbRequest *write) {
+    if (--write->invalidations == 0 && write->replied) reply_built(write);
+}
 
-    // Connect to the server
-    if (connect(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Failed to connect to server");
-        send(client_socket, "Error: Server connection failed\n", 34, 0);
-        close(server_socket);
+// All parts of an mget or mset are in: build the combined reply, in the
+// same format the client used
+static void finish_multi(MultiRequest *multi) {
+    LbRequest *parent = multi->parent;
+    ClientConn *client = parent->client;
+    int mget = parent->opcode == PROTO_OP_MGET;
+
+    if (!client) {
+        // Nobody to answer
+    } else if (parent->backend.binary) {
+        NetBuf body = {0};
+        for (int i = 0; mget && !multi->failed && i < multi->count; i++) {
+            const char *value = multi->values[i].data ? NETBUF_PTR(&multi->values[i]) : "";
+            proto_put_value(&body, multi->found[i] ? value : NULL, multi->values[i].len);
+        }
+        proto_write(&parent->reply, PROTO_MAGIC_RESPONSE, parent->opcode,
+                    multi->failed ? PROTO_STATUS_UNAVAILABLE : PROTO_STATUS_OK, parent->opaque,
+                    NULL, 0, NETBUF_PTR(&body), body.len);
+        netbuf_free(&body);
+    } else if (multi->failed) {
+        netbuf_printf(&parent->reply, "Error: Server connection failed");
+    } else {
+        netbuf_printf(&parent->reply, "Server: %.*s | Response: ",
+                      (int)multi->servers.len, NETBUF_PTR(&multi->servers));
+        for (int i = 0; mget && i < multi->count; i++) {
+            if (i > 0) netbuf_append(&parent->reply, " ", 1);
+            if (multi->found[i]) {
+                netbuf_append(&parent->reply, NETBUF_PTR(&multi->values[i]), multi->values[i].len);
+            } else {
+                netbuf_append(&parent->reply, "null", 4);
+            }
+        }
+        if (!mget) netbuf_append(&parent->reply, "OK", 2);
+    }
+
+    reply_built(parent);
+    for (int i = 0; i < multi->count; i++) netbuf_free(&multi->values[i]);
+    free(multi->values);
+    free(multi->found);
+    netbuf_free(&multi->servers);
+    free(multi);
+}
+
+static void part_done(MultiRequest *multi) {
+    if (--multi->pending == 0) finish_multi(multi);
+}
+
+// A server answered its part of an mget or mset: file the values under
+// the keys' positions in the parent
+static void on_part_reply(LbRequest *part, const char *reply, size_t len) {
+    MultiRequest *multi = part->part_of;
+    ProtoMessage msg;
+
+    if (!reply) {
+        fprintf(stderr, "Failed to reach server '%s'\n", part->server);
+        report_server_failure(part->server);
+        multi->failed = 1;
+    } else if (proto_parse(reply, len, &msg) <= 0 || msg.status != PROTO_STATUS_OK) {
+        multi->failed = 1;
+    } else if (part->opcode == PROTO_OP_MGET || part->opcode == PROTO_OP_MGET_UNCACHED) {
+        ProtoCursor cursor = {msg.value, msg.value + msg.value_len};
+        for (int i = 0; i < part->slot_count; i++) {
+            const char *value;
+            size_t value_len;
+            if (proto_next_value(&cursor, &value, &value_len) != 1) {
+                multi->failed = 1;
+                break;
+            }
+            if (value) {
+                netbuf_append(&multi->values[part->slots[i]], value, value_len);
+                multi->found[part->slots[i]] = 1;
+            }
+        }
+    }
+
+    free(part->slots);
+    free_request(part);
+    part_done(multi);
+}
+
+static void invalidate_written(LbRequest *req);
+
+// Backend callback: record the reply and let the worker send it once all
+// earlier replies to the same client have gone out
+static void on_backend_reply(BackendRequest *breq, const char *reply, size_t len) {
+    LbRequest *req = (LbRequest *)breq;
+    if (req->load) {
+        atomic_fetch_sub(&req->load->inflight, 1);
+        atomic_fetch_sub(&total_inflight, 1);
+    }
+    if (req->written.len > 0) invalidate_written(req);
+    if (req->part_of) {
+        on_part_reply(req, reply, len);
         return;
     }
+    if (req->held) {
+        invalidation_answered(req->held);
+        free_request(req);
+        return;
+    }
+    if (!req->client) {
+        reply_built(req);
+        return;
+    }
+    if (req->uncached) req->backend.binary = !req->text_client; // Answer in the client's format
 
-    // Forward client request to server
-    send(server_socket, client_request, strlen(client_request), 0);
+    if (reply && req->uncached) {
+        // Answer as the get the client sent
+        ProtoMessage msg;
+        if (proto_parse(reply, len, &msg) <= 0) {
+            msg.status = PROTO_STATUS_UNAVAILABLE;
+            msg.value_len = 0;
+        }
+        if (!req->text_client) {
+            proto_write(&req->reply, PROTO_MAGIC_RESPONSE, PROTO_OP_GET, msg.status, req->opaque, NULL,
+                        0, msg.value, msg.value_len);
+        } else if (msg.status == PROTO_STATUS_OK) {
+            netbuf_printf(&req->reply, "Server: %s | Response: %.*s", req->server, (int)msg.value_len,
+                          msg.value);
+        } else {
+            netbuf_printf(&req->reply, "Server: %s | Response: null", req->server);
+        }
+    } else if (reply && req->backend.binary) {
+        netbuf_append(&req->reply, reply, len); // Passed through untouched
+    } else if (reply) {
+        netbuf_printf(&req->reply, "Server: %s | Response: %.*s", req->server, (int)len, reply);
+    } else {
+        fprintf(stderr, "Failed to reach server '%s'\n", req->server);
+        if (req->backend.binary) {
+            proto_write(&req->reply, PROTO_MAGIC_RESPONSE, req->opcode, PROTO_STATUS_UNAVAILABLE,
+                        req->opaque, NULL, 0, NULL, 0);
+        } else {
+            netbuf_printf(&req->reply, "Error: Server connection failed");
+        }
+        report_server_failure(req->server);
+    }
+    reply_built(req);
+}
 
-    // Receive server response
-    int bytes_received = recv(server_socket, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
+// Bounded-load consistent hashing: take the first candidate whose
+// in-flight count stays within load_factor times the average. Only reads
+// are moved off their first choice, so writes and deletes always reach
+// the server that owns the key. Reads of a key with several replicas
+// start from the least loaded one. *diverted is set if the server is not
+// one of the key's replicas: writes do not invalidate it, so it must not
+// cache what it reads.
+// Returns an index into the snapshot's nodes, or -1 if the ring is empty.
+static int choose_server(RingSnapshot *snapshot, const char *key, size_t key_len, int may_divert,
+                         int copies, int *diverted) {
+    int candidates[MAX_CANDIDATES];
+    int bounded = may_divert && load_factor > 0 && snapshot->ring.node_count > 1;
+    int count = get_candidates(&snapshot->ring, key, key_len, candidates,
+                               bounded ? MAX_CANDIDATES : copies);
+    *diverted = 0;
+    if (count == 0) return -1;
 
-        // Append server address to response
-        char enhanced_response[BUFFER_SIZE];
-        snprintf(enhanced_response, BUFFER_SIZE, "Server: %s | Response: %s", server_address, buffer);
-        send(client_socket, enhanced_response, strlen(enhanced_response), 0);
+    if (copies > 1 && count > 1) {
+        // Ties are broken at random, so idle replicas share the reads too
+        int n = copies < count ? copies : count;
+        int first = rand_r(&replica_seed) % n;
+        int pick = first;
+        for (int j = 1; j < n; j++) {
+            int i = (first + j) % n;
+            if (atomic_load(&snapshot->loads[candidates[i]]->inflight) <
+                atomic_load(&snapshot->loads[candidates[pick]]->inflight)) {
+                pick = i;
+            }
+        }
+        int chosen = candidates[pick];
+        candidates[pick] = candidates[0];
+        candidates[0] = chosen;
     }
+    if (!bounded) return candidates[0];
+
+    double limit = load_factor * (atomic_load(&total_inflight) + 1) / snapshot->ring.node_count;
+    long bound = (long)limit;
+    if (bound < limit) bound++; // ceil
 
-    close(server_socket);
+    int best = 0;
+    long best_load = LONG_MAX;
+    for (int i = 0; i < count; i++) {
+        long load = atomic_load(&snapshot->loads[candidates[i]]->inflight);
+        if (load + 1 <= bound) {
+            best = i;
+            break;
+        }
+        if (load < best_load) {
+            best = i; // If every candidate is over the bound: the least loaded
+            best_load = load;
+        }
+    }
+    if (best > 0) atomic_fetch_add(&snapshot->loads[candidates[best]]->diverted, 1);
+    *diverted = best >= copies;
+    return candidates[best];
 }
 
-// Handle client connections
-void *handle_client(void *client_socket_ptr) {
-    int client_socket = *(int *)client_socket_ptr;
-    free(client_socket_ptr);
+// Per-server load report for the "lbstats" command
+static void load_stats(NetBuf *out) {
+    RingSnapshot *snapshot = atomic_load(&current_ring);
+    netbuf_printf(out, "inflight %ld factor %.2f replicas %d hot_replicas %d",
+                  atomic_load(&total_inflight), load_factor, replicas, hot_replicas);
+    for (int i = 0; i < snapshot->ring.node_count; i++) {
+        ServerLoad *load = snapshot->loads[i];
+        netbuf_printf(out, "\nserver %s inflight %ld requests %llu diverted %llu", load->address,
+                      atomic_load(&load->inflight), atomic_load(&load->requests),
+                      atomic_load(&load->diverted));
+    }
+    if (hot_replicas > replicas) hotkeys_report(hot_keys, worker_count, out);
+}
 
-    char buffer[BUFFER_SIZE] = {0};
-    recv(client_socket, buffer, BUFFER_SIZE, 0);
+// Queue a new request on a client. Replies keep the order of the requests.
+static LbRequest *new_request(ClientConn *client, int line_mode) {
+    LbRequest *req = (LbRequest *)calloc(1, sizeof(LbRequest));
+    req->client = client;
+    req->line_mode = line_mode;
+    if (client->tail) {
+        client->tail->next = req;
+    } else {
+        client->head = req;
+    }
+    client->tail = req;
+    return req;
+}
+
+// Complete a request with a reply generated here rather than by a server
+static void answer_locally(LbRequest *req, uint16_t status, const char *text) {
+    if (req->backend.binary) {
+        proto_write(&req->reply, PROTO_MAGIC_RESPONSE, req->opcode, status, req->opaque,
+                    NULL, 0, NULL, 0);
+    } else {
+        netbuf_printf(&req->reply, "%s", text);
+    }
+    finish_request(req);
+    mark_dirty(req->client);
+}
+
+// Send a request to one of the snapshot's servers
+static void send_to_server(Worker *worker, LbRequest *req, RingSnapshot *snapshot, int node,
+                           const char *data, size_t len) {
+    snprintf(req->server, sizeof(req->server), "%s", snapshot->ring.nodes[node].address);
+    req->worker = worker;
+    req->load = snapshot->loads[node];
+    atomic_fetch_add(&req->load->inflight, 1);
+    atomic_fetch_add(&req->load->requests, 1);
+    atomic_fetch_add(&total_inflight, 1);
+
+    BackendSet *backends = &worker->backends;
+    BackendConn *conn = backend_get(backends, req->server);
+    if (!conn) {
+        on_backend_reply(&req->backend, NULL, 0);
+        return;
+    }
+    // On failure the callback has already completed the request
+    backend_send(backends, conn, data, len, &req->backend);
+}
+
+static uint64_t key_hash(const char *key, size_t key_len) {
+    return atomic_load(&current_ring)->ring.hash(key, key_len);
+}
 
-    // Parse the key from the client request
-    char command[10], key[256];
-    sscanf(buffer, "%s %s", command, key);
+// Drop a key from the caches of its replicas after the first. If write is
+// set, its reply is held until they have all answered.
+static void invalidate_replicas(Worker *worker, const char *key, size_t key_len, int copies,
+                                LbRequest *write) {
+    RingSnapshot *snapshot = atomic_load(&current_ring);
+    int candidates[MAX_CANDIDATES];
+    int count = get_candidates(&snapshot->ring, key, key_len, candidates, copies);
+    if (count < 2) return;
 
+    NetBuf frame = {0};
+    proto_write(&frame, PROTO_MAGIC_REQUEST, PROTO_OP_INVALIDATE, 0, 0, key, key_len, NULL, 0);
+    for (int i = 1; i < count; i++) {
+        LbRequest *req = (LbRequest *)calloc(1, sizeof(LbRequest));
+        req->backend.binary = 1;
+        req->opcode = PROTO_OP_INVALIDATE;
+        req->held = write;
+        if (write) write->invalidations++;
+        send_to_server(worker, req, snapshot, candidates[i], NETBUF_PTR(&frame), frame.len);
+    }
+    netbuf_free(&frame);
+}
+
+// Number of replicas that may hold a copy of a key being written
+static int write_copies(const char *key, size_t key_len) {
+    if (hot_replicas > replicas && hotkeys_was_hot(&hot_set, key_hash(key, key_len))) return hot_replicas;
+    return replicas;
+}
+
+// Number of replicas a read of a key may go to. Counts the read towards
+// hot-key detection; a key that stops being tracked after having been
+// hot has its extra copies invalidated, as later writes no longer reach them.
+static int read_copies(Worker *worker, const char *key, size_t key_len) {
+    if (hot_replicas <= replicas) return replicas;
+    char dropped[256];
+    int hot = hotkeys_record(worker->hot_keys, key, key_len, key_hash(key, key_len), dropped);
+    if (dropped[0]) invalidate_replicas(worker, dropped, strlen(dropped), hot_replicas, NULL);
+    return hot ? hot_replicas : replicas;
+}
+
+// A write has been answered: invalidate its keys on the other replicas.
+// The part of an mset holds the reply to the whole mset.
+static void invalidate_written(LbRequest *req) {
+    LbRequest *write = req->part_of ? req->part_of->parent : req;
+    const char *key = NETBUF_PTR(&req->written);
+    const char *end = key + req->written.len;
+    for (size_t len; key < end; key += len + 1) {
+        len = strlen(key);
+        invalidate_replicas(req->worker, key, len, write_copies(key, len), write);
+    }
+}
+
+// Send a request to the server chosen for its key. The key need not be
+// NUL-terminated; it may point into the request.
+static void forward_request(LbRequest *req, const char *key, size_t key_len, int is_read,
+                            int is_write, const char *data, size_t len) {
     // Get the appropriate server for the key from the ring
-    pthread_mutex_lock(&lock);
-    const char *server_address = get_node(&ring, key);
-    pthread_mutex_unlock(&lock);
+    RingSnapshot *snapshot = atomic_load(&current_ring);
+    int copies = is_read ? read_copies(req->client->worker, key, key_len) : 1;
+    int diverted;
+    int node = choose_server(snapshot, key, key_len, is_read, copies, &diverted);
+    if (node < 0) {
+        answer_locally(req, PROTO_STATUS_UNAVAILABLE, "Error: No available server");
+        return;
+    }
+    if (is_write && write_copies(key, key_len) > 1) {
+        netbuf_append(&req->written, key, key_len);
+        netbuf_append(&req->written, "", 1);
+    }
+    if (verbose) {
+        printf("Forwarding request for key '%.*s' to server '%s'\n", (int)key_len, key,
+               snapshot->ring.nodes[node].address);
+    }
+    if (!diverted) {
+        send_to_server(req->client->worker, req, snapshot, node, data, len);
+        return;
+    }
 
-    if (server_address) {
-        printf("Forwarding request for key '%s' to server '%s'\n", key, server_address);
-        forward_to_server(server_address, buffer, client_socket);
-    } else {
-        send(client_socket, "Error: No available server\n", 28, 0);
+    // Re-encoded, whatever the client sent; the reply is translated back
+    NetBuf frame = {0};
+    proto_write(&frame, PROTO_MAGIC_REQUEST, PROTO_OP_GET_UNCACHED, 0, 0, key, key_len, NULL, 0);
+    req->uncached = 1;
+    req->text_client = !req->backend.binary;
+    req->backend.binary = 1;
+    send_to_server(req->client->worker, req, snapshot, node, NETBUF_PTR(&frame), frame.len);
+    netbuf_free(&frame);
+}
+
+// Scatter an mget or mset: group the keys by server and send each server
+// a single batched request, all in parallel. Takes ownership of the items.
+static void scatter_request(LbRequest *parent, MultiItem *items, int count) {
+    Worker *worker = parent->client->worker;
+    RingSnapshot *snapshot = atomic_load(&current_ring);
+    if (snapshot->ring.node_count == 0) {
+        answer_locally(parent, PROTO_STATUS_UNAVAILABLE, "Error: No available server");
+        goto done;
+    }
+
+    MultiRequest *multi = (MultiRequest *)calloc(1, sizeof(MultiRequest));
+    multi->parent = parent;
+    multi->count = count;
+    multi->values = (NetBuf *)calloc(count, sizeof(NetBuf));
+    multi->found = (char *)calloc(count, 1);
+    multi->pending = 1; // Held until every part is sent
+
+    int mget = parent->opcode == PROTO_OP_MGET;
+    int *node_of = (int *)malloc(count * sizeof(int));
+    int *diverted = (int *)malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        size_t key_len = strlen(items[i].key);
+        int copies = mget ? read_copies(worker, items[i].key, key_len) : 1;
+        node_of[i] = choose_server(snapshot, items[i].key, key_len, mget, copies, &diverted[i]);
+    }
+
+    // Keys diverted to a server go in a separate, uncached part
+    for (int i = 0; i < count; i++) {
+        if (node_of[i] < 0) continue; // Already in an earlier part
+        int node = node_of[i], uncached = diverted[i];
+
+        LbRequest *part = (LbRequest *)calloc(1, sizeof(LbRequest));
+        part->backend.binary = 1;
+        part->opcode = uncached ? PROTO_OP_MGET_UNCACHED : parent->opcode;
+        part->part_of = multi;
+        part->slots = (int *)malloc((count - i) * sizeof(int));
+
+        NetBuf body = {0}, frame = {0};
+        for (int j = i; j < count; j++) {
+            if (node_of[j] != node || diverted[j] != uncached) continue;
+            proto_put_key(&body, items[j].key, strlen(items[j].key));
+            if (!mget) {
+                proto_put_value(&body, items[j].value, items[j].value_len);
+                if (write_copies(items[j].key, strlen(items[j].key)) > 1) {
+                    netbuf_append(&part->written, items[j].key, strlen(items[j].key) + 1);
+                }
+            }
+            part->slots[part->slot_count++] = j;
+            node_of[j] = -1;
+        }
+        if (proto_write(&frame, PROTO_MAGIC_REQUEST, part->opcode, 0, 0, NULL, 0,
+                        NETBUF_PTR(&body), body.len) < 0) {
+            multi->failed = 1; // Too large for one message
+            free(part->slots);
+            free_request(part);
+            netbuf_free(&body);
+            continue;
+        }
+
+        if (multi->servers.len > 0) netbuf_append(&multi->servers, ",", 1);
+        netbuf_printf(&multi->servers, "%s", snapshot->ring.nodes[node].address);
+        if (verbose) {
+            printf("Forwarding %d keys to server '%s'\n", part->slot_count,
+                   snapshot->ring.nodes[node].address);
+        }
+
+        multi->pending++;
+        send_to_server(worker, part, snapshot, node, NETBUF_PTR(&frame), frame.len);
+        netbuf_free(&body);
+        netbuf_free(&frame);
+    }
+    free(node_of);
+    free(diverted);
+    part_done(multi);
+
+done:
+    for (int i = 0; i < count; i++) free(items[i].key);
+    free(items);
+}
+
+// Split a text mget or mset into its items
+static void handle_multi_request(LbRequest *req, char *request) {
+    char *saveptr = NULL;
+    char *command = strtok_r(request, " \t\r", &saveptr);
+    req->opcode = strcmp(command, "mget") == 0 ? PROTO_OP_MGET : PROTO_OP_MSET;
+
+    int count = 0, capacity = 16;
+    MultiItem *items = (MultiItem *)malloc(capacity * sizeof(MultiItem));
+    char *arg;
+    while ((arg = strtok_r(NULL, " \t\r", &saveptr)) != NULL) {
+        if (req->opcode == PROTO_OP_MSET && count > 0 && !items[count - 1].value) {
+            items[count - 1].value = arg;
+            items[count - 1].value_len = strlen(arg);
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            items = (MultiItem *)realloc(items, capacity * sizeof(MultiItem));
+        }
+        items[count].key = strdup(arg);
+        items[count].value = NULL;
+        items[count].value_len = 0;
+        count++;
+    }
+
+    if (count == 0 || (req->opcode == PROTO_OP_MSET && !items[count - 1].value)) {
+        for (int i = 0; i < count; i++) free(items[i].key);
+        free(items);
+        answer_locally(req, PROTO_STATUS_INVALID, "Invalid command");
+        return;
+    }
+    scatter_request(req, items, count);
+}
+
+// Split a binary mget or mset into its items
+static void handle_binary_multi(LbRequest *req, const ProtoMessage *msg) {
+    ProtoCursor cursor = {msg->value, msg->value + msg->value_len};
+    int count = 0, capacity = 16, rc;
+    MultiItem *items = (MultiItem *)malloc(capacity * sizeof(MultiItem));
+    const char *key;
+    size_t key_len;
+
+    while ((rc = proto_next_key(&cursor, &key, &key_len)) == 1) {
+        if (memchr(key, '\0', key_len)) break;
+        if (count == capacity) {
+            capacity *= 2;
+            items = (MultiItem *)realloc(items, capacity * sizeof(MultiItem));
+        }
+        MultiItem *item = &items[count++];
+        item->key = strndup(key, key_len);
+        item->value = NULL;
+        item->value_len = 0;
+        if (msg->opcode == PROTO_OP_MSET &&
+            (proto_next_value(&cursor, &item->value, &item->value_len) != 1 || !item->value)) {
+            break;
+        }
+    }
+
+    if (rc != 0 || count == 0) {
+        for (int i = 0; i < count; i++) free(items[i].key);
+        free(items);
+        answer_locally(req, PROTO_STATUS_INVALID, NULL);
+        return;
+    }
+    scatter_request(req, items, count);
+}
+
+// Route one text request to its server
+static void handle_request(ClientConn *client, char *request, int line_mode) {
+    LbRequest *req = new_request(client, line_mode);
+
+    request[strcspn(request, "\r\n")] = '\0'; // Backends frame requests with '\n'
+
+    // Parse the command, and find the key in place: it is routed on whatever its length
+    char command[10] = {0};
+    sscanf(request, "%9s", command);
+    const char *key = request + strspn(request, " \t");
+    key += strcspn(key, " \t");
+    key += strspn(key, " \t");
+    size_t key_len = strcspn(key, " \t");
+
+    if (strcmp(command, "lbstats") == 0) {
+        NetBuf report = {0};
+        load_stats(&report);
+        for (size_t i = 0; i < report.len; i++) {
+            // One line per reply: fold the report like the cache server does
+            char c = NETBUF_PTR(&report)[i];
+            if (c == '\n' && line_mode) {
+                netbuf_append(&req->reply, "; ", 2);
+            } else {
+                netbuf_append(&req->reply, &c, 1);
+            }
+        }
+        netbuf_free(&report);
+        finish_request(req);
+        mark_dirty(client);
+        return;
+    }
+    if (strcmp(command, "mget") == 0 || strcmp(command, "mset") == 0) {
+        handle_multi_request(req, request);
+        return;
+    }
+
+    forward_request(req, key, key_len, strcmp(command, "get") == 0,
+                    strcmp(command, "set") == 0 || strcmp(command, "delete") == 0, request,
+                    strlen(request));
+}
+
+// Opcodes clients may send. The rest are for cache servers and the load
+// balancer among themselves (migration, replica invalidation, dumps).
+static int client_opcode(uint8_t opcode) {
+    switch (opcode) {
+    case PROTO_OP_GET:
+    case PROTO_OP_SET:
+    case PROTO_OP_DELETE:
+    case PROTO_OP_NOOP:
+    case PROTO_OP_STATS:
+    case PROTO_OP_MGET:
+    case PROTO_OP_MSET:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Route one binary request. The message is forwarded and its response
+// returned byte for byte; only the key is looked at.
+static void handle_binary_request(ClientConn *client, const ProtoMessage *msg,
+                                  const char *data, size_t len) {
+    LbRequest *req = new_request(client, 0);
+    req->backend.binary = 1;
+    req->opcode = msg->opcode;
+    req->opaque = msg->opaque;
+
+    if (msg->magic != PROTO_MAGIC_REQUEST || !client_opcode(msg->opcode) ||
+        memchr(msg->key, '\0', msg->key_len)) {
+        answer_locally(req, PROTO_STATUS_INVALID, NULL);
+        return;
+    }
+    if (msg->opcode == PROTO_OP_NOOP) {
+        answer_locally(req, PROTO_STATUS_OK, NULL);
+        return;
+    }
+    if (msg->opcode == PROTO_OP_MGET || msg->opcode == PROTO_OP_MSET) {
+        handle_binary_multi(req, msg);
+        return;
+    }
+    forward_request(req, msg->key, msg->key_len, msg->opcode == PROTO_OP_GET,
+                    msg->opcode == PROTO_OP_SET || msg->opcode == PROTO_OP_DELETE, data, len);
+}
+
+// Parse every complete request in the input buffer, framed the same way as
+// the cache server: binary messages, '\n'-terminated text requests, or one
+// bare command per write until the client first sends a '\n'.
+// Returns -1 if the input is not a valid request stream.
+static int process_input(ClientConn *client, int drained) {
+    NetBuf *in = &client->in;
+
+    while (in->len > 0) {
+        char *start = NETBUF_PTR(in);
+
+        if (proto_is_binary(start, in->len)) {
+            ProtoMessage msg;
+            ssize_t size = proto_parse(start, in->len, &msg);
+            if (size < 0) return -1;
+            if (size == 0) break; // Partial message: wait for the rest
+            handle_binary_request(client, &msg, start, size);
+            netbuf_consume(in, size);
+            continue;
+        }
+
+        char *nl = memchr(start, '\n', in->len);
+        if (nl) {
+            *nl = '\0';
+            size_t consumed = nl - start + 1;
+            client->line_mode = 1;
+            handle_request(client, start, 1);
+            netbuf_consume(in, consumed);
+        } else if (drained && !client->line_mode) {
+            netbuf_append(in, "", 1); // NUL-terminate in place
+            handle_request(client, NETBUF_PTR(in), 0);
+            netbuf_consume(in, in->len);
+        } else {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Requests still waiting on a backend are orphaned and freed by the callback
+static void close_client(ClientConn *client) {
+    Worker *worker = client->worker;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+
+    LbRequest *req = client->head;
+    while (req) {
+        LbRequest *next = req->next;
+        if (req->done) {
+            free_request(req);
+        } else {
+            req->client = NULL;
+        }
+        req = next;
+    }
+    client->head = client->tail = NULL;
+
+    netbuf_free(&client->in);
+    netbuf_free(&client->out);
+    client->next = worker->closed;
+    worker->closed = client;
+}
+
+// Move finished replies, in request order, to the socket
+static void flush_client(ClientConn *client) {
+    while (client->head && client->head->done) {
+        LbRequest *req = client->head;
+        client->head = req->next;
+        if (!client->head) client->tail = NULL;
+        netbuf_append(&client->out, NETBUF_PTR(&req->reply), req->reply.len);
+        free_request(req);
+    }
+
+    if (netbuf_flush_fd(&client->out, client->fd) < 0 ||
+        (client->eof && !client->head && client->out.len == 0)) {
+        close_client(client);
+    }
+}
+
+static void flush_dirty_clients(Worker *worker) {
+    while (worker->dirty) {
+        ClientConn *client = worker->dirty;
+        worker->dirty = client->next_dirty;
+        client->dirty = 0;
+        if (client->fd >= 0) flush_client(client);
+    }
+}
+
+static void accept_clients(Worker *worker) {
+    while (1) {
+        int fd = accept(worker->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Failed to accept client connection");
+            }
+            return;
+        }
+
+        set_nonblocking(fd);
+        ClientConn *client = (ClientConn *)calloc(1, sizeof(ClientConn));
+        client->kind = EVENT_SOURCE_CLIENT;
+        client->fd = fd;
+        client->worker = worker;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = client;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close(fd);
+            free(client);
+        }
+    }
+}
+
+// Edge-triggered: drain the socket completely on every readiness event
+static void handle_client_event(ClientConn *client, uint32_t events) {
+    if (client->fd < 0) return; // Closed earlier in this batch of events
+
+    if (events & EPOLLERR) {
+        close_client(client);
+        return;
     }
 
-    close(client_socket);
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        while (!client->eof) {
+            ssize_t n = netbuf_read_fd(&client->in, client->fd, MAX_REQUEST_SIZE);
+            if (n < 0) {
+                if (errno != 0) {
+                    close_client(client);
+                    return;
+                }
+                client->eof = 1;
+            }
+
+            int full = client->in.len >= MAX_REQUEST_SIZE;
+            if (process_input(client, !full) < 0) {
+                fprintf(stderr, "Malformed binary request, closing connection\n");
+                close_client(client);
+                return;
+            }
+            if (!full) break;
+            if (client->in.len >= MAX_REQUEST_SIZE) {
+                fprintf(stderr, "Request too large, closing connection\n");
+                close_client(client);
+                return;
+            }
+        }
+    }
+
+    mark_dirty(client);
+}
+
+static int server_in_ring(const char *server_address) {
+    HashRing *ring = &atomic_load(&current_ring)->ring;
+    for (int i = 0; i < ring->node_count; i++) {
+        if (strcmp(ring->nodes[i].address, server_address) == 0) return 1;
+    }
+    return 0;
+}
+
+void *worker_thread(void *arg) {
+    Worker *worker = (Worker *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, WORKER_WAIT_MS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int *kind = (int *)events[i].data.ptr;
+            if (kind == NULL) {
+                accept_clients(worker);
+            } else if (*kind == EVENT_SOURCE_CLIENT) {
+                handle_client_event((ClientConn *)kind, events[i].events);
+            } else {
+                backend_handle_event(&worker->backends, (BackendConn *)kind, events[i].events);
+            }
+            flush_dirty_clients(worker);
+        }
+
+        unsigned long version = atomic_load(&current_ring)->version;
+        if (version != worker->seen_version) {
+            worker->seen_version = version;
+            backend_drop_unless(&worker->backends, server_in_ring);
+            flush_dirty_clients(worker);
+        }
+
+        // Quiescent point: no snapshot pointer survives past here
+        atomic_store(worker->quiescent, version);
+
+        // Nothing fetched in this batch refers to these any more
+        backend_collect(&worker->backends);
+        while (worker->closed) {
+            ClientConn *client = worker->closed;
+            worker->closed = client->next;
+            free(client);
+        }
+    }
     return NULL;
 }
 
@@ -166,10 +1430,35 @@ void *handle_server_announcement(void *arg) {
                                       (struct sockaddr *)&server_addr, &addr_len);
         if (bytes_received > 0) {
             buffer[bytes_received] = '\0';
+            int added = 0;
             pthread_mutex_lock(&lock);
-            add_node(&ring, buffer); // Add the server to the hash ring
+            ServerHealth *server = find_server(buffer);
+            if (!server && server_count == server_capacity) {
+                int capacity = server_capacity ? server_capacity * 2 : 8;
+                ServerHealth *grown = (ServerHealth *)realloc(servers, capacity * sizeof(ServerHealth));
+                if (grown) {
+                    servers = grown;
+                    server_capacity = capacity;
+                }
+            }
+            if (!server && server_count < server_capacity) {
+                server = &servers[server_count++];
+                memset(server, 0, sizeof(*server));
+                snprintf(server->address, sizeof(server->address), "%.255s", buffer);
+                server->state = SERVER_DOWN;
+                server->load = (ServerLoad *)calloc(1, sizeof(ServerLoad));
+                memcpy(server->load->address, server->address, sizeof(server->address));
+            }
+            // A (re)started server joins immediately
+            if (server && (server->state == SERVER_DOWN || server->state == SERVER_RECOVERING)) {
+                server->state = SERVER_UP;
+                server->streak = 0;
+                queue_ring_change(server->address, 1); // Add the server to the hash ring
+                added = 1;
+            }
             pthread_mutex_unlock(&lock);
-            printf("Server '%s' added to the ring\n", buffer);
+            apply_ring_changes();
+            if (added) printf("Server '%s' added to the ring\n", buffer);
         }
     }
 
@@ -177,7 +1466,119 @@ void *handle_server_announcement(void *arg) {
     return NULL;
 }
 
-int main() {
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t <threads>] [-n <vnodes>] [-H <hash>] [-P <placement>] [-c <factor>]\n"
+                    "          [-r <replicas>] [-R <replicas>] [-k <threshold>] [-v]\n",
+            prog);
+    fprintf(stderr, "  -t <threads>    Number of worker threads (default: one per CPU)\n");
+    fprintf(stderr, "  -n <vnodes>     Virtual nodes per server on the hash ring (default %d)\n",
+            DEFAULT_VNODES);
+    fprintf(stderr, "  -H <hash>       Ring hash: xxh64, md5 or fnv1a (default %s)\n",
+            DEFAULT_RING_HASH);
+    fprintf(stderr, "  -P <placement>  Placement: ring, maglev, jump or rendezvous (default %s);\n"
+                    "                  only ring hands cached keys over when servers join or leave\n",
+            DEFAULT_PLACEMENT);
+    fprintf(stderr, "  -c <factor>     Max in-flight requests per server relative to the average;\n"
+                    "                  reads over it go to the next server (e.g. 1.25; default 0: off)\n");
+    fprintf(stderr, "  -r <replicas>   Servers that reads of any key are spread over (default %d)\n",
+            DEFAULT_REPLICAS);
+    fprintf(stderr, "  -R <replicas>   Servers that reads of a hot key are spread over (default: same\n"
+                    "                  as -r; no more than -r turns hot-key detection off)\n");
+    fprintf(stderr, "  -k <threshold>  Reads of a key through one worker thread, roughly per %d of\n"
+                    "                  its requests, that make it hot (1-255, default %d)\n",
+            HOTKEYS_SKETCH_WIDTH * SKETCH_SAMPLE_FACTOR, HOTKEYS_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  -v              Log every forwarded request\n");
+}
+
+int main(int argc, char *argv[]) {
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int vnodes = DEFAULT_VNODES;
+    const RingHash *ring_hash = find_ring_hash(DEFAULT_RING_HASH);
+    const Placement *placement = find_placement(DEFAULT_PLACEMENT);
+    int hot_threshold = HOTKEYS_DEFAULT_THRESHOLD;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:H:P:c:r:R:k:v")) != -1) {
+        switch (opt) {
+        case 't':
+            thread_count = atoi(optarg);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            vnodes = atoi(optarg);
+            if (vnodes < 1) {
+                fprintf(stderr, "Invalid virtual node count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'H':
+            ring_hash = find_ring_hash(optarg);
+            if (!ring_hash) {
+                fprintf(stderr, "Unknown hash function: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            load_factor = atof(optarg);
+            if (load_factor != 0 && load_factor < 1) {
+                fprintf(stderr, "Invalid load factor: %s (must be 0 or at least 1)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+        case 'R': {
+            int copies = atoi(optarg);
+            if (copies < 1 || copies > MAX_CANDIDATES) {
+                fprintf(stderr, "Invalid replica count: %s (must be 1 to %d)\n", optarg, MAX_CANDIDATES);
+                return EXIT_FAILURE;
+            }
+            *(opt == 'r' ? &replicas : &hot_replicas) = copies;
+            break;
+        }
+        case 'k':
+            hot_threshold = atoi(optarg);
+            if (hot_threshold < 1 || hot_threshold > UINT8_MAX) {
+                fprintf(stderr, "Invalid hot-key threshold: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'P':
+            placement = find_placement(optarg);
+            if (!placement) {
+                fprintf(stderr, "Unknown placement strategy: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (hot_replicas == 0) hot_replicas = replicas;
+    if (hot_replicas > replicas) {
+        hot_keys = (HotKeys *)calloc(thread_count, sizeof(HotKeys));
+        for (int i = 0; i < thread_count; i++) {
+            if (!hot_keys || hotkeys_init(&hot_keys[i], HOTKEYS_DEFAULT_CAPACITY, hot_threshold, &hot_set) < 0) {
+                perror("Failed to allocate hot-key sketch");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    RingSnapshot *initial = (RingSnapshot *)calloc(1, sizeof(RingSnapshot));
+    init_ring(&initial->ring, vnodes, ring_hash, placement);
+    initial->version = 1;
+    ring_hash_name = ring_hash->name;
+    atomic_store(&current_ring, initial);
+    worker_count = thread_count;
+    worker_quiescent = (atomic_ulong *)calloc(thread_count, sizeof(atomic_ulong));
     pthread_mutex_init(&lock, NULL);
 
     // Create threads for server announcements and health checks
@@ -185,9 +1586,8 @@ int main() {
     pthread_create(&announce_thread, NULL, handle_server_announcement, NULL);
     pthread_create(&health_check_thread, NULL, health_check, NULL);
 
-    int lb_socket, client_socket;
-    struct sockaddr_in lb_addr, client_addr;
-    socklen_t addr_len = sizeof(client_addr);
+    int lb_socket;
+    struct sockaddr_in lb_addr;
 
     // Create socket for load balancer
     lb_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -196,6 +1596,9 @@ int main() {
         return EXIT_FAILURE;
     }
 
+    int reuse = 1;
+    setsockopt(lb_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     lb_addr.sin_family = AF_INET;
     lb_addr.sin_port = htons(LB_PORT);
     lb_addr.sin_addr.s_addr = INADDR_ANY;
@@ -205,25 +1608,44 @@ int main() {
         return EXIT_FAILURE;
     }
 
-    if (listen(lb_socket, 10) < 0) {
+    if (listen(lb_socket, SOMAXCONN) < 0) {
         perror("Failed to listen on load balancer socket");
         return EXIT_FAILURE;
     }
+    set_nonblocking(lb_socket);
 
-    printf("Load balancer is running on port %d...\n", LB_PORT);
+    printf("Load balancer is running on port %d with %d worker threads, %s placement, %s hash...\n",
+           LB_PORT, thread_count, placement->name, ring_hash->name);
 
-    while (1) {
-        client_socket = accept(lb_socket, (struct sockaddr *)&client_addr, &addr_len);
-        if (client_socket < 0) {
-            perror("Failed to accept client connection");
-            continue;
+    // Every worker watches the listening socket; EPOLLEXCLUSIVE wakes only
+    // one of them per incoming connection
+    pthread_t threads[thread_count];
+    Worker workers[thread_count];
+    memset(workers, 0, sizeof(workers));
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].listen_fd = lb_socket;
+        workers[i].epoll_fd = epoll_create1(0);
+        if (workers[i].epoll_fd < 0) {
+            perror("epoll_create1 failed");
+            return EXIT_FAILURE;
         }
+        workers[i].backends.epoll_fd = workers[i].epoll_fd;
+        workers[i].backends.on_reply = on_backend_reply;
+        workers[i].quiescent = &worker_quiescent[i];
+        workers[i].hot_keys = hot_keys ? &hot_keys[i] : NULL;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(workers[i].epoll_fd, EPOLL_CTL_ADD, lb_socket, &ev) < 0) {
+            perror("epoll_ctl failed");
+            return EXIT_FAILURE;
+        }
+        pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+    }
 
-        pthread_t thread;
-        int *client_socket_ptr = malloc(sizeof(int));
-        *client_socket_ptr = client_socket;
-        pthread_create(&thread, NULL, handle_client, client_socket_ptr);
-        pthread_detach(thread);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
     }
 
     close(lb_socket);
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include "clock.h"
+#include "conhash.h"
+#include "dbpool.h"
+#include "hash.h"
+#include "migrate.h"
+#include "proto.h"
+
+#define TOUCHED_INITIAL_BUCKETS 64
+#define FALLBACK_CONNS 4  // Connections to an old owner for fallback reads
+
+// Key hashes first..last, inclusive
+typedef struct HashRange {
+    uint64_t first;
+    uint64_t last;
+} HashRange;
+
+// Parsed "<ring hash> <first>-<last> ..." spec, ranges sorted
+typedef struct KeyRanges {
+    ring_hash_fn hash;
+    HashRange *ranges;
+    int count;
+} KeyRanges;
+
+// Keys written during imports
+typedef struct TouchedKey {
+    struct TouchedKey *next;
+    char key[];
+} TouchedKey;
+
+typedef struct KeySet {
+    TouchedKey **buckets;
+    size_t size;           // Power of two, 0 if unallocated
+    size_t count;
+} KeySet;
+
+// Keys being received from one server
+typedef struct Import {
+    char source[256];
+    KeyRanges ranges;
+    DbPool *pool;          // Connections to the source for fallback reads
+    uint64_t deadline;     // clock_now_ms() after which the import is dropped
+    int refs;              // Fallback reads using pool
+    int ended;             // Unlinked; freed once refs drops to 0
+    struct Import *next;
+} Import;
+
+// Keys being sent to one server
+typedef struct Migration {
+    char target[256];
+    KeyRanges ranges;
+    int keep;              // Copy: the items stay here too
+} Migration;
+
+// Items of one shard collected for a migration
+typedef struct Outgoing {
+    Migration *migration;
+    NetBuf *batches;       // Transfer bodies of about MIGRATION_BATCH_BYTES
+    int batch_count;
+    NetBuf keys;           // NUL-separated keys, removed once sent
+    size_t key_count;
+} Outgoing;
+
+static Cache *cache;
+static char self[256];
+static uint32_t fallback_ttl_ms;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Import *imports;    // Oldest first; guarded by lock
+static KeySet touched;     // Guarded by lock; emptied when the last import ends
+static atomic_int import_count; // Imports in progress; changed under lock, read without it
+
+static unsigned long long fallback_hits, fallback_misses, received, sent; // Guarded by lock
+
+static int compare_ranges(const void *a, const void *b) {
+    const HashRange *ra = (const HashRange *)a, *rb = (const HashRange *)b;
+    if (ra->first != rb->first) return ra->first < rb->first ? -1 : 1;
+    return 0;
+}
+
+static int parse_ranges(KeyRanges *set, const char *spec) {
+    char *copy = strdup(spec);
+    char *saveptr = NULL;
+    char *token = strtok_r(copy, " ", &saveptr);
+    const RingHash *hash = token ? find_ring_hash(token) : NULL;
+    int capacity = 16;
+
+    memset(set, 0, sizeof(*set));
+    if (!hash) {
+        free(copy);
+        return -1;
+    }
+    set->hash = hash->fn;
+    set->ranges = (HashRange *)malloc(capacity * sizeof(HashRange));
+    while ((token = strtok_r(NULL, " ", &saveptr)) != NULL) {
+        char *end;
+        HashRange range;
+        range.first = strtoull(token, &end, 16);
+        if (*end != '-') break;
+        range.last = strtoull(end + 1, &end, 16);
+        if (*end != '\0' || range.last < range.first) break;
+        if (set->count == capacity) {
+            capacity *= 2;
+            set->ranges = (HashRange *)realloc(set->ranges, capacity * sizeof(HashRange));
+        }
+        set->ranges[set->count++] = range;
+    }
+    free(copy);
+
+    if (token || set->count == 0) {
+        free(set->ranges);
+        set->ranges = NULL;
+        return -1;
+    }
+    qsort(set->ranges, set->count, sizeof(HashRange), compare_ranges);
+    return 0;
+}
+
+static int in_ranges(const KeyRanges *set, const char *key, size_t len) {
+    uint64_t h = set->hash(key, len);
+
+    // Last range starting at or before h
+    int lo = 0, hi = set->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (set->ranges[mid].first <= h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 && h <= set->ranges[lo - 1].last;
+}
+
+static size_t touched_index(const KeySet *set, const char *key) {
+    return hash_xxh64(key, strlen(key), 0) & (set->size - 1);
+}
+
+static int touched_contains(const KeySet *set, const char *key) {
+    if (set->size == 0) return 0;
+    for (TouchedKey *t = set->buckets[touched_index(set, key)]; t; t = t->next) {
+        if (strcmp(t->key, key) == 0) return 1;
+    }
+    return 0;
+}
+
+static void touched_add(KeySet *set, const char *key) {
+    if (touched_contains(set, key)) return;
+
+    if (set->count >= set->size) {
+        size_t size = set->size ? set->size * 2 : TOUCHED_INITIAL_BUCKETS;
+        TouchedKey **buckets = (TouchedKey **)calloc(size, sizeof(TouchedKey *));
+        if (!buckets) return;
+        KeySet grown = {buckets, size, set->count};
+        for (size_t i = 0; i < set->size; i++) {
+            TouchedKey *t = set->buckets[i];
+            while (t) {
+                TouchedKey *next = t->next;
+                size_t idx = touched_index(&grown, t->key);
+                t->next = buckets[idx];
+                buckets[idx] = t;
+                t = next;
+            }
+        }
+        free(set->buckets);
+        *set = grown;
+    }
+
+    size_t len = strlen(key);
+    TouchedKey *t = (TouchedKey *)malloc(sizeof(TouchedKey) + len + 1);
+    if (!t) return;
+    memcpy(t->key, key, len + 1);
+    size_t idx = touched_index(set, key);
+    t->next = set->buckets[idx];
+    set->buckets[idx] = t;
+    set->count++;
+}
+
+static void touched_clear(KeySet *set) {
+    for (size_t i = 0; i < set->size; i++) {
+        TouchedKey *t = set->buckets[i];
+        while (t) {
+            TouchedKey *next = t->next;
+            free(t);
+            t = next;
+        }
+    }
+    free(set->buckets);
+    memset(set, 0, sizeof(*set));
+}
+
+// Pool of connections to "ip:port", opened on first use
+static DbPool *connect_to(const char *address, int size) {
+    char host[64];
+    const char *colon = strrchr(address, ':');
+    if (!colon || colon - address >= (long)sizeof(host)) return NULL;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    return dbpool_create(host, atoi(colon + 1), size);
+}
+
+static void free_import(Import *import) {
+    dbpool_destroy(import->pool);
+    free(import->ranges.ranges);
+    free(import);
+}
+
+// Unlink an import; it is freed now or by the last fallback read using it.
+// Called with lock held.
+static void end_import(Import **link) {
+    Import *import = *link;
+    *link = import->next;
+    import->ended = 1;
+    if (atomic_fetch_sub(&import_count, 1) == 1) touched_clear(&touched);
+    if (import->refs == 0) free_import(import);
+}
+
+// Drop imports whose source never finished. Called with lock held.
+static void expire_imports(void) {
+    uint64_t now = clock_now_ms();
+    Import **link = &imports;
+    while (*link) {
+        if ((*link)->deadline <= now) {
+            fprintf(stderr, "Import from '%s' timed out\n", (*link)->source);
+            end_import(link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+}
+
+// Import covering a key, or NULL. Called with lock held.
+static Import *find_import(const char *key) {
+    expire_imports();
+    size_t len = strlen(key);
+    for (Import *import = imports; import; import = import->next) {
+        if (in_ranges(&import->ranges, key, len)) return import;
+    }
+    return NULL;
+}
+
+void migration_init(Cache *c, const char *self_address, uint32_t ttl_ms) {
+    cache = c;
+    snprintf(self, sizeof(self), "%s", self_address);
+    fallback_ttl_ms = ttl_ms;
+}
+
+int migration_import(const char *source, const char *spec) {
+    Import *import = (Import *)calloc(1, sizeof(Import));
+    if (parse_ranges(&import->ranges, spec) < 0 || !(import->pool = connect_to(source, FALLBACK_CONNS))) {
+        free(import->ranges.ranges);
+        free(import);
+        return -1;
+    }
+    snprintf(import->source, sizeof(import->source), "%s", source);
+    import->deadline = clock_now_ms() + MIGRATION_TIMEOUT_MS;
+
+    pthread_mutex_lock(&lock);
+    Import **link = &imports;
+    while (*link) link = &(*link)->next;
+    *link = import;
+    atomic_fetch_add(&import_count, 1);
+    pthread_mutex_unlock(&lock);
+    printf("Importing %d key ranges from '%s'\n", import->ranges.count, source);
+    return 0;
+}
+
+void migration_import_end(const char *source) {
+    pthread_mutex_lock(&lock);
+    for (Import **link = &imports; *link; link = &(*link)->next) {
+        if (strcmp((*link)->source, source) == 0) {
+            end_import(link);
+            printf("Import from '%s' finished\n", source);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void migration_touch(const char *key) {
+    if (atomic_load(&import_count) == 0) return;
+
+    pthread_mutex_lock(&lock);
+    if (find_import(key)) touched_add(&touched, key);
+    pthread_mutex_unlock(&lock);
+}
+
+int migration_fallback(const char *key, NetBuf *value) {
+    if (atomic_load(&import_count) == 0) return -1;
+
+    pthread_mutex_lock(&lock);
+    Import *import = touched_contains(&touched, key) ? NULL : find_import(key);
+    if (import) import->refs++;
+    pthread_mutex_unlock(&lock);
+    if (!import) return -1;
+
+    DbConn *conn = dbpool_acquire(import->pool);
+    int status = dbpool_request(import->pool, conn, PROTO_OP_PEEK, key, strlen(key), NULL, 0, value);
+    dbpool_release(import->pool, conn);
+
+    // The key may have been written while the old owner was asked
+    pthread_mutex_lock(&lock);
+    int found = status == PROTO_STATUS_OK && !touched_contains(&touched, key) &&
+                (value->len == 0 || !memchr(NETBUF_PTR(value), '\0', value->len));
+    if (found) {
+        cache_set(cache, key, NETBUF_PTR(value), fallback_ttl_ms);
+        fallback_hits++;
+    } else {
+        netbuf_consume(value, value->len);
+        fallback_misses++;
+    }
+    if (--import->refs == 0 && import->ended) free_import(import);
+    pthread_mutex_unlock(&lock);
+    return found ? 0 : -1;
+}
+
+long migration_receive(const char *body, size_t len) {
+    ProtoCursor cursor = {body, body + len};
+    NetBuf item = {0};
+    long stored = 0;
+    int rc;
+
+    const char *key, *ttl, *value;
+    size_t key_len, ttl_len, value_len;
+    while ((rc = proto_next_key(&cursor, &key, &key_len)) == 1) {
+        if (proto_next_value(&cursor, &ttl, &ttl_len) != 1 || !ttl || ttl_len != 4 ||
+            proto_next_value(&cursor, &value, &value_len) != 1 || !value ||
+            memchr(key, '\0', key_len) || memchr(value, '\0', value_len)) {
+            rc = -1;
+            break;
+        }
+        uint32_t ttl_ms;
+        memcpy(&ttl_ms, ttl, 4);
+        ttl_ms = ntohl(ttl_ms);
+
+        // Key and value NUL-terminated, one after the other
+        netbuf_consume(&item, item.len);
+        netbuf_append(&item, key, key_len);
+        netbuf_append(&item, "", 1);
+        netbuf_append(&item, value, value_len);
+        netbuf_append(&item, "", 1);
+        const char *k = NETBUF_PTR(&item);
+
+        pthread_mutex_lock(&lock);
+        if (!touched_contains(&touched, k) && cache_set(cache, k, k + key_len + 1, ttl_ms) == 0) {
+            stored++;
+            received++;
+        }
+        pthread_mutex_unlock(&lock);
+    }
+    netbuf_free(&item);
+    return rc < 0 ? -1 : stored;
+}
+
+static void collect_item(const CacheItem *item, uint32_t ttl_ms, void *arg) {
+    Outgoing *out = (Outgoing *)arg;
+    if (!in_ranges(&out->migration->ranges, ITEM_KEY(item), item->key_len)) return;
+
+    netbuf_append(&out->keys, ITEM_KEY(item), item->key_len + 1);
+    out->key_count++;
+    if (item->key_len + item->value_len + 16 > PROTO_MAX_BODY) return; // Cannot be sent: just dropped
+
+    NetBuf *batch = &out->batches[out->batch_count - 1];
+    if (batch->len > 0 && batch->len + item->key_len + item->value_len > MIGRATION_BATCH_BYTES) {
+        out->batches = (NetBuf *)realloc(out->batches, (out->batch_count + 1) * sizeof(NetBuf));
+        batch = &out->batches[out->batch_count++];
+        memset(batch, 0, sizeof(*batch));
+    }
+    uint32_t ttl = htonl(ttl_ms);
+    proto_put_key(batch, ITEM_KEY(item), item->key_len);
+    proto_put_value(batch, (const char *)&ttl, sizeof(ttl));
+    proto_put_value(batch, ITEM_VALUE(item), item->value_len);
+}
+
+// Send the items of one shard. Unless they are kept, they are only removed
+// here once the target has them all; on failure the shard keeps its copies.
+static int migrate_shard(Migration *migration, int index, DbPool *pool, DbConn *conn,
+                         unsigned long long *count) {
+    Outgoing out = {migration, (NetBuf *)calloc(1, sizeof(NetBuf)), 1, {0}, 0};
+    cache_foreach_shard(cache, index, collect_item, &out);
+
+    int failed = 0;
+    for (int i = 0; i < out.batch_count && !failed; i++) {
+        if (out.batches[i].len == 0) continue;
+        failed = dbpool_request(pool, conn, PROTO_OP_TRANSFER, "", 0, NETBUF_PTR(&out.batches[i]),
+                                out.batches[i].len, NULL) != PROTO_STATUS_OK;
+    }
+    if (!failed && !migration->keep) {
+        for (const char *key = NETBUF_PTR(&out.keys); key < NETBUF_PTR(&out.keys) + out.keys.len;
+             key += strlen(key) + 1) {
+            cache_delete(cache, key);
+        }
+    }
+    if (!failed) *count += out.key_count;
+
+    for (int i = 0; i < out.batch_count; i++) netbuf_free(&out.batches[i]);
+    free(out.batches);
+    netbuf_free(&out.keys);
+    return failed ? -1 : 0;
+}
+
+static void *migrate_thread(void *arg) {
+    Migration *migration = (Migration *)arg;
+    DbPool *pool = connect_to(migration->target, 1);
+    DbConn *conn = pool ? dbpool_acquire(pool) : NULL;
+    uint64_t start = clock_now_ms();
+    unsigned long long count = 0;
+    int failed = !pool;
+
+    for (int i = 0; i < cache->shard_count && !failed; i++) {
+        failed = migrate_shard(migration, i, pool, conn, &count) < 0;
+    }
+    // The target stops falling back to this server either way
+    if (conn) dbpool_request(pool, conn, PROTO_OP_IMPORT_END, self, strlen(self), NULL, 0, NULL);
+
+    if (failed) {
+        fprintf(stderr, "Migration to '%s' failed after %llu items\n", migration->target, count);
+    } else {
+        printf("%s %llu items to '%s' in %llu ms\n", migration->keep ? "Copied" : "Migrated", count,
+               migration->target, (unsigned long long)(clock_now_ms() - start));
+    }
+    pthread_mutex_lock(&lock);
+    sent += count;
+    pthread_mutex_unlock(&lock);
+
+    if (conn) dbpool_release(pool, conn);
+    if (pool) dbpool_destroy(pool);
+    free(migration->ranges.ranges);
+    free(migration);
+    return NULL;
+}
+
+int migration_start(const char *target, const char *spec, int keep) {
+    Migration *migration = (Migration *)calloc(1, sizeof(Migration));
+    if (parse_ranges(&migration->ranges, spec) < 0) {
+        free(migration);
+        return -1;
+    }
+    snprintf(migration->target, sizeof(migration->target), "%s", target);
+    migration->keep = keep;
+    int count = migration->ranges.count; // The thread frees migration when done
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, migrate_thread, migration) != 0) {
+        perror("Failed to start migration");
+        free(migration->ranges.ranges);
+        free(migration);
+        return -1;
+    }
+    pthread_detach(thread);
+    printf("%s %d key ranges to '%s'\n", keep ? "Copying" : "Migrating", count, target);
+    return 0;
+}
+
+void migration_stats(NetBuf *out) {
+    pthread_mutex_lock(&lock);
+    netbuf_printf(out, "Migration: imports %d, touched %zu, fallback hits %llu, fallback misses %llu, "
+                  "received %llu, sent %llu\n",
+                  atomic_load(&import_count), touched.count, fallback_hits, fallback_misses, received, sent);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,89 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cache.h"
+#include "netbuf.h"
+
+// Key migration between cache servers. When the ring changes, the load
+// balancer tells each new owner which key hash ranges it takes over and
+// from which server (import), publishes the new ring, then tells each old
+// owner to hand those keys over (migrate). The old owner streams its items
+// in the ranges to the new owner with their remaining TTL, drops its own
+// copies and ends the import. Until then the new owner looks up misses in
+// the ranges in the old owner's cache before going to db_server, so keys
+// that move do not all miss at once. A new replica of keys that stay on
+// the old server is filled the same way, except that the old server keeps
+// its copies (replicate).
+//
+// Writes win over migrated copies: a key set or deleted on the new owner
+// during an import is neither overwritten by a transferred item nor read
+// back from the old owner.
+//
+// PROTO_OP_TRANSFER body, for each item: proto_put_key(key), then
+// proto_put_value() of the remaining TTL in milliseconds (4 bytes, network
+// order, 0 for no expiry), then proto_put_value(value).
+
+#define MIGRATION_TIMEOUT_MS 60000      // An import not ended by then is dropped
+#define MIGRATION_BATCH_BYTES (256 * 1024) // Transfer body size the sender aims for
+
+/**
+ * Set up migration for this server.
+ * @param cache The server's cache.
+ * @param self_address This server's address, as announced to the load balancer.
+ * @param ttl_ms TTL of values read from an old owner's cache.
+ */
+void migration_init(Cache *cache, const char *self_address, uint32_t ttl_ms);
+
+/**
+ * Start importing keys from a server. Until migration_import_end() or
+ * MIGRATION_TIMEOUT_MS, misses in the ranges fall back to its cache.
+ * @param spec "<ring hash> <first>-<last> ..." with hex key hashes.
+ * @return 0 on success, -1 if spec is invalid.
+ */
+int migration_import(const char *source, const char *spec);
+
+/**
+ * End the oldest import from a server: it has sent everything.
+ */
+void migration_import_end(const char *source);
+
+/**
+ * Send the items in the given ranges to a server, from a background
+ * thread. Unless keep is set, each shard's items are removed here once
+ * they have been sent; the import on the target is ended when all shards
+ * are done.
+ * @param spec As for migration_import().
+ * @param keep Keep the items here: the target becomes another replica.
+ * @return 0 if the migration started, -1 if spec is invalid.
+ */
+int migration_start(const char *target, const char *spec, int keep);
+
+/**
+ * Store the items of a PROTO_OP_TRANSFER body.
+ * @return Number of items stored, or -1 if the body is malformed.
+ */
+long migration_receive(const char *body, size_t len);
+
+/**
+ * Record a write to a key. Call before changing the cache, so a copy
+ * being imported cannot replace the newer value afterwards.
+ */
+void migration_touch(const char *key);
+
+/**
+ * Look a missed key up in the cache of the server it is being imported
+ * from, and cache the value here if found.
+ * @param value Receives the value (NUL-terminated).
+ * @return 0 if found, -1 if the key is not being imported or the old
+ *         owner does not have it.
+ */
+int migration_fallback(const char *key, NetBuf *value);
+
+/**
+ * Append counters to a stats report.
+ */
+void migration_stats(NetBuf *out);
+
+#endif // MIGRATE_H
@@ -1,62 +1,240 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "cache.h"
+#include "hash.h"
 #include "mockdb.h"
 
-// Create a mock database and populate it with dummy data
+#define DB_INITIAL_SIZE 1024
+#define DB_REHASH_STEP_BUCKETS 4    // Buckets migrated per operation while resizing
+#define DB_REHASH_MAX_EMPTY_VISITS 10
+
+static int table_init(DbTable *table, size_t size) {
+    table->buckets = (DbEntry **)calloc(size, sizeof(DbEntry *));
+    if (!table->buckets) return -1;
+    table->size = size;
+    table->used = 0;
+    return 0;
+}
+
+static void free_entry(DbEntry *entry) {
+    free(entry->value);
+    free(entry);
+}
+
+static int is_resizing(MockDB *db) {
+    return db->rehash_idx != -1;
+}
+
+// Migrate up to n buckets from ht[0] to ht[1]
+static void rehash_step(MockDB *db, int n) {
+    int empty_visits = n * DB_REHASH_MAX_EMPTY_VISITS;
+    DbTable *from = &db->ht[0];
+    DbTable *to = &db->ht[1];
+
+    while (n-- && from->used != 0) {
+        while (from->buckets[db->rehash_idx] == NULL) {
+            db->rehash_idx++;
+            if (--empty_visits == 0) return;
+        }
+
+        DbEntry *entry = from->buckets[db->rehash_idx];
+        while (entry) {
+            DbEntry *next = entry->next;
+            size_t idx = entry->hash & (to->size - 1);
+            entry->next = to->buckets[idx];
+            to->buckets[idx] = entry;
+            from->used--;
+            to->used++;
+            entry = next;
+        }
+        from->buckets[db->rehash_idx] = NULL;
+        db->rehash_idx++;
+    }
+
+    // Resize finished: ht[1] becomes the main table
+    if (from->used == 0) {
+        free(from->buckets);
+        *from = *to;
+        memset(to, 0, sizeof(*to));
+        db->rehash_idx = -1;
+    }
+}
+
+// Link pointing at the entry for key, or at the NULL ending its chain.
+// table receives the table holding the link.
+static DbEntry **lookup(MockDB *db, const char *key, uint64_t h, DbTable **table) {
+    DbEntry **link = NULL;
+    for (int t = 0; t <= 1; t++) {
+        *table = &db->ht[t];
+        if ((*table)->size == 0) break;
+        link = &(*table)->buckets[h & ((*table)->size - 1)];
+        while (*link) {
+            if ((*link)->hash == h && strcmp((*link)->key, key) == 0) return link;
+            link = &(*link)->next;
+        }
+        if (!is_resizing(db)) break;
+    }
+    return link;
+}
+
+static DbEntry **find_link(MockDB *db, const char *key, uint64_t h, DbTable **table) {
+    if (is_resizing(db)) rehash_step(db, DB_REHASH_STEP_BUCKETS);
+    return lookup(db, key, h, table);
+}
+
+static int in_base(MockDB *db, const char *key, uint64_t h) {
+    return db->base && snapshot_get(db->base, key, h) != NULL;
+}
+
+static void insert_entry(MockDB *db, DbEntry *entry) {
+    // Start growing once the load factor reaches 1 (keep chaining on OOM)
+    if (!is_resizing(db) && db->ht[0].used >= db->ht[0].size &&
+        table_init(&db->ht[1], db->ht[0].size * 2) == 0) {
+        db->rehash_idx = 0;
+    }
+
+    // New entries go straight into the new table while resizing
+    DbTable *table = is_resizing(db) ? &db->ht[1] : &db->ht[0];
+    size_t idx = entry->hash & (table->size - 1);
+    entry->next = table->buckets[idx];
+    table->buckets[idx] = entry;
+    table->used++;
+}
+
+static DbEntry *new_entry(const char *key, uint64_t h, char *value) {
+    size_t key_len = strlen(key);
+    DbEntry *entry = (DbEntry *)malloc(sizeof(DbEntry) + key_len + 1);
+    if (!entry) return NULL;
+    entry->hash = h;
+    entry->value = value;
+    memcpy(entry->key, key, key_len + 1);
+    return entry;
+}
+
 MockDB *create_mockdb() {
-    MockDB *db = (MockDB *)malloc(sizeof(MockDB));
-    db->count = 0;
+    MockDB *db = (MockDB *)calloc(1, sizeof(MockDB));
+    if (!db) return NULL;
+    if (table_init(&db->ht[0], DB_INITIAL_SIZE) < 0) {
+        free(db);
+        return NULL;
+    }
+    db->rehash_idx = -1;
 
     // Add some dummy data
+    char key[16], value[16];
     for (int i = 0; i < 10; i++) {
-        snprintf(db->keys[i], MAX_KEY_LENGTH, "key%d", i);
-        snprintf(db->values[i], MAX_VALUE_LENGTH, "value%d", i);
-        db->count++;
+        snprintf(key, sizeof(key), "key%d", i);
+        snprintf(value, sizeof(value), "value%d", i);
+        db_set(db, key, value);
     }
     return db;
 }
 
-// Set a key-value pair in the mock database
 void db_set(MockDB *db, const char *key, const char *value) {
-    for (int i = 0; i < db->count; i++) {
-        if (strcmp(db->keys[i], key) == 0) {
-            strncpy(db->values[i], value, MAX_VALUE_LENGTH);
-            return;
-        }
+    uint64_t h = hash_xxh64(key, strlen(key), 0);
+    DbTable *table;
+    DbEntry **link = find_link(db, key, h, &table);
+    char *copy = strdup(value);
+    if (!copy) return;
+
+    if (*link) {
+        if (!(*link)->value) db->count++; // Deleted snapshot key comes back
+        free((*link)->value);
+        (*link)->value = copy;
+        return;
+    }
+
+    DbEntry *entry = new_entry(key, h, copy);
+    if (!entry) {
+        free(copy);
+        return;
     }
-    strncpy(db->keys[db->count], key, MAX_KEY_LENGTH);
-    strncpy(db->values[db->count], value, MAX_VALUE_LENGTH);
-    db->count++;
+    if (!in_base(db, key, h)) db->count++;
+    insert_entry(db, entry);
 }
 
-// Get a value from the mock database
 char *db_get(MockDB *db, const char *key) {
-    for (int i = 0; i < db->count; i++) {
-        if (strcmp(db->keys[i], key) == 0) {
-            return db->values[i];
+    uint64_t h = hash_xxh64(key, strlen(key), 0);
+    DbTable *table;
+    DbEntry **link = find_link(db, key, h, &table);
+    if (*link) return (*link)->value;
+    return db->base ? (char *)snapshot_get(db->base, key, h) : NULL;
+}
+
+void db_delete(MockDB *db, const char *key) {
+    uint64_t h = hash_xxh64(key, strlen(key), 0);
+    DbTable *table;
+    DbEntry **link = find_link(db, key, h, &table);
+    DbEntry *entry = *link;
+
+    if (!in_base(db, key, h)) {
+        if (!entry) return;
+        *link = entry->next;
+        table->used--;
+        db->count--;
+        free_entry(entry);
+        return;
+    }
+
+    // The snapshot still has the key: shadow it with a deleted entry
+    if (entry) {
+        if (!entry->value) return;
+        free(entry->value);
+        entry->value = NULL;
+    } else {
+        entry = new_entry(key, h, NULL);
+        if (!entry) return;
+        insert_entry(db, entry);
+    }
+    db->count--;
+}
+
+static void clear_tables(MockDB *db) {
+    for (int t = 0; t <= 1; t++) {
+        DbTable *table = &db->ht[t];
+        for (size_t i = 0; i < table->size; i++) {
+            DbEntry *entry = table->buckets[i];
+            while (entry) {
+                DbEntry *next = entry->next;
+                free_entry(entry);
+                entry = next;
+            }
         }
+        free(table->buckets);
+        memset(table, 0, sizeof(*table));
     }
-    return NULL; // Not found
+    db->rehash_idx = -1;
 }
 
-// Delete a key from the mock database
-void db_delete(MockDB *db, const char *key) {
-    for (int i = 0; i < db->count; i++) {
-        if (strcmp(db->keys[i], key) == 0) {
-            // Shift remaining entries left
-            for (int j = i; j < db->count - 1; j++) {
-                strncpy(db->keys[j], db->keys[j + 1], MAX_KEY_LENGTH);
-                strncpy(db->values[j], db->values[j + 1], MAX_VALUE_LENGTH);
+void db_load_snapshot(MockDB *db, const Snapshot *snap) {
+    clear_tables(db);
+    table_init(&db->ht[0], DB_INITIAL_SIZE);
+    db->base = snap;
+    db->count = snap->header->count;
+}
+
+void db_foreach(MockDB *db, db_visit_fn fn, void *arg) {
+    for (int t = 0; t <= 1; t++) {
+        DbTable *table = &db->ht[t];
+        for (size_t i = 0; i < table->size; i++) {
+            for (DbEntry *entry = table->buckets[i]; entry; entry = entry->next) {
+                if (entry->value) fn(entry->key, entry->value, entry->hash, arg);
             }
-            db->count--;
-            return;
         }
     }
+    if (!db->base) return;
+
+    // Snapshot keys, unless the table has a newer version or deleted them
+    for (uint64_t slot = 0; slot < db->base->header->slot_count; slot++) {
+        const SnapshotRecord *record = snapshot_record(db->base, slot);
+        if (!record) continue;
+        DbTable *table;
+        if (*lookup(db, record->data, record->hash, &table)) continue;
+        fn(record->data, record->data + record->key_len + 1, record->hash, arg);
+    }
 }
 
-// Free mock database memory
 void free_mockdb(MockDB *db) {
+    clear_tables(db);
     free(db);
 }
@@ -1,16 +1,79 @@
 #ifndef MOCKDB_H
 #define MOCKDB_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "snapshot.h"
+
+// One stored key-value pair. The key is stored inline; the value is a
+// separate allocation so it can be replaced without moving the entry.
+typedef struct DbEntry {
+    struct DbEntry *next;  // Next entry in the same bucket
+    uint64_t hash;         // Cached hash of the key
+    char *value;           // NUL-terminated value; NULL if deleted from the snapshot
+    char key[];            // NUL-terminated key
+} DbEntry;
+
+// Chained hash table (power-of-two sized)
+typedef struct DbTable {
+    DbEntry **buckets;
+    size_t size;           // Number of buckets (0 if unallocated)
+    size_t used;           // Number of entries stored in this table
+} DbTable;
+
+// In-memory key-value store. The table doubles once the load factor
+// reaches 1; entries move to the new table a few buckets per operation,
+// so growing never stalls a request. The store may sit on top of a mapped
+// snapshot: the table then only holds what changed since, with deleted
+// snapshot keys kept as entries without a value.
 typedef struct MockDB {
-    char keys[100][150];
-    char values[100][150];
-    int count;
+    DbTable ht[2];         // ht[1] is only used while resizing
+    long rehash_idx;       // Next ht[0] bucket to migrate, -1 if not resizing
+    size_t count;          // Number of live keys, including the snapshot's
+    const Snapshot *base;  // Snapshot underneath the table, or NULL
 } MockDB;
 
+typedef void (*db_visit_fn)(const char *key, const char *value, uint64_t hash, void *arg);
+
+/**
+ * Create a database holding a few dummy entries (key0..key9).
+ * @return Pointer to the database, or NULL if memory could not be allocated.
+ */
 MockDB *create_mockdb();
+
+/**
+ * Insert or replace a key. Keys and values may be of any length.
+ */
 void db_set(MockDB *db, const char *key, const char *value);
+
+/**
+ * Look up a key.
+ * @return The stored value, valid until the key is next modified, or NULL
+ *         if the key does not exist.
+ */
 char *db_get(MockDB *db, const char *key);
+
+/**
+ * Delete a key if it exists.
+ */
 void db_delete(MockDB *db, const char *key);
+
+/**
+ * Replace the contents of the database with a mapped snapshot. Its records
+ * are read in place; the snapshot must stay mapped while the database is
+ * in use.
+ */
+void db_load_snapshot(MockDB *db, const Snapshot *snap);
+
+/**
+ * Call fn for every live key. The database must not be modified meanwhile.
+ * @param fn Receives each key, its value and the XXH64 of the key.
+ */
+void db_foreach(MockDB *db, db_visit_fn fn, void *arg);
+
+/**
+ * Free the database and everything stored in it (but not its snapshot).
+ */
 void free_mockdb(MockDB *db);
 
 #endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "netbuf.h"
+
+#define NETBUF_MIN_CAP 1024
+#define NETBUF_READ_CHUNK 4096
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Make room for extra bytes after the unread data
+static int netbuf_reserve(NetBuf *buf, size_t extra) {
+    if (buf->start + buf->len + extra <= buf->cap) return 0;
+
+    // Slide unread data to the front before growing
+    if (buf->start > 0) {
+        memmove(buf->data, buf->data + buf->start, buf->len);
+        buf->start = 0;
+        if (buf->len + extra <= buf->cap) return 0;
+    }
+
+    size_t cap = buf->cap ? buf->cap : NETBUF_MIN_CAP;
+    while (cap < buf->len + extra) cap *= 2;
+
+    char *data = (char *)realloc(buf->data, cap);
+    if (!data) return -1;
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+int netbuf_append(NetBuf *buf, const void *data, size_t len) {
+    if (netbuf_reserve(buf, len) < 0) return -1;
+    memcpy(buf->data + buf->start + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+int netbuf_printf(NetBuf *buf, const char *fmt, ...) {
+    va_list ap;
+    char small[256];
+
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if ((size_t)n < sizeof(small)) return netbuf_append(buf, small, n);
+
+    if (netbuf_reserve(buf, n + 1) < 0) return -1;
+    va_start(ap, fmt);
+    vsnprintf(buf->data + buf->start + buf->len, n + 1, fmt, ap);
+    va_end(ap);
+    buf->len += n;
+    return 0;
+}
+
+void netbuf_consume(NetBuf *buf, size_t len) {
+    if (len >= buf->len) {
+        buf->start = 0;
+        buf->len = 0;
+    } else {
+        buf->start += len;
+        buf->len -= len;
+    }
+}
+
+ssize_t netbuf_read_fd(NetBuf *buf, int fd, size_t max_len) {
+    ssize_t total = 0;
+
+    while (buf->len < max_len) {
+        if (netbuf_reserve(buf, NETBUF_READ_CHUNK) < 0) return -1;
+
+        size_t room = buf->cap - buf->start - buf->len;
+        ssize_t n = recv(fd, buf->data + buf->start + buf->len, room, 0);
+        if (n > 0) {
+            buf->len += n;
+            total += n;
+        } else if (n == 0) {
+            errno = 0;
+            return -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return total;
+}
+
+int netbuf_flush_fd(NetBuf *buf, int fd) {
+    while (buf->len > 0) {
+        ssize_t n = send(fd, NETBUF_PTR(buf), buf->len, MSG_NOSIGNAL);
+        if (n > 0) {
+            netbuf_consume(buf, n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void netbuf_free(NetBuf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->start = buf->len = buf->cap = 0;
+}
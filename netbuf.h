@@ -0,0 +1,60 @@
+#ifndef NETBUF_H
+#define NETBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Growable byte buffer for non-blocking socket I/O. Unread data lives in
+// data[start, start + len); consumed bytes are reclaimed lazily.
+typedef struct NetBuf {
+    char *data;    // Backing storage
+    size_t start;  // Offset of the first unread byte
+    size_t len;    // Number of unread bytes
+    size_t cap;    // Allocated size of data
+} NetBuf;
+
+#define NETBUF_PTR(buf) ((buf)->data + (buf)->start)
+
+/**
+ * Put a file descriptor into non-blocking mode.
+ * @return 0 on success, -1 on error.
+ */
+int set_nonblocking(int fd);
+
+/**
+ * Append bytes to the end of the buffer.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int netbuf_append(NetBuf *buf, const void *data, size_t len);
+
+/**
+ * Append a formatted string to the end of the buffer.
+ * @return 0 on success, -1 on error.
+ */
+int netbuf_printf(NetBuf *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Drop len bytes from the front of the buffer.
+ */
+void netbuf_consume(NetBuf *buf, size_t len);
+
+/**
+ * Read from a non-blocking socket until it would block or max_len unread
+ * bytes are buffered.
+ * @return Bytes read (possibly 0 if nothing was available), or -1 on error
+ *         or end of stream with errno set to 0 for end of stream.
+ */
+ssize_t netbuf_read_fd(NetBuf *buf, int fd, size_t max_len);
+
+/**
+ * Write buffered data to a non-blocking socket until it would block.
+ * @return 0 if everything was written or the socket would block, -1 on error.
+ */
+int netbuf_flush_fd(NetBuf *buf, int fd);
+
+/**
+ * Release the buffer's storage.
+ */
+void netbuf_free(NetBuf *buf);
+
+#endif // NETBUF_H
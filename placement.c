@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "conhash.h"
+
+// Placement strategies besides the ring (conhash.c). All of them work on
+// HashRing.nodes, whose order may change when a node is removed: the
+// last node then takes the removed node's index.
+
+#define MAGLEV_TABLE_SIZE 65537 // Prime, much larger than the number of servers
+
+// SplitMix64 finalizer: scrambles a 64-bit value
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int contains(const int *list, int count, int value) {
+    for (int i = 0; i < count; i++) {
+        if (list[i] == value) return 1;
+    }
+    return 0;
+}
+
+// Maglev: every server walks its own permutation of the table slots and
+// the servers take turns claiming the next free slot in theirs, so each
+// server ends up owning an almost equal share of the table.
+static int maglev_build(HashRing *ring) {
+    int size = MAGLEV_TABLE_SIZE;
+    int n = ring->node_count;
+    if (!ring->table) {
+        ring->table = (int *)malloc(size * sizeof(int));
+        if (!ring->table) return -1;
+        ring->table_size = size;
+    }
+    for (int i = 0; i < size; i++) ring->table[i] = -1;
+    if (n == 0) return 0;
+
+    uint64_t *offset = (uint64_t *)malloc(n * sizeof(uint64_t));
+    uint64_t *skip = (uint64_t *)malloc(n * sizeof(uint64_t));
+    uint64_t *next = (uint64_t *)calloc(n, sizeof(uint64_t));
+    if (!offset || !skip || !next) {
+        free(offset);
+        free(skip);
+        free(next);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        offset[i] = ring->nodes[i].seed % size;
+        skip[i] = mix64(ring->nodes[i].seed) % (size - 1) + 1;
+    }
+
+    int filled = 0;
+    while (filled < size) {
+        for (int i = 0; i < n && filled < size; i++) {
+            uint64_t slot = (offset[i] + next[i] * skip[i]) % size;
+            while (ring->table[slot] >= 0) {
+                next[i]++;
+                slot = (offset[i] + next[i] * skip[i]) % size;
+            }
+            ring->table[slot] = i;
+            next[i]++;
+            filled++;
+        }
+    }
+
+    free(offset);
+    free(skip);
+    free(next);
+    return 0;
+}
+
+static int maglev_node_added(HashRing *ring, int index) {
+    return maglev_build(ring);
+}
+
+static void maglev_node_removed(HashRing *ring, int index, int moved_from) {
+    if (maglev_build(ring) < 0) perror("Failed to rebuild Maglev table");
+}
+
+// Maglev: the key's table slot, then the owners of the following slots
+static int maglev_candidates(const HashRing *ring, uint64_t key_hash, int *out, int max) {
+    if (!ring->table) return 0;
+    int count = 0;
+    uint64_t slot = key_hash % ring->table_size;
+    for (int step = 0; step < ring->table_size && count < max && count < ring->node_count; step++) {
+        int node = ring->table[(slot + step) % ring->table_size];
+        if (!contains(out, count, node)) out[count++] = node;
+    }
+    return count;
+}
+
+const Placement maglev_placement = {
+    "maglev", maglev_node_added, maglev_node_removed, maglev_candidates,
+};
+
+// Jump consistent hash (Lamping and Veach): no lookup structure at all.
+// Keys only move to a newly appended bucket, so removing any node but the
+// last also remaps the keys of the node moved into its slot.
+static int jump_bucket(uint64_t key, int buckets) {
+    int64_t b = -1, j = 0;
+    while (j < buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (int)b;
+}
+
+// Jump: the key's bucket, then the following buckets
+static int jump_candidates(const HashRing *ring, uint64_t key_hash, int *out, int max) {
+    int n = ring->node_count;
+    int first = jump_bucket(key_hash, n);
+    int count = 0;
+    for (int i = 0; i < n && count < max; i++) {
+        out[count++] = (first + i) % n;
+    }
+    return count;
+}
+
+const Placement jump_placement = {
+    "jump", NULL, NULL, jump_candidates,
+};
+
+// Rendezvous (highest random weight): every server scores the key and the
+// highest score wins. O(servers) per lookup, but only the keys of a
+// changed server ever move.
+static int rendezvous_candidates(const HashRing *ring, uint64_t key_hash, int *out, int max) {
+    int count = 0;
+    while (count < max && count < ring->node_count) {
+        int best = -1;
+        uint64_t best_score = 0;
+        for (int i = 0; i < ring->node_count; i++) {
+            uint64_t score = mix64(key_hash ^ ring->nodes[i].seed);
+            if ((best < 0 || score > best_score) && !contains(out, count, i)) {
+                best = i;
+                best_score = score;
+            }
+        }
+        out[count++] = best;
+    }
+    return count;
+}
+
+const Placement rendezvous_placement = {
+    "rendezvous", NULL, NULL, rendezvous_candidates,
+};
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "conhash.h"
+
+// Placement simulation: for every strategy and cluster size, reports
+// lookup cost, load imbalance, and the fraction of keys remapped when one
+// server joins or leaves (against the ideal 1/(n+1) and 1/n).
+
+#define DEFAULT_KEYS 200000
+#define DEFAULT_SIZES "3,5,10,50"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void server_address(char *buf, size_t len, int i) {
+    snprintf(buf, len, "10.0.%d.%d:8080", i / 256, i % 256);
+}
+
+static void build(HashRing *ring, const Placement *placement, const RingHash *hash, int vnodes, int n) {
+    char address[64];
+    init_ring(ring, vnodes, hash, placement);
+    for (int i = 0; i < n; i++) {
+        server_address(address, sizeof(address), i);
+        add_node(ring, address);
+    }
+}
+
+// Fraction of keys whose server differs from owners[]
+static double remapped(HashRing *ring, char **keys, int key_count, const char **owners) {
+    long moved = 0;
+    for (int i = 0; i < key_count; i++) {
+        if (strcmp(get_node(ring, keys[i]), owners[i]) != 0) moved++;
+    }
+    return (double)moved / key_count;
+}
+
+static void run(const Placement *placement, const RingHash *hash, int vnodes, int n,
+                char **keys, int key_count) {
+    HashRing ring;
+    build(&ring, placement, hash, vnodes, n);
+
+    // Lookup cost, including hashing the key
+    int *owner = (int *)malloc(key_count * sizeof(int));
+    double start = now_seconds();
+    for (int i = 0; i < key_count; i++) {
+        get_candidates(&ring, keys[i], strlen(keys[i]), &owner[i], 1);
+    }
+    double ns = (now_seconds() - start) * 1e9 / key_count;
+
+    // Load imbalance: busiest server over the mean
+    long *counts = (long *)calloc(n, sizeof(long));
+    for (int i = 0; i < key_count; i++) {
+        counts[owner[i]]++;
+    }
+    long max = 0;
+    for (int i = 0; i < n; i++) {
+        if (counts[i] > max) max = counts[i];
+    }
+    double imbalance = max / ((double)key_count / n);
+
+    // Node indices change with membership: remember owners by address
+    char (*names)[256] = malloc(n * sizeof(*names));
+    for (int i = 0; i < n; i++) memcpy(names[i], ring.nodes[i].address, sizeof(names[i]));
+    const char **owners = (const char **)malloc(key_count * sizeof(char *));
+    for (int i = 0; i < key_count; i++) {
+        owners[i] = names[owner[i]];
+    }
+
+    char address[64];
+    server_address(address, sizeof(address), n);
+    add_node(&ring, address);
+    double added = remapped(&ring, keys, key_count, owners);
+    free_ring(&ring);
+
+    // Remove a server from the middle rather than the newest one
+    build(&ring, placement, hash, vnodes, n);
+    double removed = 0;
+    if (n > 1) {
+        server_address(address, sizeof(address), n / 2);
+        remove_node(&ring, address);
+        removed = remapped(&ring, keys, key_count, owners);
+    }
+    free_ring(&ring);
+
+    printf("%-11s %7d %8.1f %9.3f %9.2f%% (%5.2f%%) %9.2f%% (%5.2f%%)\n",
+           placement->name, n, ns, imbalance, 100 * added, 100.0 / (n + 1),
+           100 * removed, n > 1 ? 100.0 / n : 0.0);
+
+    free(owner);
+    free(owners);
+    free(counts);
+    free(names);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n <sizes>] [-k <keys>] [-v <vnodes>] [-H <hash>]\n", prog);
+    fprintf(stderr, "  -n <sizes>   Comma-separated server counts (default %s)\n", DEFAULT_SIZES);
+    fprintf(stderr, "  -k <keys>    Number of keys (default %d)\n", DEFAULT_KEYS);
+    fprintf(stderr, "  -v <vnodes>  Virtual nodes per server for the ring (default %d)\n", DEFAULT_VNODES);
+    fprintf(stderr, "  -H <hash>    Hash: xxh64, md5 or fnv1a (default %s)\n", DEFAULT_RING_HASH);
+}
+
+int main(int argc, char *argv[]) {
+    char sizes[256];
+    snprintf(sizes, sizeof(sizes), "%s", DEFAULT_SIZES);
+    int key_count = DEFAULT_KEYS;
+    int vnodes = DEFAULT_VNODES;
+    const RingHash *hash = find_ring_hash(DEFAULT_RING_HASH);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:k:v:H:")) != -1) {
+        switch (opt) {
+        case 'n': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+        case 'k': key_count = atoi(optarg); break;
+        case 'v': vnodes = atoi(optarg); break;
+        case 'H':
+            hash = find_ring_hash(optarg);
+            if (!hash) {
+                fprintf(stderr, "Unknown hash function: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (key_count < 1 || vnodes < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char **keys = (char **)malloc(key_count * sizeof(char *));
+    for (int i = 0; i < key_count; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "user:%d", i);
+        keys[i] = strdup(key);
+    }
+
+    printf("%-11s %7s %8s %9s %19s %19s\n", "placement", "servers", "ns/op", "max/mean",
+           "moved on add", "moved on remove");
+
+    char *saveptr = NULL;
+    for (char *size = strtok_r(sizes, ",", &saveptr); size; size = strtok_r(NULL, ",", &saveptr)) {
+        int n = atoi(size);
+        if (n < 1) continue;
+        for (int i = 0; placements[i]; i++) {
+            run(placements[i], hash, vnodes, n, keys, key_count);
+        }
+    }
+
+    for (int i = 0; i < key_count; i++) free(keys[i]);
+    free(keys);
+    return 0;
+}
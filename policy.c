@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+// Eviction policies (cache.c keeps the index and the memory accounting).
+// Items live in the shard's ItemLists; a policy decides which lists it
+// uses and how items move between them.
+
+#define EVICT_SEARCH_DEPTH 50      // Items inspected for a victim of the wanted slab class
+#define SLRU_PROTECTED_PERCENT 80  // Share of the (main) space the protected segment may fill
+#define TINYLFU_WINDOW_PERCENT 1   // Share of the shard for the admission window
+#define TINYLFU_ITEM_ESTIMATE 128  // Bytes per item assumed when sizing the sketch
+
+// List indices. LRU and CLOCK only use LIST_PROBATION.
+enum { LIST_PROBATION = 0, LIST_PROTECTED = 1, LIST_WINDOW = 2 };
+
+static size_t footprint(CacheShard *shard, CacheItem *item) {
+    return shard->slabs->classes[slab_class_of(item)].chunk_size;
+}
+
+static void list_push(CacheShard *shard, int index, CacheItem *item) {
+    ItemList *list = &shard->lists[index];
+    item->list = index;
+    item->prev = NULL;
+    item->next = list->head;
+    if (list->head) list->head->prev = item;
+    list->head = item;
+    if (!list->tail) list->tail = item;
+    list->bytes += footprint(shard, item);
+}
+
+static void list_unlink(CacheShard *shard, CacheItem *item) {
+    ItemList *list = &shard->lists[item->list];
+    if (item->prev) {
+        item->prev->next = item->next;
+    } else {
+        list->head = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    } else {
+        list->tail = item->prev;
+    }
+    list->bytes -= footprint(shard, item);
+}
+
+// Move an item to the head of a list (possibly the one it is in)
+static void list_move(CacheShard *shard, int index, CacheItem *item) {
+    if (item->list == index && shard->lists[index].head == item) return;
+    list_unlink(shard, item);
+    list_push(shard, index, item);
+}
+
+// Prefer the least recently used item of the wanted class near the tail,
+// since that frees a usable chunk immediately; otherwise take the tail,
+// whose page cache.c then empties and moves to the wanted class
+static CacheItem *list_victim(CacheShard *shard, int index, int class_id) {
+    CacheItem *item = shard->lists[index].tail;
+    for (int i = 0; item && i < EVICT_SEARCH_DEPTH; i++, item = item->prev) {
+        if (slab_class_of(item) == class_id) return item;
+    }
+    return shard->lists[index].tail;
+}
+
+// A hit in probation earns a place in the protected segment; when that
+// overflows, its least recently used items drop back to probation
+static void promote(CacheShard *shard, CacheItem *item, size_t protected_limit) {
+    list_move(shard, LIST_PROTECTED, item);
+    ItemList *protected = &shard->lists[LIST_PROTECTED];
+    while (protected->bytes > protected_limit && protected->tail != item) {
+        list_move(shard, LIST_PROBATION, protected->tail);
+    }
+}
+
+static void list_removed(CacheShard *shard, CacheItem *item) {
+    list_unlink(shard, item);
+}
+
+// LRU: one list, every hit moves the item to the head
+
+static void lru_inserted(CacheShard *shard, CacheItem *item) {
+    list_push(shard, LIST_PROBATION, item);
+}
+
+static void lru_accessed(CacheShard *shard, CacheItem *item) {
+    list_move(shard, LIST_PROBATION, item);
+}
+
+static CacheItem *lru_victim(CacheShard *shard, int class_id) {
+    return list_victim(shard, LIST_PROBATION, class_id);
+}
+
+static const EvictionPolicy lru_policy = {
+    "lru", NULL, NULL, NULL, lru_inserted, lru_accessed, list_removed, lru_victim,
+};
+
+// Segmented LRU: new items enter probation and are evicted from there
+// first; only items hit a second time reach the protected segment, so a
+// scan of cold keys cannot flush the hot set
+
+static size_t slru_protected_limit(CacheShard *shard) {
+    return shard->mem_limit / 100 * SLRU_PROTECTED_PERCENT;
+}
+
+static void slru_accessed(CacheShard *shard, CacheItem *item) {
+    if (item->list == LIST_PROBATION) {
+        promote(shard, item, slru_protected_limit(shard));
+    } else {
+        list_move(shard, LIST_PROTECTED, item);
+    }
+}
+
+static CacheItem *slru_victim(CacheShard *shard, int class_id) {
+    CacheItem *victim = list_victim(shard, LIST_PROBATION, class_id);
+    return victim ? victim : list_victim(shard, LIST_PROTECTED, class_id);
+}
+
+static const EvictionPolicy slru_policy = {
+    "slru", NULL, NULL, NULL, lru_inserted, slru_accessed, list_removed, slru_victim,
+};
+
+// CLOCK: the list is a ring swept by a hand from the tail towards the
+// head. A hit only sets the item's referenced bit; the hand clears set
+// bits as it passes and evicts the first item whose bit is clear. New
+// items go right behind the hand, so they get a full turn before it comes
+// back to them.
+
+static CacheItem *clock_next(CacheShard *shard, CacheItem *item) {
+    return item->prev ? item->prev : shard->lists[LIST_PROBATION].tail;
+}
+
+static void clock_inserted(CacheShard *shard, CacheItem *item) {
+    CacheItem *hand = shard->hand;
+    item->referenced = 0;
+    if (!hand) {
+        list_push(shard, LIST_PROBATION, item);
+        shard->hand = item;
+        return;
+    }
+
+    ItemList *list = &shard->lists[LIST_PROBATION];
+    item->list = LIST_PROBATION;
+    item->prev = hand;
+    item->next = hand->next;
+    if (hand->next) {
+        hand->next->prev = item;
+    } else {
+        list->tail = item;
+    }
+    hand->next = item;
+    list->bytes += footprint(shard, item);
+}
+
+static void clock_accessed(CacheShard *shard, CacheItem *item) {
+    (void)shard;
+    item->referenced = 1;
+}
+
+static void clock_removed(CacheShard *shard, CacheItem *item) {
+    if (shard->hand == item) {
+        shard->hand = clock_next(shard, item);
+        if (shard->hand == item) shard->hand = NULL;
+    }
+    list_unlink(shard, item);
+}
+
+static CacheItem *clock_victim(CacheShard *shard, int class_id) {
+    CacheItem *item = shard->hand;
+    CacheItem *fallback = NULL;
+    if (!item) return NULL;
+
+    for (int i = 0; i < EVICT_SEARCH_DEPTH; i++, item = clock_next(shard, item)) {
+        if (item->referenced) {
+            item->referenced = 0;
+        } else if (slab_class_of(item) == class_id) {
+            shard->hand = item;
+            return item;
+        } else if (!fallback) {
+            fallback = item;
+        }
+    }
+
+    // Every bit passed has been cleared, so this stops within one turn
+    if (!fallback) {
+        while (item->referenced) {
+            item->referenced = 0;
+            item = clock_next(shard, item);
+        }
+        fallback = item;
+    }
+    shard->hand = item;
+    return fallback;
+}
+
+static const EvictionPolicy clock_policy = {
+    "clock", NULL, NULL, NULL, clock_inserted, clock_accessed, clock_removed, clock_victim,
+};
+
+// W-TinyLFU: new items enter a small LRU window. Items pushed out of the
+// window join the probation segment of a segmented LRU main space, but at
+// eviction time the newest of them must beat the main space's victim on
+// estimated access frequency (count-min sketch of recent lookups) to stay.
+// The window lets bursts in; the frequency filter keeps one-hit wonders
+// and scans from displacing popular items.
+
+static size_t tinylfu_window_limit(CacheShard *shard) {
+    return shard->mem_limit / 100 * TINYLFU_WINDOW_PERCENT;
+}
+
+static int tinylfu_init(CacheShard *shard) {
+    return sketch_init(&shard->sketch, shard->mem_limit / TINYLFU_ITEM_ESTIMATE);
+}
+
+static void tinylfu_destroy(CacheShard *shard) {
+    sketch_free(&shard->sketch);
+}
+
+static void tinylfu_record(CacheShard *shard, uint32_t hash) {
+    sketch_add(&shard->sketch, hash);
+}
+
+static void tinylfu_inserted(CacheShard *shard, CacheItem *item) {
+    list_push(shard, LIST_WINDOW, item);
+    ItemList *window = &shard->lists[LIST_WINDOW];
+    size_t limit = tinylfu_window_limit(shard);
+    while (window->bytes > limit && window->tail != item) {
+        list_move(shard, LIST_PROBATION, window->tail);
+    }
+}
+
+static void tinylfu_accessed(CacheShard *shard, CacheItem *item) {
+    if (item->list == LIST_PROBATION) {
+        size_t main_limit = shard->mem_limit - tinylfu_window_limit(shard);
+        promote(shard, item, main_limit / 100 * SLRU_PROTECTED_PERCENT);
+    } else {
+        list_move(shard, item->list, item);
+    }
+}
+
+static CacheItem *tinylfu_victim(CacheShard *shard, int class_id) {
+    CacheItem *candidate = shard->lists[LIST_PROBATION].head;
+    CacheItem *victim = list_victim(shard, LIST_PROBATION, class_id);
+    if (!victim) victim = list_victim(shard, LIST_PROTECTED, class_id);
+    if (!victim) return list_victim(shard, LIST_WINDOW, class_id);
+    if (!candidate || candidate == victim) return victim;
+
+    // Admission: the newcomer stays only if it is seen more often
+    if (sketch_estimate(&shard->sketch, candidate->hash) >
+        sketch_estimate(&shard->sketch, victim->hash)) {
+        return victim;
+    }
+    return candidate;
+}
+
+static const EvictionPolicy tinylfu_policy = {
+    "tinylfu", tinylfu_init, tinylfu_destroy, tinylfu_record,
+    tinylfu_inserted, tinylfu_accessed, list_removed, tinylfu_victim,
+};
+
+const EvictionPolicy *const eviction_policies[] = {
+    &lru_policy, &slru_policy, &clock_policy, &tinylfu_policy, NULL,
+};
+
+const EvictionPolicy *find_eviction_policy(const char *name) {
+    for (int i = 0; eviction_policies[i]; i++) {
+        if (strcmp(eviction_policies[i]->name, name) == 0) return eviction_policies[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include "cache.h"
+
+// Eviction policy simulation: replays key traces against a single-shard
+// Cache with every eviction policy and several memory budgets, treating it
+// as a look-aside cache (a miss stores the key), and reports hit ratios.
+// Traces come from a file (one request per line, the key being the last
+// word, so "get <key>" lines work too) or are generated:
+//   zipf  Zipf-distributed keys (s = 0.99)
+//   scan  The zipf trace with a burst of never-repeated keys every so often,
+//         like a batch job reading cold data
+//   loop  All keys requested round robin, a cycle larger than the cache
+
+#define DEFAULT_REQUESTS 1000000
+#define DEFAULT_KEYS 100000
+#define DEFAULT_SIZES "1,2,4,8"
+#define ZIPF_S 0.99
+#define SCAN_EVERY 50000          // Requests between scans
+#define SCAN_LENGTH 20000         // Cold keys per scan
+#define VALUE_LENGTH 100
+#define MAX_SIZES 16
+
+typedef struct Trace {
+    const char *name;
+    char **keys;
+    size_t count;
+} Trace;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static char *key_name(const char *prefix, size_t id) {
+    char key[32];
+    snprintf(key, sizeof(key), "%s:%zu", prefix, id);
+    return strdup(key);
+}
+
+// Zipf sampler: inverse CDF by binary search over precomputed weights
+static size_t *zipf_ranks(int key_count, size_t count) {
+    double *cdf = (double *)malloc(key_count * sizeof(double));
+    double sum = 0;
+    for (int i = 0; i < key_count; i++) {
+        sum += 1.0 / pow(i + 1, ZIPF_S);
+        cdf[i] = sum;
+    }
+
+    size_t *ranks = (size_t *)malloc(count * sizeof(size_t));
+    for (size_t n = 0; n < count; n++) {
+        double u = (next_random() >> 11) * (1.0 / 9007199254740992.0) * sum;
+        int lo = 0, hi = key_count - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        ranks[n] = lo;
+    }
+    free(cdf);
+    return ranks;
+}
+
+static void generate(Trace *trace, const char *name, int key_count, size_t count) {
+    trace->name = name;
+    trace->count = count;
+    trace->keys = (char **)malloc(count * sizeof(char *));
+
+    if (strcmp(name, "loop") == 0) {
+        for (size_t n = 0; n < count; n++) trace->keys[n] = key_name("key", n % key_count);
+        return;
+    }
+
+    size_t *ranks = zipf_ranks(key_count, count);
+    size_t cold = 0;
+    for (size_t n = 0; n < count; n++) {
+        if (strcmp(name, "scan") == 0 && n % SCAN_EVERY >= SCAN_EVERY - SCAN_LENGTH) {
+            trace->keys[n] = key_name("cold", cold++);
+        } else {
+            trace->keys[n] = key_name("key", ranks[n]);
+        }
+    }
+    free(ranks);
+}
+
+static int load(Trace *trace, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open trace");
+        return -1;
+    }
+
+    size_t capacity = 1024;
+    char line[1024];
+    trace->name = path;
+    trace->count = 0;
+    trace->keys = (char **)malloc(capacity * sizeof(char *));
+    while (fgets(line, sizeof(line), file)) {
+        char *key = NULL, *token, *saveptr;
+        for (token = strtok_r(line, " \t\r\n", &saveptr); token; token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            key = token;
+        }
+        if (!key) continue;
+        if (trace->count == capacity) {
+            capacity *= 2;
+            trace->keys = (char **)realloc(trace->keys, capacity * sizeof(char *));
+        }
+        trace->keys[trace->count++] = strdup(key);
+    }
+    fclose(file);
+    return trace->count > 0 ? 0 : -1;
+}
+
+static void free_trace(Trace *trace) {
+    for (size_t n = 0; n < trace->count; n++) free(trace->keys[n]);
+    free(trace->keys);
+}
+
+// Hit ratio of one policy at one memory budget
+static double replay(const Trace *trace, const EvictionPolicy *policy, size_t memory_mb) {
+    char value[VALUE_LENGTH + 1];
+    memset(value, 'v', VALUE_LENGTH);
+    value[VALUE_LENGTH] = '\0';
+
+    Cache *cache = create_cache(memory_mb * 1024 * 1024, 1, 0, policy);
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate cache memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t hits = 0;
+    for (size_t n = 0; n < trace->count; n++) {
+        if (cache_get(cache, trace->keys[n], NULL, 0) >= 0) {
+            hits++;
+        } else {
+            cache_set(cache, trace->keys[n], value, 0);
+        }
+    }
+    free_cache(cache);
+    return (double)hits / trace->count;
+}
+
+static void report(const Trace *trace, const size_t *sizes, int size_count) {
+    printf("\ntrace %s: %zu requests, %d-byte values\n", trace->name, trace->count, VALUE_LENGTH);
+    printf("%10s", "memory_mb");
+    for (int p = 0; eviction_policies[p]; p++) printf(" %9s", eviction_policies[p]->name);
+    printf("\n");
+
+    for (int i = 0; i < size_count; i++) {
+        printf("%10zu", sizes[i]);
+        for (int p = 0; eviction_policies[p]; p++) {
+            printf(" %8.2f%%", 100.0 * replay(trace, eviction_policies[p], sizes[i]));
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f <trace>] [-n <requests>] [-k <keys>] [-c <sizes_mb>]\n", prog);
+    fprintf(stderr, "  -f <trace>     Replay a trace file instead of the generated zipf, scan and loop traces\n");
+    fprintf(stderr, "  -n <requests>  Requests per generated trace (default %d)\n", DEFAULT_REQUESTS);
+    fprintf(stderr, "  -k <keys>      Distinct keys in generated traces (default %d)\n", DEFAULT_KEYS);
+    fprintf(stderr, "  -c <sizes_mb>  Comma-separated cache memory budgets in MB (default %s)\n", DEFAULT_SIZES);
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_file = NULL;
+    size_t requests = DEFAULT_REQUESTS;
+    int key_count = DEFAULT_KEYS;
+    char sizes_arg[256] = DEFAULT_SIZES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:k:c:")) != -1) {
+        switch (opt) {
+        case 'f': trace_file = optarg; break;
+        case 'n': requests = strtoul(optarg, NULL, 10); break;
+        case 'k': key_count = atoi(optarg); break;
+        case 'c': snprintf(sizes_arg, sizeof(sizes_arg), "%s", optarg); break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t sizes[MAX_SIZES];
+    int size_count = 0;
+    char *saveptr;
+    for (char *tok = strtok_r(sizes_arg, ",", &saveptr); tok && size_count < MAX_SIZES;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        sizes[size_count] = strtoul(tok, NULL, 10);
+        if (sizes[size_count] > 0) size_count++;
+    }
+    if (size_count == 0 || requests == 0 || key_count < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Trace trace;
+    if (trace_file) {
+        if (load(&trace, trace_file) < 0) {
+            fprintf(stderr, "No requests in %s\n", trace_file);
+            return EXIT_FAILURE;
+        }
+        report(&trace, sizes, size_count);
+        free_trace(&trace);
+        return 0;
+    }
+
+    const char *generated[] = {"zipf", "scan", "loop"};
+    printf("generated traces: %d keys\n", key_count);
+    for (int i = 0; i < 3; i++) {
+        generate(&trace, generated[i], key_count, requests);
+        report(&trace, sizes, size_count);
+        free_trace(&trace);
+    }
+    return 0;
+}
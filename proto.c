@@ -0,0 +1,120 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include "proto.h"
+
+ssize_t proto_parse(const char *data, size_t len, ProtoMessage *msg) {
+    if (len < PROTO_HEADER_SIZE) return 0;
+
+    const unsigned char *h = (const unsigned char *)data;
+    uint16_t key_len;
+    uint32_t body_len, opaque;
+    memcpy(&key_len, h + 2, 2);
+    memcpy(&body_len, h + 8, 4);
+    memcpy(&opaque, h + 12, 4);
+    key_len = ntohs(key_len);
+    body_len = ntohl(body_len);
+    size_t extras_len = h[4];
+
+    if ((h[0] != PROTO_MAGIC_REQUEST && h[0] != PROTO_MAGIC_RESPONSE) || h[5] != PROTO_VERSION ||
+        body_len > PROTO_MAX_BODY || extras_len + key_len > body_len) {
+        return -1;
+    }
+    if (len < PROTO_HEADER_SIZE + (size_t)body_len) return 0;
+
+    uint16_t status;
+    memcpy(&status, h + 6, 2);
+    msg->magic = h[0];
+    msg->opcode = h[1];
+    msg->status = ntohs(status);
+    msg->opaque = ntohl(opaque);
+    msg->extras = data + PROTO_HEADER_SIZE;
+    msg->extras_len = extras_len;
+    msg->key = msg->extras + extras_len;
+    msg->key_len = key_len;
+    msg->value = msg->key + key_len;
+    msg->value_len = body_len - extras_len - key_len;
+    return PROTO_HEADER_SIZE + body_len;
+}
+
+int proto_write(NetBuf *out, uint8_t magic, uint8_t opcode, uint16_t status, uint32_t opaque,
+                const char *key, size_t key_len, const char *value, size_t value_len) {
+    if (key_len > UINT16_MAX || key_len + value_len > PROTO_MAX_BODY) {
+        if (magic == PROTO_MAGIC_RESPONSE) {
+            proto_write(out, magic, opcode, PROTO_STATUS_TOO_LARGE, opaque, NULL, 0, NULL, 0);
+        }
+        return -1;
+    }
+    unsigned char h[PROTO_HEADER_SIZE] = {0};
+    uint16_t key_len16 = htons((uint16_t)key_len);
+    uint16_t status16 = htons(status);
+    uint32_t body_len = htonl((uint32_t)(key_len + value_len));
+    uint32_t opaque32 = htonl(opaque);
+
+    h[0] = magic;
+    h[1] = opcode;
+    memcpy(h + 2, &key_len16, 2);
+    h[5] = PROTO_VERSION;
+    memcpy(h + 6, &status16, 2);
+    memcpy(h + 8, &body_len, 4);
+    memcpy(h + 12, &opaque32, 4);
+
+    netbuf_append(out, h, sizeof(h));
+    if (key_len > 0) netbuf_append(out, key, key_len);
+    if (value_len > 0) netbuf_append(out, value, value_len);
+    return 0;
+}
+
+void proto_put_key(NetBuf *out, const char *key, size_t len) {
+    uint16_t len16 = htons((uint16_t)len);
+    netbuf_append(out, &len16, 2);
+    netbuf_append(out, key, len);
+}
+
+void proto_put_value(NetBuf *out, const char *value, size_t len) {
+    uint32_t len32 = htonl(value ? (uint32_t)len : PROTO_MISSING);
+    netbuf_append(out, &len32, 4);
+    if (value) netbuf_append(out, value, len);
+}
+
+int proto_next_key(ProtoCursor *cursor, const char **key, size_t *len) {
+    if (cursor->pos == cursor->end) return 0;
+    uint16_t len16;
+    if (cursor->end - cursor->pos < 2) return -1;
+    memcpy(&len16, cursor->pos, 2);
+    *len = ntohs(len16);
+    if ((size_t)(cursor->end - cursor->pos - 2) < *len) return -1;
+    *key = cursor->pos + 2;
+    cursor->pos += 2 + *len;
+    return 1;
+}
+
+int proto_next_value(ProtoCursor *cursor, const char **value, size_t *len) {
+    if (cursor->pos == cursor->end) return 0;
+    uint32_t len32;
+    if (cursor->end - cursor->pos < 4) return -1;
+    memcpy(&len32, cursor->pos, 4);
+    len32 = ntohl(len32);
+    cursor->pos += 4;
+    if (len32 == PROTO_MISSING) {
+        *value = NULL;
+        *len = 0;
+        return 1;
+    }
+    if ((size_t)(cursor->end - cursor->pos) < len32) return -1;
+    *value = cursor->pos;
+    *len = len32;
+    cursor->pos += len32;
+    return 1;
+}
+
+const char *proto_status_name(uint16_t status) {
+    switch (status) {
+    case PROTO_STATUS_OK: return "OK";
+    case PROTO_STATUS_KEY_NOT_FOUND: return "Not found";
+    case PROTO_STATUS_TOO_LARGE: return "Too large";
+    case PROTO_STATUS_INVALID: return "Invalid arguments";
+    case PROTO_STATUS_UNKNOWN_COMMAND: return "Unknown command";
+    case PROTO_STATUS_UNAVAILABLE: return "Unavailable";
+    default: return "Error";
+    }
+}
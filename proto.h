@@ -0,0 +1,141 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "netbuf.h"
+
+// Binary protocol, modelled on the memcached binary protocol. Every
+// message is a 24-byte header followed by extras, key and value:
+//
+//   0  magic       PROTO_MAGIC_REQUEST or PROTO_MAGIC_RESPONSE
+//   1  opcode      PROTO_OP_*
+//   2  key length  (16 bits)
+//   4  extras length
+//   5  version     PROTO_VERSION
+//   6  status      PROTO_STATUS_* in responses, 0 in requests (16 bits)
+//   8  body length extras + key + value (32 bits)
+//  12  opaque      Chosen by the client, echoed in the response (32 bits)
+//  16  cas         Reserved, 0 (64 bits)
+//
+// Multi-byte fields are in network byte order. A connection may carry
+// any number of outstanding requests; responses come back in request
+// order. Text commands never start with the request magic byte, so each
+// message on a connection can be either binary or text.
+
+#define PROTO_HEADER_SIZE 24
+#define PROTO_MAGIC_REQUEST 0x80
+#define PROTO_MAGIC_RESPONSE 0x81
+#define PROTO_VERSION 1
+#define PROTO_MAX_BODY (1024 * 1024 - PROTO_HEADER_SIZE) // Whole message fits a 1 MB buffer
+
+#define PROTO_OP_GET 0x00
+#define PROTO_OP_SET 0x01
+#define PROTO_OP_DELETE 0x04
+#define PROTO_OP_NOOP 0x0a   // Ping
+#define PROTO_OP_STATS 0x10
+#define PROTO_OP_MGET 0x20   // Value: keys (proto_put_key); response: one proto_put_value per key
+#define PROTO_OP_MSET 0x21   // Value: key/value pairs (proto_put_key, proto_put_value)
+#define PROTO_OP_SAVE 0x30   // Dump the cache to its warm-restart file
+#define PROTO_OP_PEEK 0x31   // Get from the cache only, never from db_server
+
+// Key migration between cache servers (migrate.h). Ranges are given as
+// text in the value: "<ring hash> <first>-<last> ..." in hex.
+#define PROTO_OP_IMPORT 0x32      // Key: source; expect its items in the ranges
+#define PROTO_OP_MIGRATE 0x33     // Key: target; send it the items in the ranges
+#define PROTO_OP_TRANSFER 0x34    // Value: key, TTL and value of each item (migrate.h)
+#define PROTO_OP_IMPORT_END 0x35  // Key: source; it has sent everything
+#define PROTO_OP_REPLICATE 0x37   // Key: target; send it copies of the items in the ranges
+
+#define PROTO_OP_INVALIDATE 0x36  // Drop a replica's copy of a key; db_server is left alone
+
+// Reads the load balancer diverts to a server that is not among the key's
+// replicas. Writes do not invalidate that server, so it must not keep a
+// value it fetches from db_server.
+#define PROTO_OP_GET_UNCACHED 0x38
+#define PROTO_OP_MGET_UNCACHED 0x39 // As PROTO_OP_MGET
+
+#define PROTO_MISSING 0xffffffffu // Length of a value that was not found
+
+#define PROTO_STATUS_OK 0x0000
+#define PROTO_STATUS_KEY_NOT_FOUND 0x0001
+#define PROTO_STATUS_TOO_LARGE 0x0003
+#define PROTO_STATUS_INVALID 0x0004
+#define PROTO_STATUS_UNKNOWN_COMMAND 0x0081
+#define PROTO_STATUS_UNAVAILABLE 0x0086
+
+// A parsed message. Pointers refer into the buffer it was parsed from.
+typedef struct ProtoMessage {
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t status;
+    uint32_t opaque;
+    const char *extras;
+    size_t extras_len;
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+} ProtoMessage;
+
+/**
+ * Check whether buffered input starts with a binary message.
+ */
+static inline int proto_is_binary(const char *data, size_t len) {
+    return len > 0 && ((unsigned char)data[0] == PROTO_MAGIC_REQUEST ||
+                       (unsigned char)data[0] == PROTO_MAGIC_RESPONSE);
+}
+
+/**
+ * Parse one message from the start of a buffer.
+ * @return Size of the whole message if complete, 0 if more bytes are
+ *         needed, -1 if the header is invalid.
+ */
+ssize_t proto_parse(const char *data, size_t len, ProtoMessage *msg);
+
+/**
+ * Append a message to a buffer. A key longer than 65535 bytes or a body
+ * larger than PROTO_MAX_BODY cannot be framed: a request is then not
+ * written at all, and a response is replaced by an empty one with
+ * PROTO_STATUS_TOO_LARGE, so the peer still gets an answer.
+ * @return 0 if the message was written as given, -1 otherwise.
+ */
+int proto_write(NetBuf *out, uint8_t magic, uint8_t opcode, uint16_t status, uint32_t opaque,
+                 const char *key, size_t key_len, const char *value, size_t value_len);
+
+// Reads the items packed in the value of a multi-key message
+typedef struct ProtoCursor {
+    const char *pos;
+    const char *end;
+} ProtoCursor;
+
+/**
+ * Append a key to a multi-key body: 16-bit length, then the bytes.
+ */
+void proto_put_key(NetBuf *out, const char *key, size_t len);
+
+/**
+ * Append a value to a multi-key body: 32-bit length, then the bytes.
+ * A NULL value is written as PROTO_MISSING.
+ */
+void proto_put_value(NetBuf *out, const char *value, size_t len);
+
+/**
+ * Read the next key of a multi-key body.
+ * @return 1 if a key was read, 0 at the end, -1 if the body is malformed.
+ */
+int proto_next_key(ProtoCursor *cursor, const char **key, size_t *len);
+
+/**
+ * Read the next value of a multi-key body; *value is NULL if it was missing.
+ * @return 1 if a value was read, 0 at the end, -1 if the body is malformed.
+ */
+int proto_next_value(ProtoCursor *cursor, const char **value, size_t *len);
+
+/**
+ * Short description of a status code.
+ */
+const char *proto_status_name(uint16_t status);
+
+#endif // PROTO_H
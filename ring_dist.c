@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include "conhash.h"
+
+// Key distribution report: maps synthetic keys onto a ring of N servers
+// and shows how evenly they spread, and how many keys move when one
+// server leaves.
+
+#define DEFAULT_SERVERS 3
+#define DEFAULT_KEYS 100000
+
+static int server_index(HashRing *ring, const char *address) {
+    for (int i = 0; i < ring->node_count; i++) {
+        if (strcmp(ring->nodes[i].address, address) == 0) return i;
+    }
+    return -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n <servers>] [-v <vnodes>] [-k <keys>] [-H <hash>]\n", prog);
+    fprintf(stderr, "  -n <servers>  Number of servers on the ring (default %d)\n", DEFAULT_SERVERS);
+    fprintf(stderr, "  -v <vnodes>   Virtual nodes per server (default %d)\n", DEFAULT_VNODES);
+    fprintf(stderr, "  -k <keys>     Number of keys to place (default %d)\n", DEFAULT_KEYS);
+    fprintf(stderr, "  -H <hash>     Ring hash: xxh64, md5 or fnv1a (default %s)\n", DEFAULT_RING_HASH);
+}
+
+int main(int argc, char *argv[]) {
+    int server_count = DEFAULT_SERVERS;
+    int vnodes = DEFAULT_VNODES;
+    int key_count = DEFAULT_KEYS;
+    const RingHash *ring_hash = find_ring_hash(DEFAULT_RING_HASH);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:v:k:H:")) != -1) {
+        switch (opt) {
+        case 'n': server_count = atoi(optarg); break;
+        case 'v': vnodes = atoi(optarg); break;
+        case 'k': key_count = atoi(optarg); break;
+        case 'H':
+            ring_hash = find_ring_hash(optarg);
+            if (!ring_hash) {
+                fprintf(stderr, "Unknown hash function: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (server_count < 1 || vnodes < 1 || key_count < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HashRing ring;
+    init_ring(&ring, vnodes, ring_hash, NULL);
+    char address[64];
+    for (int i = 0; i < server_count; i++) {
+        snprintf(address, sizeof(address), "127.0.0.1:%d", 8080 + i);
+        add_node(&ring, address);
+    }
+
+    int *owner = (int *)malloc(key_count * sizeof(int));
+    long *counts = (long *)calloc(server_count, sizeof(long));
+    char key[32];
+    for (int i = 0; i < key_count; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        owner[i] = server_index(&ring, get_node(&ring, key));
+        counts[owner[i]]++;
+    }
+
+    double mean = (double)key_count / server_count, var = 0;
+    long min = key_count, max = 0;
+    printf("%d servers, %d virtual nodes each, %d keys, %s\n", server_count, vnodes, key_count,
+           ring_hash->name);
+    for (int i = 0; i < server_count; i++) {
+        printf("  %-20s %8ld keys  %6.2f%%\n", ring.nodes[i].address, counts[i],
+               100.0 * counts[i] / key_count);
+        if (counts[i] < min) min = counts[i];
+        if (counts[i] > max) max = counts[i];
+        var += (counts[i] - mean) * (counts[i] - mean);
+    }
+    printf("min/mean %.3f  max/mean %.3f  stddev %.2f%% of mean\n",
+           min / mean, max / mean, 100.0 * sqrt(var / server_count) / mean);
+
+    // Only keys owned by the removed server should move
+    if (server_count > 1) {
+        char removed[256];
+        snprintf(removed, sizeof(removed), "%s", ring.nodes[0].address);
+        char (*before)[256] = malloc(server_count * sizeof(*before));
+        for (int i = 0; i < server_count; i++) {
+            snprintf(before[i], sizeof(before[i]), "%s", ring.nodes[i].address);
+        }
+
+        remove_node(&ring, removed);
+        long moved = 0, stray = 0;
+        for (int i = 0; i < key_count; i++) {
+            snprintf(key, sizeof(key), "key%d", i);
+            if (strcmp(get_node(&ring, key), before[owner[i]]) == 0) continue;
+            moved++;
+            if (owner[i] != 0) stray++;
+        }
+        printf("after removing %s: %.2f%% of keys moved, %ld from surviving servers\n",
+               removed, 100.0 * moved / key_count, stray);
+        free(before);
+    }
+
+    free(owner);
+    free(counts);
+    free_ring(&ring);
+    return 0;
+}
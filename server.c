@@ -2,13 +2,96 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include "cache.h"
+#include "cachedump.h"
+#include "clock.h"
+#include "migrate.h"
 #include "mockdb.h"
+#include "netbuf.h"
+#include "dbpool.h"
+#include "proto.h"
+#include "writebehind.h"
+#include "singleflight.h"
 
 #define BUFFER_SIZE 1024
+#define MAX_REQUEST_SIZE (1024 * 1024) // Largest request buffered per connection
+#define MAX_EVENTS 256
 #define DB_SERVER_ADDRESS "127.0.0.1"
 #define DB_SERVER_PORT 9092
+#define DEFAULT_CACHE_MEMORY_MB 64
+#define DEFAULT_CACHE_SHARDS 16
+#define DEFAULT_TTL_MS 60000
+#define CLOCK_RESOLUTION_MS 1
+#define EXPIRE_INTERVAL_MS 10  // Pause between passes of the expiry thread
+#define EXPIRE_BUDGET 256      // Most expired items removed per shard and pass
+#define DB_WORKERS_PER_THREAD 4 // Default DB workers per event loop thread
+#define JOB_REPLY_BATCH 16     // Jobs a DB worker finishes before waking the event loop, while more are queued
+#define STATUS_WOULD_BLOCK 0xFFFF // Not a wire status: the request must run on a DB worker
+
+Cache *cache = NULL;     // Shared by all reactor threads
+DbPool *db_pool = NULL;  // Persistent connections to db_server
+WriteBehind *write_behind = NULL; // Write-behind log; NULL for write-through
+SingleFlight flights;    // DB fetches in progress, shared by all reactor threads
+uint32_t cache_ttl_ms = DEFAULT_TTL_MS; // TTL of cached values
+const char *dump_path = NULL; // Warm-restart file (-f); NULL if none
+int verbose = 0;         // Log every cache hit and miss (-v)
+
+// A request that may wait on db_server (or the disk). Event loops hand
+// these to the DB workers so that they keep serving other connections,
+// and the load balancer's health probes, in the meantime.
+typedef struct Job {
+    struct Job *next;       // Next job from the same connection
+    char *request;          // Copy of the request: a binary message or a text line
+    size_t len;
+    int binary;
+    int line_mode;
+    NetBuf reply;
+    int done;               // reply is complete
+} Job;
+
+struct Reactor;
+
+// Per-connection state, owned by the reactor thread that accepted it.
+// Fields marked as guarded are shared with the DB workers.
+typedef struct Connection {
+    int fd;                 // Socket, -1 once closed
+    struct Reactor *reactor;
+    NetBuf in;   // Bytes received but not yet parsed
+    NetBuf out;  // Replies not yet sent
+    int line_mode;  // Set once the client has sent a '\n'-terminated request
+    int eof;                // Client finished sending
+    Job *head;              // Oldest job whose reply is not sent yet
+    Job *tail;              // Newest job; its next link is guarded
+    Job *next_job;          // Oldest job not started yet (guarded)
+    int scheduled;          // Queued on or held by a DB worker (guarded)
+    int ready;              // On reactor->ready (guarded)
+    struct Connection *next_ready;     // Guarded
+    struct Connection *next_scheduled; // Guarded by db_queue_lock
+    struct Connection *next_closed;    // Next connection on reactor->closed
+} Connection;
+
+// Per-reactor-thread state
+typedef struct Reactor {
+    int epoll_fd;
+    int listen_fd;
+    int wake_fd;            // eventfd: DB workers finished jobs
+    pthread_mutex_t lock;   // Guards the job state of this reactor's connections
+    Connection *ready;      // Connections with jobs finished since the last wakeup (guarded)
+    Connection *closed;     // Closed connections, freed after the event batch
+} Reactor;
+
+// Connections with jobs to run, oldest first
+static pthread_mutex_t db_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t db_queue_wakeup = PTHREAD_COND_INITIALIZER;
+static Connection *db_queue_head;
+static Connection *db_queue_tail;
 
 void announce_to_load_balancer(const char *server_address) {
     int sock;
@@ -29,96 +112,987 @@ void announce_to_load_balancer(const char *server_address) {
     close(sock);
 }
 
-char *db_request(const char *command, const char *key, const char *value) {
-    int sock;
-    struct sockaddr_in db_addr;
-    static char response[BUFFER_SIZE];
+// Run one request against db_server over a pooled connection. The reply
+// value, if wanted, is appended to reply; returns the reply status, or -1
+// if the DB is unreachable.
+int db_request(uint8_t opcode, const char *key, const char *value, size_t value_len, NetBuf *reply) {
+    DbConn *conn = dbpool_acquire(db_pool);
+    int status = dbpool_request(db_pool, conn, opcode, key, strlen(key), value, value_len, reply);
+    dbpool_release(db_pool, conn);
+    return status;
+}
 
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        perror("Failed to create socket to DB");
-        return NULL;
+// Client status for a write to db_server that did not succeed
+static uint16_t write_failed(int status) {
+    return status < 0 ? PROTO_STATUS_UNAVAILABLE : (uint16_t)status;
+}
+
+// Copy a cached value into result, whatever its size
+static int cache_lookup(const char *key, NetBuf *result) {
+    char value[BUFFER_SIZE];
+    ssize_t len = cache_get(cache, key, value, sizeof(value));
+    if (len < 0) return -1;
+    if (len < BUFFER_SIZE) return netbuf_append(result, value, len);
+
+    // Value larger than the stack buffer: copy it out in full
+    char *large = (char *)malloc(len + 1);
+    if (!large) return -1;
+    ssize_t full = cache_get(cache, key, large, len + 1);
+    int rc = full < 0 ? -1 : netbuf_append(result, large, strlen(large));
+    free(large);
+    return rc;
+}
+
+// Fetch a missed key from db_server. Concurrent misses for the same key
+// share a single DB call: the first one fetches, the others wait for it.
+// The value is cached if keep is set.
+static uint16_t fetch(const char *key, NetBuf *result, int keep) {
+    int leader, status;
+    Flight *flight = singleflight_join(&flights, key, &leader);
+    if (leader) {
+        if (migration_fallback(key, result) == 0) {
+            status = PROTO_STATUS_OK; // Moving here from another server, which still had it
+        } else {
+            status = db_request(PROTO_OP_GET, key, NULL, 0, result);
+            if (status == PROTO_STATUS_OK && keep) cache_set(cache, key, NETBUF_PTR(result), cache_ttl_ms);
+        }
+        if (!singleflight_finish(&flights, flight, status, NETBUF_PTR(result), result->len)) {
+            cache_delete(cache, key); // Overtaken by a write
+        }
+    } else {
+        status = singleflight_wait(&flights, flight, result);
+    }
+
+    if (status != PROTO_STATUS_OK) {
+        netbuf_consume(result, result->len);
+        return PROTO_STATUS_KEY_NOT_FOUND;
+    }
+    return PROTO_STATUS_OK;
+}
+
+// Execute one operation, shared by the text and binary front ends. Values
+// of gets and stats are appended to result. If nonblocking is set, an
+// operation that would wait on db_server or the disk returns
+// STATUS_WOULD_BLOCK before it has any effect.
+static uint16_t execute(uint8_t opcode, const char *key, const char *value, NetBuf *result,
+                        int nonblocking) {
+    int status;
+    switch (opcode) {
+    case PROTO_OP_SET:
+        if (!key || !value) return PROTO_STATUS_INVALID;
+        if (nonblocking && !write_behind) return STATUS_WOULD_BLOCK;
+        migration_touch(key);
+        singleflight_invalidate(&flights, key); // A fetch in flight may have read the old value
+        cache_set(cache, key, value, cache_ttl_ms);
+        if (write_behind) {
+            writebehind_set(write_behind, key, value);
+        } else if ((status = db_request(PROTO_OP_SET, key, value, strlen(value), NULL)) != PROTO_STATUS_OK) {
+            // Not stored: the cache must not serve a value the DB does not have
+            cache_delete(cache, key);
+            return write_failed(status);
+        }
+        return PROTO_STATUS_OK;
+
+    case PROTO_OP_GET:
+    case PROTO_OP_GET_UNCACHED:
+        if (!key) return PROTO_STATUS_INVALID;
+        if (cache_lookup(key, result) == 0) {
+            if (verbose) printf("Cache Hit: %s\n", key);
+            return PROTO_STATUS_OK;
+        }
+        if (write_behind) {
+            // A write not yet in the DB is newer than anything the DB has
+            int queued = writebehind_lookup(write_behind, key, result);
+            if (queued == 0) return PROTO_STATUS_KEY_NOT_FOUND;
+            if (queued == 1) {
+                if (opcode == PROTO_OP_GET) cache_set(cache, key, NETBUF_PTR(result), cache_ttl_ms);
+                return PROTO_STATUS_OK;
+            }
+        }
+        if (nonblocking) return STATUS_WOULD_BLOCK;
+        if (verbose) printf("Cache Miss: %s\n", key);
+        return fetch(key, result, opcode == PROTO_OP_GET);
+
+    case PROTO_OP_DELETE:
+        if (!key) return PROTO_STATUS_INVALID;
+        if (nonblocking && !write_behind) return STATUS_WOULD_BLOCK;
+        migration_touch(key);
+        singleflight_invalidate(&flights, key);
+        cache_delete(cache, key);
+        if (write_behind) {
+            writebehind_delete(write_behind, key);
+        } else if ((status = db_request(PROTO_OP_DELETE, key, NULL, 0, NULL)) != PROTO_STATUS_OK) {
+            return write_failed(status);
+        }
+        return PROTO_STATUS_OK;
+
+    case PROTO_OP_INVALIDATE:
+        // The load balancer wrote the key through another server. A fetch
+        // already in flight may have read the old value: it is not kept.
+        if (!key) return PROTO_STATUS_INVALID;
+        migration_touch(key);
+        singleflight_invalidate(&flights, key);
+        cache_delete(cache, key);
+        return PROTO_STATUS_OK;
+
+    case PROTO_OP_NOOP:
+        return PROTO_STATUS_OK; // Load balancer health probe
+
+    case PROTO_OP_STATS: {
+        char stats[BUFFER_SIZE];
+        cache_stats(cache, stats, sizeof(stats));
+        netbuf_append(result, stats, strlen(stats));
+        singleflight_stats(&flights, result);
+        if (write_behind) writebehind_stats(write_behind, result);
+        migration_stats(result);
+        return PROTO_STATUS_OK;
+    }
+
+    case PROTO_OP_SAVE: {
+        if (!dump_path) return PROTO_STATUS_UNAVAILABLE;
+        if (nonblocking) return STATUS_WOULD_BLOCK;
+        long saved = cache_dump(cache, dump_path);
+        if (saved < 0) return PROTO_STATUS_UNAVAILABLE;
+        printf("Saved %ld items to %s\n", saved, dump_path);
+        return PROTO_STATUS_OK;
     }
 
-    db_addr.sin_family = AF_INET;
-    db_addr.sin_port = htons(DB_SERVER_PORT);
-    inet_pton(AF_INET, DB_SERVER_ADDRESS, &db_addr.sin_addr);
+    case PROTO_OP_PEEK:
+        if (!key) return PROTO_STATUS_INVALID;
+        return cache_lookup(key, result) == 0 ? PROTO_STATUS_OK : PROTO_STATUS_KEY_NOT_FOUND;
+
+    case PROTO_OP_IMPORT:
+        if (!key || !value) return PROTO_STATUS_INVALID;
+        return migration_import(key, value) == 0 ? PROTO_STATUS_OK : PROTO_STATUS_INVALID;
+
+    case PROTO_OP_IMPORT_END:
+        if (!key) return PROTO_STATUS_INVALID;
+        migration_import_end(key);
+        return PROTO_STATUS_OK;
+
+    case PROTO_OP_MIGRATE:
+    case PROTO_OP_REPLICATE:
+        if (!key || !value) return PROTO_STATUS_INVALID;
+        return migration_start(key, value, opcode == PROTO_OP_REPLICATE) == 0 ? PROTO_STATUS_OK
+                                                                            : PROTO_STATUS_INVALID;
 
-    if (connect(sock, (struct sockaddr *)&db_addr, sizeof(db_addr)) < 0) {
-        perror("Connection to DB server failed");
-        close(sock);
-        return NULL;
+    default:
+        return PROTO_STATUS_UNKNOWN_COMMAND;
     }
+}
 
-    char request[BUFFER_SIZE];
-    snprintf(request, BUFFER_SIZE, "%s %s %s", command, key, value ? value : "");
-    send(sock, request, strlen(request), 0);
+// Look up many keys at once. Values are packed into result in key order
+// (proto_put_value). Misses that no other thread is fetching already go to
+// db_server in one request; the rest wait for the fetch in flight, after
+// this thread's own fetches have been published. Fetched values are
+// cached if keep is set.
+static void execute_mget(char **keys, int count, NetBuf *result, int keep) {
+    NetBuf *values = (NetBuf *)calloc(count, sizeof(NetBuf));
+    char *found = (char *)calloc(count, 1);
+    char *leader = (char *)calloc(count, 1);   // This thread fetches the key
+    Flight **flight = (Flight **)calloc(count, sizeof(Flight *));
+    NetBuf misses = {0};
+    int miss_count = 0;
 
-    int bytes_received = recv(sock, response, BUFFER_SIZE - 1, 0);
-    response[bytes_received] = '\0';
+    for (int i = 0; i < count; i++) {
+        int queued = -1, leads;
+        if (cache_lookup(keys[i], &values[i]) == 0) {
+            if (verbose) printf("Cache Hit: %s\n", keys[i]);
+            found[i] = 1;
+        } else if (write_behind && (queued = writebehind_lookup(write_behind, keys[i], &values[i])) >= 0) {
+            found[i] = queued; // Resolved by a write not yet in the DB
+        } else {
+            if (verbose) printf("Cache Miss: %s\n", keys[i]);
+            flight[i] = singleflight_join(&flights, keys[i], &leads);
+            if (leads && migration_fallback(keys[i], &values[i]) == 0) {
+                found[i] = 1;
+                singleflight_finish(&flights, flight[i], PROTO_STATUS_OK, NETBUF_PTR(&values[i]),
+                                    values[i].len);
+                flight[i] = NULL;
+            } else if (leads) {
+                proto_put_key(&misses, keys[i], strlen(keys[i]));
+                leader[i] = 1;
+                miss_count++;
+            }
+        }
+    }
 
-    close(sock);
-    return response;
+    NetBuf reply = {0};
+    int status = miss_count > 0
+                     ? db_request(PROTO_OP_MGET, "", NETBUF_PTR(&misses), misses.len, &reply)
+                     : PROTO_STATUS_OK;
+    ProtoCursor cursor = {NETBUF_PTR(&reply), NETBUF_PTR(&reply) + reply.len};
+    for (int i = 0; i < count; i++) {
+        const char *value = NULL;
+        size_t len = 0;
+        if (!leader[i]) continue;
+        if (status == PROTO_STATUS_OK && proto_next_value(&cursor, &value, &len) != 1) {
+            status = -1; // Reply shorter than the request: fail the rest
+        }
+        if (status != PROTO_STATUS_OK || (value && memchr(value, '\0', len))) value = NULL;
+
+        if (value) {
+            netbuf_append(&values[i], value, len);
+            netbuf_append(&values[i], "", 1);
+            values[i].len--; // NUL-terminated for the cache
+            if (keep) cache_set(cache, keys[i], NETBUF_PTR(&values[i]), cache_ttl_ms);
+            found[i] = 1;
+        }
+        if (!singleflight_finish(&flights, flight[i], value ? PROTO_STATUS_OK : PROTO_STATUS_KEY_NOT_FOUND,
+                                 value, len) && value && keep) {
+            cache_delete(cache, keys[i]); // Overtaken by a write elsewhere
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (flight[i] && !leader[i]) {
+            found[i] = singleflight_wait(&flights, flight[i], &values[i]) == PROTO_STATUS_OK;
+        }
+        const char *value = values[i].data ? NETBUF_PTR(&values[i]) : ""; // Empty values allocate nothing
+        proto_put_value(result, found[i] ? value : NULL, values[i].len);
+        netbuf_free(&values[i]);
+    }
+    netbuf_free(&reply);
+    netbuf_free(&misses);
+    free(values);
+    free(found);
+    free(leader);
+    free(flight);
 }
 
-void handle_client(int client_socket, Cache *cache) {
-    char buffer[BUFFER_SIZE];
+// Store many key/value pairs (pairs[2i] is a key, pairs[2i + 1] its value)
+// with a single write to db_server. If that fails, none of them stay cached.
+static uint16_t execute_mset(char **pairs, int count) {
+    NetBuf body = {0};
+    for (int i = 0; i < count; i++) {
+        char *key = pairs[2 * i], *value = pairs[2 * i + 1];
+        migration_touch(key);
+        singleflight_invalidate(&flights, key);
+        cache_set(cache, key, value, cache_ttl_ms);
+        if (write_behind) {
+            writebehind_set(write_behind, key, value);
+        } else {
+            proto_put_key(&body, key, strlen(key));
+            proto_put_value(&body, value, strlen(value));
+        }
+    }
+    int status = write_behind ? PROTO_STATUS_OK
+                              : db_request(PROTO_OP_MSET, "", NETBUF_PTR(&body), body.len, NULL);
+    netbuf_free(&body);
+    if (status == PROTO_STATUS_OK) return PROTO_STATUS_OK;
+    for (int i = 0; i < count; i++) cache_delete(cache, pairs[2 * i]);
+    return write_failed(status);
+}
+
+// Append a reply. Requests terminated by '\n' get '\n'-terminated replies,
+// so replies must not contain newlines of their own in that case.
+static void append_reply(NetBuf *out, const char *reply, size_t len, int line_mode) {
+    if (!line_mode) {
+        netbuf_append(out, reply, len);
+        return;
+    }
+
+    const char *p = reply, *end = reply + len, *nl;
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        netbuf_append(out, p, nl - p);
+        if (nl + 1 < end) netbuf_append(out, "; ", 2);
+        p = nl + 1;
+    }
+    netbuf_append(out, p, end - p);
+    netbuf_append(out, "\n", 1);
+}
+
+// Execute a text mget or mset. Values in an mget reply are separated by
+// spaces, with "null" for keys that have no value.
+// Returns STATUS_WOULD_BLOCK, having done nothing, if nonblocking is set
+// and the request would wait on db_server; 0 otherwise.
+static int handle_multi_request(NetBuf *out, const char *command, char **saveptr, int line_mode,
+                                int nonblocking) {
+    if (nonblocking && (strcmp(command, "mget") == 0 || !write_behind)) return STATUS_WOULD_BLOCK;
+    int count = 0, capacity = 16;
+    char **args = (char **)malloc(capacity * sizeof(char *));
+    char *arg;
+    while ((arg = strtok_r(NULL, " \t\r", saveptr)) != NULL) {
+        if (count == capacity) {
+            capacity *= 2;
+            args = (char **)realloc(args, capacity * sizeof(char *));
+        }
+        args[count++] = arg;
+    }
+
+    if (strcmp(command, "mget") == 0 && count > 0) {
+        NetBuf values = {0}, reply = {0};
+        execute_mget(args, count, &values, 1);
+
+        ProtoCursor cursor = {NETBUF_PTR(&values), NETBUF_PTR(&values) + values.len};
+        const char *value;
+        size_t len;
+        for (int i = 0; proto_next_value(&cursor, &value, &len) == 1; i++) {
+            if (i > 0) netbuf_append(&reply, " ", 1);
+            netbuf_append(&reply, value ? value : "null", value ? len : 4);
+        }
+        append_reply(out, NETBUF_PTR(&reply), reply.len, line_mode);
+        netbuf_free(&values);
+        netbuf_free(&reply);
+    } else if (strcmp(command, "mset") == 0 && count > 0 && count % 2 == 0) {
+        if (execute_mset(args, count / 2) == PROTO_STATUS_OK) {
+            append_reply(out, "OK", 2, line_mode);
+        } else {
+            append_reply(out, "ERROR", 5, line_mode);
+        }
+    } else {
+        append_reply(out, "Invalid command", 15, line_mode);
+    }
+    free(args);
+    return 0;
+}
+
+// Execute one text request and append its reply to out. The request is
+// tokenized in place. Returns STATUS_WOULD_BLOCK as execute() does, or 0.
+static int handle_request(NetBuf *out, char *request, int line_mode, int nonblocking) {
+    char *saveptr = NULL;
+
+    char *command = strtok_r(request, " \t\r", &saveptr);
+    if (command && (strcmp(command, "mget") == 0 || strcmp(command, "mset") == 0)) {
+        return handle_multi_request(out, command, &saveptr, line_mode, nonblocking);
+    }
+    char *key = strtok_r(NULL, " \t\r", &saveptr);
+    char *value = strtok_r(NULL, " \t\r", &saveptr);
+    if (!command) command = "";
+
+    int opcode = -1;
+    if (strcmp(command, "set") == 0 && key && value) {
+        opcode = PROTO_OP_SET;
+    } else if (strcmp(command, "get") == 0 && key) {
+        opcode = PROTO_OP_GET;
+    } else if (strcmp(command, "delete") == 0 && key) {
+        opcode = PROTO_OP_DELETE;
+    } else if (strcmp(command, "ping") == 0) {
+        opcode = PROTO_OP_NOOP;
+    } else if (strcmp(command, "stats") == 0) {
+        opcode = PROTO_OP_STATS;
+    } else if (strcmp(command, "save") == 0) {
+        opcode = PROTO_OP_SAVE;
+    }
+
+    if (opcode < 0) {
+        append_reply(out, "Invalid command", 15, line_mode);
+        return 0;
+    }
+
+    NetBuf result = {0};
+    uint16_t status = execute(opcode, key, value, &result, nonblocking);
+    if (status == STATUS_WOULD_BLOCK) {
+        // Nothing done yet
+    } else if (opcode == PROTO_OP_GET || opcode == PROTO_OP_STATS) {
+        if (status == PROTO_STATUS_OK) {
+            append_reply(out, NETBUF_PTR(&result), result.len, line_mode);
+        } else {
+            append_reply(out, "null", 4, line_mode);
+        }
+    } else if (opcode == PROTO_OP_NOOP) {
+        append_reply(out, "PONG", 4, line_mode);
+    } else if (status != PROTO_STATUS_OK) {
+        append_reply(out, "ERROR", 5, line_mode);
+    } else {
+        append_reply(out, "OK", 2, line_mode);
+    }
+    netbuf_free(&result);
+    return status == STATUS_WOULD_BLOCK ? STATUS_WOULD_BLOCK : 0;
+}
+
+// Copy a key or value out of a binary message as a C string. Values are
+// stored NUL-terminated, so embedded NULs cannot be represented.
+static char *message_string(const char *data, size_t len) {
+    if (memchr(data, '\0', len)) return NULL;
+    char *s = (char *)malloc(len + 1);
+    if (!s) return NULL;
+    memcpy(s, data, len);
+    s[len] = '\0';
+    return s;
+}
+
+// Unpack the keys (and for mset, values) of a binary mget or mset as C
+// strings. Returns the number of strings, or -1 if the body is malformed.
+static int unpack_multi(const ProtoMessage *msg, char ***out) {
+    ProtoCursor cursor = {msg->value, msg->value + msg->value_len};
+    int count = 0, capacity = 16;
+    char **items = (char **)malloc(capacity * sizeof(char *));
 
     while (1) {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received <= 0) break;
-
-        char command[10], key[MAX_KEY_LENGTH], value[MAX_VALUE_LENGTH];
-        sscanf(buffer, "%s %s %s", command, key, value);
-
-        char response[BUFFER_SIZE] = {0};
-
-        if (strcmp(command, "set") == 0) {
-            cache_set(cache, key, value, 60);
-            db_request("set", key, value);
-            snprintf(response, BUFFER_SIZE, "OK");
-        } else if (strcmp(command, "get") == 0) {
-            char *result = cache_get(cache, key);
-            if (result) {
-                printf("Cache Hit: %s\n", key);
-                snprintf(response, BUFFER_SIZE, "%s", result);
-            } else {
-                printf("Cache Miss: %s\n", key);
-                result = db_request("get", key, NULL);
-                if (strcmp(result, "null") != 0) {
-                    cache_set(cache, key, result, 60);
-                    snprintf(response, BUFFER_SIZE, "%s", result);
-                } else {
-                    snprintf(response, BUFFER_SIZE, "null");
+        const char *data;
+        size_t len;
+        int rc = (msg->opcode == PROTO_OP_MSET && count % 2 == 1)
+                     ? proto_next_value(&cursor, &data, &len)
+                     : proto_next_key(&cursor, &data, &len);
+        if (rc == 0) break;
+
+        char *item = rc > 0 && data ? message_string(data, len) : NULL;
+        if (!item) goto malformed;
+        if (count == capacity) {
+            capacity *= 2;
+            items = (char **)realloc(items, capacity * sizeof(char *));
+        }
+        items[count++] = item;
+    }
+    if (count == 0 || (msg->opcode == PROTO_OP_MSET && count % 2 != 0)) goto malformed;
+
+    *out = items;
+    return count;
+
+malformed:
+    for (int i = 0; i < count; i++) free(items[i]);
+    free(items);
+    return -1;
+}
+
+// Execute a binary mget or mset and append its response to out
+static int handle_binary_multi(NetBuf *out, const ProtoMessage *msg, int nonblocking) {
+    if (nonblocking && (msg->opcode != PROTO_OP_MSET || !write_behind)) return STATUS_WOULD_BLOCK;
+    NetBuf result = {0};
+    uint16_t status = PROTO_STATUS_OK;
+    char **items = NULL;
+    int count = msg->magic == PROTO_MAGIC_REQUEST ? unpack_multi(msg, &items) : -1;
+
+    if (count < 0) {
+        status = PROTO_STATUS_INVALID;
+    } else if (msg->opcode == PROTO_OP_MGET || msg->opcode == PROTO_OP_MGET_UNCACHED) {
+        execute_mget(items, count, &result, msg->opcode == PROTO_OP_MGET);
+    } else {
+        status = execute_mset(items, count / 2);
+    }
+
+    proto_write(out, PROTO_MAGIC_RESPONSE, msg->opcode, status, msg->opaque, NULL, 0,
+                NETBUF_PTR(&result), result.len);
+    for (int i = 0; i < count; i++) free(items[i]);
+    free(items);
+    netbuf_free(&result);
+    return 0;
+}
+
+// Execute one binary request and append its response to out. Returns
+// STATUS_WOULD_BLOCK as execute() does, or 0.
+static int handle_binary_request(NetBuf *out, const ProtoMessage *msg, int nonblocking) {
+    if (msg->opcode == PROTO_OP_MGET || msg->opcode == PROTO_OP_MGET_UNCACHED ||
+        msg->opcode == PROTO_OP_MSET) {
+        return handle_binary_multi(out, msg, nonblocking);
+    }
+    if (msg->opcode == PROTO_OP_TRANSFER) {
+        // Items carry binary TTLs, so the body is not a string
+        long stored = migration_receive(msg->value, msg->value_len);
+        proto_write(out, PROTO_MAGIC_RESPONSE, msg->opcode,
+                    stored < 0 ? PROTO_STATUS_INVALID : PROTO_STATUS_OK, msg->opaque, NULL, 0, NULL, 0);
+        return 0;
+    }
+
+    NetBuf result = {0};
+    uint16_t status;
+
+    char *key = msg->key_len > 0 ? message_string(msg->key, msg->key_len) : NULL;
+    char *value = msg->opcode == PROTO_OP_SET || msg->opcode == PROTO_OP_IMPORT ||
+                          msg->opcode == PROTO_OP_MIGRATE || msg->opcode == PROTO_OP_REPLICATE
+                      ? message_string(msg->value, msg->value_len)
+                      : NULL;
+    if (msg->magic != PROTO_MAGIC_REQUEST || (msg->key_len > 0 && !key)) {
+        status = PROTO_STATUS_INVALID;
+    } else {
+        status = execute(msg->opcode, key, value, &result, nonblocking);
+    }
+
+    if (status != STATUS_WOULD_BLOCK) {
+        proto_write(out, PROTO_MAGIC_RESPONSE, msg->opcode, status, msg->opaque, NULL, 0,
+                    NETBUF_PTR(&result), result.len);
+    }
+    netbuf_free(&result);
+    free(key);
+    free(value);
+    return status == STATUS_WOULD_BLOCK ? STATUS_WOULD_BLOCK : 0;
+}
+
+// Execute a binary message or a text line (not NUL-terminated) and append
+// its reply to out. Returns STATUS_WOULD_BLOCK as execute() does, or 0.
+static int run_request(NetBuf *out, const char *data, size_t len, int binary, int line_mode,
+                       int nonblocking) {
+    if (binary) {
+        ProtoMessage msg;
+        proto_parse(data, len, &msg);
+        return handle_binary_request(out, &msg, nonblocking);
+    }
+    char *request = strndup(data, len); // Tokenized in place
+    if (!request) {
+        append_reply(out, "ERROR", 5, line_mode);
+        return 0;
+    }
+    int rc = handle_request(out, request, line_mode, nonblocking);
+    free(request);
+    return rc;
+}
+
+// Hand a connection with jobs to run to the DB workers. Called with the
+// reactor's lock held.
+static void schedule_connection(Connection *conn) {
+    if (conn->scheduled) return;
+    conn->scheduled = 1;
+    pthread_mutex_lock(&db_queue_lock);
+    conn->next_scheduled = NULL;
+    if (db_queue_tail) {
+        db_queue_tail->next_scheduled = conn;
+    } else {
+        db_queue_head = conn;
+    }
+    db_queue_tail = conn;
+    pthread_cond_signal(&db_queue_wakeup);
+    pthread_mutex_unlock(&db_queue_lock);
+}
+
+// Queue a request for the DB workers. Replies keep the order of the
+// requests, and the jobs of one connection run one at a time, in order.
+static void queue_job(Connection *conn, const char *data, size_t len, int binary, int line_mode) {
+    Job *job = (Job *)calloc(1, sizeof(Job));
+    job->request = (char *)malloc(len > 0 ? len : 1);
+    if (len > 0) memcpy(job->request, data, len);
+    job->len = len;
+    job->binary = binary;
+    job->line_mode = line_mode;
+
+    Reactor *reactor = conn->reactor;
+    pthread_mutex_lock(&reactor->lock);
+    if (conn->tail) {
+        conn->tail->next = job;
+    } else {
+        conn->head = job;
+    }
+    conn->tail = job;
+    if (!conn->next_job) conn->next_job = job;
+    schedule_connection(conn);
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+// Answer a request here if nothing is queued ahead of it and it does not
+// wait on db_server; queue it for the DB workers otherwise
+static void dispatch(Connection *conn, const char *data, size_t len, int binary, int line_mode) {
+    if (!conn->head && run_request(&conn->out, data, len, binary, line_mode, 1) != STATUS_WOULD_BLOCK) {
+        return;
+    }
+    queue_job(conn, data, len, binary, line_mode);
+}
+
+// Run the jobs of queued connections in turn. Their reactors are woken
+// once a connection has no more jobs queued, or every JOB_REPLY_BATCH jobs
+// of a long pipeline, so its replies go out in batches.
+void *db_worker_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&db_queue_lock);
+        while (!db_queue_head) pthread_cond_wait(&db_queue_wakeup, &db_queue_lock);
+        Connection *conn = db_queue_head;
+        db_queue_head = conn->next_scheduled;
+        if (!db_queue_head) db_queue_tail = NULL;
+        pthread_mutex_unlock(&db_queue_lock);
+
+        Reactor *reactor = conn->reactor;
+        pthread_mutex_lock(&reactor->lock);
+        Job *job;
+        int unsent = 0;
+        while ((job = conn->next_job) != NULL) {
+            conn->next_job = job->next;
+            pthread_mutex_unlock(&reactor->lock);
+            run_request(&job->reply, job->request, job->len, job->binary, job->line_mode, 0);
+
+            pthread_mutex_lock(&reactor->lock);
+            job->done = 1;
+            if (!conn->next_job) conn->scheduled = 0; // Once woken, the reactor may free conn
+            if (++unsent < JOB_REPLY_BATCH && conn->scheduled) continue;
+            unsent = 0;
+            if (!conn->ready) {
+                // A non-empty list already has a wakeup pending
+                uint64_t one = 1;
+                if (!reactor->ready && write(reactor->wake_fd, &one, sizeof(one)) < 0) {
+                    perror("Failed to wake event loop");
                 }
+                conn->ready = 1;
+                conn->next_ready = reactor->ready;
+                reactor->ready = conn;
             }
-        } else if (strcmp(command, "delete") == 0) {
-            cache_delete(cache, key);
-            db_request("delete", key, NULL);
-            snprintf(response, BUFFER_SIZE, "OK");
+            if (!conn->scheduled) break;
+        }
+        pthread_mutex_unlock(&reactor->lock);
+    }
+    return NULL;
+}
+
+// Parse and execute every complete request in the input buffer. Binary
+// requests are recognised by their magic byte; text requests end at '\n'.
+// For compatibility with clients that send one bare command per write,
+// unterminated text is taken as a whole request once the socket has been
+// drained, unless the client has already shown that it terminates its
+// requests.
+// @return -1 if the input is not a valid request stream.
+static int process_input(Connection *conn, int drained) {
+    NetBuf *in = &conn->in;
+
+    while (in->len > 0) {
+        char *start = NETBUF_PTR(in);
+
+        if (proto_is_binary(start, in->len)) {
+            ProtoMessage msg;
+            ssize_t size = proto_parse(start, in->len, &msg);
+            if (size < 0) return -1;
+            if (size == 0) break; // Partial message: wait for the rest
+            dispatch(conn, start, size, 1, 0);
+            netbuf_consume(in, size);
+            continue;
+        }
+
+        char *nl = memchr(start, '\n', in->len);
+        if (nl) {
+            conn->line_mode = 1;
+            dispatch(conn, start, nl - start, 0, 1);
+            netbuf_consume(in, nl - start + 1);
+        } else if (drained && !conn->line_mode) {
+            dispatch(conn, start, in->len, 0, 0);
+            netbuf_consume(in, in->len);
         } else {
-            snprintf(response, BUFFER_SIZE, "Invalid command");
+            break;
+        }
+    }
+    return 0;
+}
+
+// Jobs still running finish, but their replies are dropped
+static void close_connection(Reactor *reactor, Connection *conn) {
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    netbuf_free(&conn->in);
+    netbuf_free(&conn->out);
+    conn->next_closed = reactor->closed;
+    reactor->closed = conn;
+}
+
+static void free_job(Job *job) {
+    free(job->request);
+    netbuf_free(&job->reply);
+    free(job);
+}
+
+// Free the closed connections that no DB worker holds any more; the others
+// are tried again after a later batch
+static void free_closed(Reactor *reactor) {
+    Connection **link = &reactor->closed;
+    pthread_mutex_lock(&reactor->lock);
+    while (*link) {
+        Connection *conn = *link;
+        if (conn->scheduled || conn->ready) {
+            link = &conn->next_closed;
+            continue;
+        }
+        *link = conn->next_closed;
+        while (conn->head) {
+            Job *job = conn->head;
+            conn->head = job->next;
+            free_job(job);
+        }
+        free(conn);
+    }
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+// Send the replies of finished jobs that are next in line. Closes the
+// connection once the client has finished and everything is answered.
+static void flush_connection(Reactor *reactor, Connection *conn) {
+    pthread_mutex_lock(&reactor->lock);
+    while (conn->head && conn->head->done) {
+        Job *job = conn->head;
+        conn->head = job->next;
+        if (!conn->head) conn->tail = NULL;
+        netbuf_append(&conn->out, NETBUF_PTR(&job->reply), job->reply.len);
+        free_job(job);
+    }
+    pthread_mutex_unlock(&reactor->lock);
+
+    if (netbuf_flush_fd(&conn->out, conn->fd) < 0 || (conn->eof && !conn->head)) {
+        close_connection(reactor, conn);
+    }
+}
+
+// DB workers have finished jobs
+static void collect_jobs(Reactor *reactor) {
+    uint64_t count;
+    if (read(reactor->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("Failed to read event loop wakeup");
+    }
+    while (1) {
+        pthread_mutex_lock(&reactor->lock);
+        Connection *conn = reactor->ready;
+        if (conn) {
+            reactor->ready = conn->next_ready;
+            conn->ready = 0;
+        }
+        pthread_mutex_unlock(&reactor->lock);
+        if (!conn) break;
+        if (conn->fd >= 0) flush_connection(reactor, conn);
+    }
+}
+
+static void accept_connections(Reactor *reactor) {
+    while (1) {
+        int fd = accept(reactor->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        set_nonblocking(fd);
+        Connection *conn = (Connection *)calloc(1, sizeof(Connection));
+        conn->fd = fd;
+        conn->reactor = reactor;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+// Edge-triggered: drain the socket completely on every readiness event
+static void handle_connection_event(Reactor *reactor, Connection *conn, uint32_t events) {
+    if (conn->fd < 0) return; // Closed earlier in this batch of events
+
+    if (events & EPOLLERR) {
+        close_connection(reactor, conn);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        while (!conn->eof) {
+            ssize_t n = netbuf_read_fd(&conn->in, conn->fd, MAX_REQUEST_SIZE);
+            if (n < 0) {
+                if (errno != 0) {
+                    close_connection(reactor, conn);
+                    return;
+                }
+                conn->eof = 1;
+            }
+
+            int full = conn->in.len >= MAX_REQUEST_SIZE;
+            if (process_input(conn, !full) < 0) {
+                fprintf(stderr, "Malformed binary request, closing connection\n");
+                close_connection(reactor, conn);
+                return;
+            }
+            if (!full) break;
+            if (conn->in.len >= MAX_REQUEST_SIZE) {
+                fprintf(stderr, "Request too large, closing connection\n");
+                close_connection(reactor, conn);
+                return;
+            }
+        }
+    }
+
+    flush_connection(reactor, conn);
+}
+
+void *reactor_thread(void *arg) {
+    Reactor *reactor = (Reactor *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_connections(reactor);
+            } else if (events[i].data.ptr == reactor) {
+                collect_jobs(reactor);
+            } else {
+                handle_connection_event(reactor, (Connection *)events[i].data.ptr, events[i].events);
+            }
         }
+        if (reactor->closed) free_closed(reactor);
+    }
+    return NULL;
+}
 
-        send(client_socket, response, strlen(response), 0);
+// Removes expired items in the background so they do not wait for a read
+// or for LRU eviction to free their memory
+void *expiry_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        cache_expire(cache, EXPIRE_BUDGET);
+        usleep(EXPIRE_INTERVAL_MS * 1000);
     }
+    return NULL;
+}
 
-    close(client_socket);
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m <memory_mb>] [-s <shards>] [-t <threads>] [-p <db_conns>] [-w <queue>] [-T <ttl_ms>] [-e <policy>] [-f <file>] [-L] [-v] <port>\n", prog);
+    fprintf(stderr, "  -m <memory_mb>  Cache memory budget in megabytes (default %d)\n",
+            DEFAULT_CACHE_MEMORY_MB);
+    fprintf(stderr, "  -s <shards>     Number of independently locked cache shards (default %d)\n",
+            DEFAULT_CACHE_SHARDS);
+    fprintf(stderr, "  -t <threads>    Number of event loop threads (default: one per CPU)\n");
+    fprintf(stderr, "  -p <db_conns>   Persistent connections to db_server, one per DB worker thread\n");
+    fprintf(stderr, "                  (default %d per event loop thread)\n", DB_WORKERS_PER_THREAD);
+    fprintf(stderr, "  -w <queue>      Write behind: acknowledge writes once cached and send them to\n");
+    fprintf(stderr, "                  db_server in the background, queueing at most <queue> keys\n");
+    fprintf(stderr, "                  (default: write through)\n");
+    fprintf(stderr, "  -T <ttl_ms>     Time-to-live of cached values in milliseconds (default %d)\n",
+            DEFAULT_TTL_MS);
+    fprintf(stderr, "  -e <policy>     Eviction policy: lru, slru, clock or tinylfu (default %s)\n",
+            DEFAULT_EVICTION_POLICY);
+    fprintf(stderr, "  -f <file>       Warm restart: load the cache from <file> on startup and save it\n");
+    fprintf(stderr, "                  there on shutdown or on the save command\n");
+    fprintf(stderr, "  -L              Back cache memory with huge pages if available\n");
+    fprintf(stderr, "  -v              Log every cache hit and miss\n");
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    size_t memory_mb = DEFAULT_CACHE_MEMORY_MB;
+    int shard_count = DEFAULT_CACHE_SHARDS;
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int db_pool_size = 0;
+    int use_huge_pages = 0;
+    long write_queue = 0;
+    const EvictionPolicy *policy = find_eviction_policy(DEFAULT_EVICTION_POLICY);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:s:t:p:w:T:e:f:Lv")) != -1) {
+        switch (opt) {
+        case 'm':
+            memory_mb = strtoul(optarg, NULL, 10);
+            if (memory_mb == 0) {
+                fprintf(stderr, "Invalid memory budget: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            shard_count = atoi(optarg);
+            if (shard_count < 1) {
+                fprintf(stderr, "Invalid shard count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            thread_count = atoi(optarg);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            db_pool_size = atoi(optarg);
+            if (db_pool_size < 1) {
+                fprintf(stderr, "Invalid DB connection count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            write_queue = atol(optarg);
+            if (write_queue < 1) {
+                fprintf(stderr, "Invalid write-behind queue size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            cache_ttl_ms = strtoul(optarg, NULL, 10);
+            if (cache_ttl_ms == 0) {
+                fprintf(stderr, "Invalid TTL: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            policy = find_eviction_policy(optarg);
+            if (!policy) {
+                fprintf(stderr, "Unknown eviction policy: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            dump_path = optarg;
+            break;
+        case 'L':
+            use_huge_pages = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int port = atoi(argv[optind]);
+    int server_socket;
+    struct sockaddr_in server_addr;
+    if (thread_count < 1) thread_count = 1;
+    if (db_pool_size < 1) db_pool_size = thread_count * DB_WORKERS_PER_THREAD;
+    int db_worker_count = db_pool_size; // Each DB worker has at most one DB call in flight
+
+    singleflight_init(&flights);
+    cache = create_cache(memory_mb * 1024 * 1024, shard_count, use_huge_pages, policy);
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate cache memory\n");
         return EXIT_FAILURE;
     }
 
-    int port = atoi(argv[1]);
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_len = sizeof(client_addr);
+    // Shutdown signals are taken by the main thread only (sigwait below);
+    // threads created from here on inherit the blocked mask
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+
+    pthread_t expiry;
+    if (clock_start(CLOCK_RESOLUTION_MS) < 0 ||
+        pthread_create(&expiry, NULL, expiry_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start expiry\n");
+        return EXIT_FAILURE;
+    }
+    pthread_detach(expiry);
 
-    Cache *cache = create_cache();
+    // Come back warm: the items are in place before the load balancer
+    // routes any keys here
+    if (dump_path) {
+        uint64_t start = clock_now_ms();
+        long restored = cache_restore(cache, dump_path);
+        if (restored >= 0) {
+            printf("Restored %ld items from %s in %llu ms\n", restored, dump_path,
+                   (unsigned long long)(clock_now_ms() - start));
+        }
+    }
+
+    if (write_queue > 0) db_pool_size++; // One for the flush thread
+    db_pool = dbpool_create(DB_SERVER_ADDRESS, DB_SERVER_PORT, db_pool_size);
+    if (!db_pool) {
+        fprintf(stderr, "Failed to create DB connection pool\n");
+        return EXIT_FAILURE;
+    }
+    if (write_queue > 0) {
+        write_behind = writebehind_create(db_pool, write_queue);
+        if (!write_behind) {
+            fprintf(stderr, "Failed to start write-behind\n");
+            return EXIT_FAILURE;
+        }
+    }
 
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
@@ -126,6 +1100,9 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(port);
@@ -136,24 +1113,71 @@ int main(int argc, char *argv[]) {
 
     char server_address[256];
     snprintf(server_address, sizeof(server_address), "127.0.0.1:%d", port);
-    announce_to_load_balancer(server_address);
+    migration_init(cache, server_address, cache_ttl_ms);
 
-    if (listen(server_socket, 10) < 0) {
+    if (listen(server_socket, SOMAXCONN) < 0) {
         perror("Listen failed");
         return EXIT_FAILURE;
     }
-    printf("Server is listening on port %d\n", port);
+    set_nonblocking(server_socket);
+    printf("Server is listening on port %d with %d event loop threads, %d DB workers, %s eviction\n",
+           port, thread_count, db_worker_count, policy->name);
 
-    while (1) {
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_len);
-        if (client_socket < 0) {
-            perror("Accept failed");
-            continue;
+    for (int i = 0; i < db_worker_count; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, db_worker_thread, NULL) != 0) {
+            perror("Failed to start DB worker");
+            return EXIT_FAILURE;
+        }
+        pthread_detach(worker);
+    }
+
+    // Every reactor watches the listening socket; EPOLLEXCLUSIVE wakes only
+    // one of them per incoming connection
+    pthread_t threads[thread_count];
+    Reactor reactors[thread_count];
+    memset(reactors, 0, sizeof(reactors));
+    for (int i = 0; i < thread_count; i++) {
+        reactors[i].listen_fd = server_socket;
+        reactors[i].epoll_fd = epoll_create1(0);
+        reactors[i].wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (reactors[i].epoll_fd < 0 || reactors[i].wake_fd < 0) {
+            perror("Failed to create event loop");
+            return EXIT_FAILURE;
         }
-        handle_client(client_socket, cache);
+        pthread_mutex_init(&reactors[i].lock, NULL);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        struct epoll_event wake;
+        wake.events = EPOLLIN;
+        wake.data.ptr = &reactors[i];
+        if (epoll_ctl(reactors[i].epoll_fd, EPOLL_CTL_ADD, server_socket, &ev) < 0 ||
+            epoll_ctl(reactors[i].epoll_fd, EPOLL_CTL_ADD, reactors[i].wake_fd, &wake) < 0) {
+            perror("epoll_ctl failed");
+            return EXIT_FAILURE;
+        }
+        pthread_create(&threads[i], NULL, reactor_thread, &reactors[i]);
     }
 
-    free_cache(cache);
+    // Only join the ring once requests can be served: the load balancer
+    // starts a key migration to this server right away
+    announce_to_load_balancer(server_address);
+
+    int sig;
+    sigwait(&shutdown_signals, &sig);
+    printf("Received signal %d, shutting down\n", sig);
+
+    // Acknowledged writes must reach the DB before the process goes away
+    if (write_behind) {
+        printf("Flushing write-behind queue\n");
+        writebehind_shutdown(write_behind);
+    }
+    if (dump_path) {
+        long saved = cache_dump(cache, dump_path);
+        if (saved >= 0) printf("Saved %ld items to %s\n", saved, dump_path);
+    }
     close(server_socket);
     return 0;
 }
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "singleflight.h"
+
+void singleflight_init(SingleFlight *sf) {
+    memset(sf, 0, sizeof(*sf));
+    pthread_mutex_init(&sf->lock, NULL);
+}
+
+static Flight **bucket_of(SingleFlight *sf, const char *key) {
+    return &sf->buckets[hash_xxh64(key, strlen(key), 0) % SINGLEFLIGHT_BUCKETS];
+}
+
+// Drop one reference; the last holder frees the flight. Called with lock held.
+static void release(Flight *flight) {
+    if (--flight->refs > 0) return;
+    pthread_cond_destroy(&flight->finished);
+    netbuf_free(&flight->value);
+    free(flight->key);
+    free(flight);
+}
+
+Flight *singleflight_join(SingleFlight *sf, const char *key, int *leader) {
+    pthread_mutex_lock(&sf->lock);
+    Flight **bucket = bucket_of(sf, key);
+    Flight *flight = *bucket;
+    while (flight && strcmp(flight->key, key) != 0) flight = flight->next;
+
+    if (flight) {
+        flight->refs++;
+        sf->coalesced++;
+        *leader = 0;
+    } else {
+        flight = (Flight *)calloc(1, sizeof(Flight));
+        flight->key = strdup(key);
+        flight->refs = 1;
+        pthread_cond_init(&flight->finished, NULL);
+        flight->next = *bucket;
+        *bucket = flight;
+        sf->fetches++;
+        *leader = 1;
+    }
+    pthread_mutex_unlock(&sf->lock);
+    return flight;
+}
+
+// Take a flight out of its bucket, if still there. Called with lock held.
+static void unlink_flight(SingleFlight *sf, Flight *flight) {
+    Flight **link = bucket_of(sf, flight->key);
+    while (*link && *link != flight) link = &(*link)->next;
+    if (*link) *link = flight->next;
+}
+
+int singleflight_finish(SingleFlight *sf, Flight *flight, int status, const char *value, size_t len) {
+    pthread_mutex_lock(&sf->lock);
+
+    // Later misses start a new fetch: this result may already be stale
+    unlink_flight(sf, flight);
+
+    flight->status = status;
+    if (value) netbuf_append(&flight->value, value, len);
+    flight->done = 1;
+    int current = !flight->stale;
+    pthread_cond_broadcast(&flight->finished);
+    release(flight);
+    pthread_mutex_unlock(&sf->lock);
+    return current;
+}
+
+void singleflight_invalidate(SingleFlight *sf, const char *key) {
+    pthread_mutex_lock(&sf->lock);
+    Flight *flight = *bucket_of(sf, key);
+    while (flight && strcmp(flight->key, key) != 0) flight = flight->next;
+    if (flight) {
+        flight->stale = 1;
+        unlink_flight(sf, flight);
+    }
+    pthread_mutex_unlock(&sf->lock);
+}
+
+int singleflight_wait(SingleFlight *sf, Flight *flight, NetBuf *value) {
+    pthread_mutex_lock(&sf->lock);
+    while (!flight->done) pthread_cond_wait(&flight->finished, &sf->lock);
+
+    int status = flight->status;
+    if (flight->value.len > 0) netbuf_append(value, NETBUF_PTR(&flight->value), flight->value.len);
+    netbuf_append(value, "", 1);
+    value->len--; // NUL-terminated, but not counted
+    release(flight);
+    pthread_mutex_unlock(&sf->lock);
+    return status;
+}
+
+void singleflight_stats(SingleFlight *sf, NetBuf *out) {
+    pthread_mutex_lock(&sf->lock);
+    netbuf_printf(out, "Single-flight: fetches %llu, coalesced %llu\n", sf->fetches, sf->coalesced);
+    pthread_mutex_unlock(&sf->lock);
+}
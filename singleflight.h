@@ -0,0 +1,74 @@
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "netbuf.h"
+
+#define SINGLEFLIGHT_BUCKETS 1024
+
+// A DB fetch in progress for one key. Threads that miss the same key while
+// it is in flight wait for its result instead of fetching it again.
+typedef struct Flight {
+    char *key;
+    int done;                  // Result is available
+    int status;                // Fetch result (PROTO_STATUS_*, or -1 if the DB failed)
+    NetBuf value;              // Value fetched
+    int refs;                  // Leader plus waiters still holding the flight
+    int stale;                 // The key was invalidated while in flight
+    pthread_cond_t finished;
+    struct Flight *next;       // Next flight in the same bucket
+} Flight;
+
+// Table of fetches in flight, shared by all event loop threads
+typedef struct SingleFlight {
+    pthread_mutex_t lock;
+    Flight *buckets[SINGLEFLIGHT_BUCKETS];
+    unsigned long long fetches;    // Fetches started by a leader
+    unsigned long long coalesced;  // Misses answered by someone else's fetch: DB calls saved
+} SingleFlight;
+
+/**
+ * Initialize an empty table.
+ */
+void singleflight_init(SingleFlight *sf);
+
+/**
+ * Join the fetch for a key, starting one if there is none. A leader must
+ * fetch the value and call singleflight_finish(); anyone else calls
+ * singleflight_wait(). A thread must finish every flight it leads before
+ * it waits on another, so waits can never form a cycle.
+ * @param leader Set to 1 if the caller started the fetch, 0 if it joined one.
+ * @return The flight.
+ */
+Flight *singleflight_join(SingleFlight *sf, const char *key, int *leader);
+
+/**
+ * Publish a leader's result, wake the waiters and release the flight.
+ * @return 0 if the key was invalidated while the fetch was in flight: the
+ *         value may predate the write that invalidated it, so the leader
+ *         must drop any copy of it it has cached. 1 otherwise.
+ */
+int singleflight_finish(SingleFlight *sf, Flight *flight, int status, const char *value, size_t len);
+
+/**
+ * Mark the fetch of a key in flight, if any, as stale. Misses from now on
+ * start a new fetch instead of joining it. Call on every write, before
+ * the key is stored or dropped in the cache, so a leader caching the old
+ * value either is marked or has already cached it.
+ */
+void singleflight_invalidate(SingleFlight *sf, const char *key);
+
+/**
+ * Wait for the leader's result and release the flight.
+ * @param value Receives the value fetched (NUL-terminated).
+ * @return The leader's status.
+ */
+int singleflight_wait(SingleFlight *sf, Flight *flight, NetBuf *value);
+
+/**
+ * Append counters to a stats report.
+ */
+void singleflight_stats(SingleFlight *sf, NetBuf *out);
+
+#endif // SINGLEFLIGHT_H
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include "sketch.h"
+
+// SplitMix64 finalizer: spreads a hash over all 64 bits
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Counter of each row for a key: double hashing from the two halves of
+// one mixed hash
+static void sketch_slots(const CountMinSketch *sketch, uint64_t hash, uint8_t **slots) {
+    uint64_t h = mix64(hash);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        size_t idx = (h1 + row * h2) & (sketch->width - 1);
+        slots[row] = &sketch->counters[row * sketch->width + idx];
+    }
+}
+
+int sketch_init(CountMinSketch *sketch, size_t width) {
+    sketch->width = 16;
+    while (sketch->width < width) sketch->width *= 2;
+    sketch->counters = (uint8_t *)calloc(SKETCH_DEPTH, sketch->width);
+    sketch->additions = 0;
+    return sketch->counters ? 0 : -1;
+}
+
+uint32_t sketch_add(CountMinSketch *sketch, uint64_t hash) {
+    uint8_t *slots[SKETCH_DEPTH];
+    sketch_slots(sketch, hash, slots);
+
+    uint8_t min = UINT8_MAX;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        if (*slots[row] < min) min = *slots[row];
+    }
+    if (min == UINT8_MAX) return min;
+
+    // Conservative update: only the counters at the minimum grow, which
+    // keeps collisions from inflating the other rows
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        if (*slots[row] == min) (*slots[row])++;
+    }
+
+    if (++sketch->additions >= sketch->width * SKETCH_SAMPLE_FACTOR) {
+        for (size_t i = 0; i < SKETCH_DEPTH * sketch->width; i++) sketch->counters[i] >>= 1;
+        sketch->additions /= 2;
+    }
+    return min + 1;
+}
+
+uint32_t sketch_estimate(const CountMinSketch *sketch, uint64_t hash) {
+    uint8_t *slots[SKETCH_DEPTH];
+    sketch_slots(sketch, hash, slots);
+
+    uint8_t min = UINT8_MAX;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        if (*slots[row] < min) min = *slots[row];
+    }
+    return min;
+}
+
+void sketch_free(CountMinSketch *sketch) {
+    free(sketch->counters);
+    sketch->counters = NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SKETCH_DEPTH 4          // Rows, each indexed by a different hash
+#define SKETCH_SAMPLE_FACTOR 10 // Increments between halvings, per counter in a row
+
+// Count-min sketch of 8-bit saturating counters. Estimates can only be too
+// high, never too low. Once width * SKETCH_SAMPLE_FACTOR increments have
+// been made every counter is halved, so old popularity fades.
+typedef struct CountMinSketch {
+    uint8_t *counters;   // SKETCH_DEPTH rows of width counters
+    size_t width;        // Counters per row (power of two)
+    uint64_t additions;  // Increments since the last halving
+} CountMinSketch;
+
+/**
+ * Initialize a sketch.
+ * @param width Counters per row; rounded up to a power of two.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int sketch_init(CountMinSketch *sketch, size_t width);
+
+/**
+ * Count one occurrence of a key.
+ * @param hash Hash of the key; it is mixed again, so any 32 or 64-bit hash works.
+ * @return Estimated count including this occurrence.
+ */
+uint32_t sketch_add(CountMinSketch *sketch, uint64_t hash);
+
+/**
+ * Estimated number of occurrences of a key.
+ */
+uint32_t sketch_estimate(const CountMinSketch *sketch, uint64_t hash);
+
+/**
+ * Free the counters.
+ */
+void sketch_free(CountMinSketch *sketch);
+
+#endif // SKETCH_H
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "slab.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define PAGE_HEADER_SIZE ((sizeof(SlabPage) + 63) & ~(size_t)63)
+#define SLAB_MAX_CHUNK (SLAB_PAGE_SIZE - PAGE_HEADER_SIZE)
+
+static SlabPage *page_of(void *ptr) {
+    return (SlabPage *)((uintptr_t)ptr & ~((uintptr_t)SLAB_PAGE_SIZE - 1));
+}
+
+// Map an arena of size bytes aligned to SLAB_PAGE_SIZE
+static char *map_arena(size_t size, int use_huge_pages, int *huge) {
+    *huge = 0;
+
+#ifdef MAP_HUGETLB
+    if (use_huge_pages) {
+        // Huge page mappings are aligned to the huge page size
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *huge = 1;
+            return (char *)p;
+        }
+        fprintf(stderr, "Huge pages unavailable, falling back to regular pages\n");
+    }
+#endif
+
+    // Over-map by one page and trim so the arena starts on a page boundary
+    char *p = (char *)mmap(NULL, size + SLAB_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+
+    uintptr_t start = ((uintptr_t)p + SLAB_PAGE_SIZE - 1) & ~((uintptr_t)SLAB_PAGE_SIZE - 1);
+    size_t head = start - (uintptr_t)p;
+    if (head) munmap(p, head);
+    if (SLAB_PAGE_SIZE - head) munmap((char *)start + size, SLAB_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages) madvise((void *)start, size, MADV_HUGEPAGE);
+#endif
+    return (char *)start;
+}
+
+SlabAllocator *slab_create(size_t mem_limit, int use_huge_pages) {
+    SlabAllocator *slabs = (SlabAllocator *)calloc(1, sizeof(SlabAllocator));
+    if (!slabs) return NULL;
+
+    size_t size = (mem_limit + SLAB_PAGE_SIZE - 1) & ~((size_t)SLAB_PAGE_SIZE - 1);
+    if (size == 0) size = SLAB_PAGE_SIZE;
+    if (use_huge_pages) size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+
+    slabs->arena = map_arena(size, use_huge_pages, &slabs->huge_pages);
+    if (!slabs->arena) {
+        perror("Failed to map slab arena");
+        free(slabs);
+        return NULL;
+    }
+    slabs->arena_size = size;
+    slabs->page_count = size / SLAB_PAGE_SIZE;
+
+    // Geometric size classes, the last one holding a single chunk per page
+    size_t chunk = SLAB_MIN_CHUNK;
+    while (slabs->class_count < SLAB_MAX_CLASSES - 1 && chunk < SLAB_MAX_CHUNK / SLAB_GROWTH_FACTOR) {
+        SlabClass *cls = &slabs->classes[slabs->class_count++];
+        cls->chunk_size = chunk;
+        cls->per_page = SLAB_MAX_CHUNK / chunk;
+        chunk = ((size_t)(chunk * SLAB_GROWTH_FACTOR) + 7) & ~(size_t)7;
+    }
+    SlabClass *last = &slabs->classes[slabs->class_count++];
+    last->chunk_size = SLAB_MAX_CHUNK;
+    last->per_page = 1;
+
+    return slabs;
+}
+
+int slab_class_for(SlabAllocator *slabs, size_t size) {
+    // Binary search for the smallest class that fits
+    int lo = 0, hi = slabs->class_count - 1;
+    if (size > slabs->classes[hi].chunk_size) return -1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (slabs->classes[mid].chunk_size >= size) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static SlabPage *grab_page(SlabAllocator *slabs) {
+    SlabPage *page;
+
+    if (slabs->free_pages) {
+        page = slabs->free_pages;
+        slabs->free_pages = page->next;
+    } else if (slabs->pages_assigned < slabs->page_count) {
+        page = (SlabPage *)(slabs->arena + slabs->pages_assigned++ * SLAB_PAGE_SIZE);
+    } else {
+        return NULL;
+    }
+
+    page->free_chunks = NULL;
+    page->unused = (char *)page + PAGE_HEADER_SIZE;
+    page->used = 0;
+    return page;
+}
+
+static void partial_push(SlabClass *cls, SlabPage *page) {
+    page->prev = NULL;
+    page->next = cls->partial;
+    if (cls->partial) cls->partial->prev = page;
+    cls->partial = page;
+}
+
+static void partial_unlink(SlabClass *cls, SlabPage *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        cls->partial = page->next;
+    }
+    if (page->next) page->next->prev = page->prev;
+    page->next = page->prev = NULL;
+}
+
+void *slab_alloc(SlabAllocator *slabs, int class_id) {
+    SlabClass *cls = &slabs->classes[class_id];
+    SlabPage *page = cls->partial;
+
+    if (!page) {
+        page = grab_page(slabs);
+        if (!page) {
+            cls->alloc_failures++;
+            return NULL;
+        }
+        page->class_id = class_id;
+        cls->pages++;
+        partial_push(cls, page);
+    }
+
+    void *chunk;
+    if (page->free_chunks) {
+        chunk = page->free_chunks;
+        page->free_chunks = *(void **)chunk;
+    } else {
+        chunk = page->unused;
+        page->unused += cls->chunk_size;
+    }
+
+    page->used++;
+    cls->used_chunks++;
+    if (page->used == cls->per_page) partial_unlink(cls, page);
+    return chunk;
+}
+
+void slab_free(SlabAllocator *slabs, void *ptr) {
+    SlabPage *page = page_of(ptr);
+    SlabClass *cls = &slabs->classes[page->class_id];
+
+    if (page->used == cls->per_page) partial_push(cls, page);
+
+    *(void **)ptr = page->free_chunks;
+    page->free_chunks = ptr;
+    page->used--;
+    cls->used_chunks--;
+
+    // Give empty pages back so other classes can use them
+    if (page->used == 0) {
+        partial_unlink(cls, page);
+        cls->pages--;
+        page->class_id = -1;
+        page->next = slabs->free_pages;
+        slabs->free_pages = page;
+    }
+}
+
+int slab_class_of(void *ptr) {
+    return page_of(ptr)->class_id;
+}
+
+int slab_page_chunks(SlabAllocator *slabs, void *ptr, void **out) {
+    SlabPage *page = page_of(ptr);
+    SlabClass *cls = &slabs->classes[page->class_id];
+    char *first = (char *)page + PAGE_HEADER_SIZE;
+    uint32_t carved = (page->unused - first) / cls->chunk_size;
+
+    // Chunks carved from the page are allocated unless on its free list
+    char *is_free = (char *)calloc(carved > 0 ? carved : 1, 1);
+    if (!is_free) return -1;
+    for (char *chunk = page->free_chunks; chunk; chunk = *(char **)chunk) {
+        is_free[(chunk - first) / cls->chunk_size] = 1;
+    }
+
+    int count = 0;
+    for (uint32_t i = 0; i < carved; i++) {
+        if (!is_free[i]) out[count++] = first + i * cls->chunk_size;
+    }
+    free(is_free);
+    cls->pages_moved++;
+    return count;
+}
+
+size_t slab_stats(SlabAllocator **slabs, int count, char *buf, size_t len) {
+    size_t off = 0, pages_assigned = 0, page_count = 0;
+    int huge_pages = 0;
+    int n;
+
+    if (len == 0) return 0;
+    buf[0] = '\0';
+    if (count == 0) return 0;
+
+    for (int s = 0; s < count; s++) {
+        pages_assigned += slabs[s]->pages_assigned;
+        page_count += slabs[s]->page_count;
+        huge_pages += slabs[s]->huge_pages;
+    }
+
+    n = snprintf(buf, len, "pages %zu/%zu huge %d\n", pages_assigned, page_count, huge_pages > 0);
+    if (n < 0 || (size_t)n >= len) return strlen(buf);
+    off = n;
+
+    // Only classes that have ever been used, to keep the output short
+    for (int i = 0; i < slabs[0]->class_count; i++) {
+        SlabClass total = slabs[0]->classes[i];
+        for (int s = 1; s < count; s++) {
+            SlabClass *cls = &slabs[s]->classes[i];
+            total.pages += cls->pages;
+            total.used_chunks += cls->used_chunks;
+            total.alloc_failures += cls->alloc_failures;
+            total.pages_moved += cls->pages_moved;
+        }
+        if (total.pages == 0 && total.alloc_failures == 0) continue;
+
+        n = snprintf(buf + off, len - off,
+                     "class %d chunk %zu pages %zu used %zu/%zu failures %llu moved %llu\n",
+                     i, total.chunk_size, total.pages, total.used_chunks,
+                     total.pages * total.per_page, (unsigned long long)total.alloc_failures,
+                     (unsigned long long)total.pages_moved);
+        if (n < 0 || (size_t)n >= len - off) {
+            buf[off] = '\0';
+            break;
+        }
+        off += n;
+    }
+    return off;
+}
+
+void slab_destroy(SlabAllocator *slabs) {
+    if (!slabs) return;
+    munmap(slabs->arena, slabs->arena_size);
+    free(slabs);
+}
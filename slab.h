@@ -0,0 +1,104 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_PAGE_SIZE (1024 * 1024)  // Size of a slab page (must be a power of two)
+#define SLAB_MIN_CHUNK 64             // Smallest chunk size
+#define SLAB_GROWTH_FACTOR 1.25       // Chunk size ratio between neighbouring classes
+#define SLAB_MAX_CLASSES 64
+
+// Header at the start of every page. Pages are SLAB_PAGE_SIZE aligned, so
+// the page owning a chunk is found by masking the chunk address.
+typedef struct SlabPage {
+    struct SlabPage *next;   // Next page in the class partial list or free page list
+    struct SlabPage *prev;   // Previous page in the class partial list
+    void *free_chunks;       // Singly linked list of freed chunks
+    char *unused;            // First never-used chunk (chunks are carved lazily)
+    uint32_t used;           // Chunks currently allocated
+    int class_id;            // Owning size class, -1 if the page is free
+} SlabPage;
+
+// One size class
+typedef struct SlabClass {
+    size_t chunk_size;       // Bytes per chunk
+    uint32_t per_page;       // Chunks per page
+    SlabPage *partial;       // Pages with at least one free chunk
+    size_t pages;            // Pages assigned to this class
+    size_t used_chunks;      // Chunks currently allocated
+    uint64_t alloc_failures; // Allocations that found no free chunk or page
+    uint64_t pages_moved;    // Pages emptied so another class could have them
+} SlabClass;
+
+// Slab allocator carving chunks out of one pre-allocated arena
+typedef struct SlabAllocator {
+    char *arena;             // Page-aligned arena
+    size_t arena_size;       // Mapped size of the arena in bytes
+    size_t page_count;       // Pages in the arena
+    size_t pages_assigned;   // Pages handed out from the bump pointer so far
+    SlabPage *free_pages;    // Pages returned after all their chunks were freed
+    int huge_pages;          // 1 if the arena is backed by huge pages
+    int class_count;
+    SlabClass classes[SLAB_MAX_CLASSES];
+} SlabAllocator;
+
+/**
+ * Create a slab allocator with an arena of mem_limit bytes.
+ * @param mem_limit Arena size in bytes (rounded up to whole pages).
+ * @param use_huge_pages Try to back the arena with huge pages.
+ * @return Pointer to the allocator, or NULL if the arena cannot be mapped.
+ */
+SlabAllocator *slab_create(size_t mem_limit, int use_huge_pages);
+
+/**
+ * Find the size class for an allocation.
+ * @return Class id, or -1 if size exceeds the largest chunk.
+ */
+int slab_class_for(SlabAllocator *slabs, size_t size);
+
+/**
+ * Allocate a chunk from a size class.
+ * @return Pointer to the chunk, or NULL if the class has no free chunk and
+ *         no free page is left.
+ */
+void *slab_alloc(SlabAllocator *slabs, int class_id);
+
+/**
+ * Return a chunk to its class. Pages whose chunks are all free go back to
+ * the shared free page list so any class can reuse them.
+ */
+void slab_free(SlabAllocator *slabs, void *ptr);
+
+/**
+ * Size class of an allocated chunk.
+ */
+int slab_class_of(void *ptr);
+
+/**
+ * Start moving the page holding an allocated chunk to another class: list
+ * the page's allocated chunks, which the caller then frees. The last free
+ * returns the page to the free page list, where the class short of memory
+ * picks it up.
+ * @param out Receives the chunks; room for the class's per_page chunks.
+ * @return Number of chunks written, or -1 if memory for the scan is short.
+ */
+int slab_page_chunks(SlabAllocator *slabs, void *ptr, void **out);
+
+/**
+ * Format per-class occupancy statistics summed over several allocators
+ * with the same size classes (e.g. one per cache shard).
+ * @param slabs Array of allocators.
+ * @param count Number of allocators.
+ * @param buf Output buffer.
+ * @param len Size of the output buffer.
+ * @return Number of bytes written (excluding the NUL).
+ */
+size_t slab_stats(SlabAllocator **slabs, int count, char *buf, size_t len);
+
+/**
+ * Unmap the arena and free the allocator.
+ */
+void slab_destroy(SlabAllocator *slabs);
+
+#endif // SLAB_H
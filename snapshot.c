@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "mockdb.h"
+#include "snapshot.h"
+
+#define RECORD_ALIGN 8
+
+static size_t record_size(size_t key_len, size_t value_len) {
+    size_t size = sizeof(SnapshotRecord) + key_len + 1 + value_len + 1;
+    return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+// Chain a record into a checksum; the padding is left out
+static uint64_t checksum_record(uint64_t checksum, const SnapshotRecord *record,
+                                const char *key, const char *value) {
+    checksum = hash_xxh64(record, sizeof(SnapshotRecord), checksum);
+    checksum = hash_xxh64(key, (size_t)record->key_len + 1, checksum);
+    return hash_xxh64(value, (size_t)record->value_len + 1, checksum);
+}
+
+// Record at a file offset, if it lies entirely inside the file with its key
+// and value NUL-terminated where their lengths say
+static const SnapshotRecord *record_at(const char *map, size_t size, uint64_t offset) {
+    if (offset % RECORD_ALIGN != 0 || offset > size || size - offset < sizeof(SnapshotRecord)) {
+        return NULL;
+    }
+    const SnapshotRecord *record = (const SnapshotRecord *)(map + offset);
+    if (record_size(record->key_len, record->value_len) > size - offset ||
+        record->data[record->key_len] != '\0' ||
+        record->data[(size_t)record->key_len + 1 + record->value_len] != '\0') {
+        return NULL;
+    }
+    return record;
+}
+
+// Check everything lookups will trust: the records tile the file after the
+// index and match the checksum, and every slot points at one of them
+static int snapshot_valid(const char *map, size_t size) {
+    const SnapshotHeader *header = (const SnapshotHeader *)map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->slot_count > (size - sizeof(SnapshotHeader)) / sizeof(uint64_t) ||
+        header->count >= header->slot_count) {
+        return 0;
+    }
+    size_t index_end = sizeof(SnapshotHeader) + header->slot_count * sizeof(uint64_t);
+
+    uint64_t checksum = 0, count = 0;
+    for (size_t offset = index_end; offset < size; count++) {
+        const SnapshotRecord *record = record_at(map, size, offset);
+        if (!record) return 0;
+        checksum = checksum_record(checksum, record, record->data,
+                                   record->data + record->key_len + 1);
+        offset += record_size(record->key_len, record->value_len);
+    }
+    const uint64_t *slots = (const uint64_t *)(map + sizeof(SnapshotHeader));
+    checksum = hash_xxh64(slots, header->slot_count * sizeof(uint64_t), checksum);
+    if (count != header->count || checksum != header->checksum) return 0;
+
+    uint64_t used = 0;
+    for (uint64_t slot = 0; slot < header->slot_count; slot++) {
+        if (slots[slot] == 0) continue;
+        if (slots[slot] < index_end || !record_at(map, size, slots[slot])) return 0;
+        used++;
+    }
+    return used == header->count;
+}
+
+Snapshot *snapshot_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map snapshot");
+        return NULL;
+    }
+
+    if (!snapshot_valid((const char *)map, st.st_size)) {
+        fprintf(stderr, "Ignoring invalid snapshot %s\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    Snapshot *snap = (Snapshot *)malloc(sizeof(Snapshot));
+    if (!snap) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    snap->map = (const char *)map;
+    snap->size = st.st_size;
+    snap->header = (const SnapshotHeader *)map;
+    snap->slots = (const uint64_t *)(snap->map + sizeof(SnapshotHeader));
+    return snap;
+}
+
+const SnapshotRecord *snapshot_record(const Snapshot *snap, uint64_t slot) {
+    uint64_t offset = snap->slots[slot];
+    if (offset == 0) return NULL;
+    return (const SnapshotRecord *)(snap->map + offset);
+}
+
+const char *snapshot_get(const Snapshot *snap, const char *key, uint64_t hash) {
+    uint64_t mask = snap->header->slot_count - 1;
+    size_t key_len = strlen(key);
+
+    for (uint64_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const SnapshotRecord *record = snapshot_record(snap, slot);
+        if (!record) return NULL;
+        if (record->hash == hash && record->key_len == key_len &&
+            memcmp(record->data, key, key_len) == 0) {
+            return record->data + key_len + 1;
+        }
+    }
+}
+
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+struct SnapshotWriter {
+    int fd;
+    uint64_t *slots;
+    uint64_t slot_count;
+    char *buffer;          // Records not yet written to the file
+    size_t used;
+    uint64_t offset;       // File offset of the next record
+    uint64_t count;
+    uint64_t checksum;
+    int failed;
+};
+
+SnapshotWriter *snapshot_writer_create(size_t key_count) {
+    SnapshotWriter *w = (SnapshotWriter *)calloc(1, sizeof(SnapshotWriter));
+    if (!w) return NULL;
+    w->fd = -1;
+    w->slot_count = 16;
+    while (w->slot_count < key_count * 2 + 1) w->slot_count *= 2;
+    w->slots = (uint64_t *)calloc(w->slot_count, sizeof(uint64_t));
+    w->buffer = (char *)malloc(WRITE_BUFFER_SIZE);
+    if (!w->slots || !w->buffer) {
+        snapshot_writer_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void snapshot_writer_free(SnapshotWriter *w) {
+    if (!w) return;
+    free(w->slots);
+    free(w->buffer);
+    free(w);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void flush_buffer(SnapshotWriter *w) {
+    if (w->used > 0 && write_all(w->fd, w->buffer, w->used) < 0) w->failed = 1;
+    w->used = 0;
+}
+
+static void buffer_write(SnapshotWriter *w, const void *data, size_t len) {
+    if (w->used + len > WRITE_BUFFER_SIZE) flush_buffer(w);
+    if (len > WRITE_BUFFER_SIZE) {
+        if (write_all(w->fd, data, len) < 0) w->failed = 1;
+        return;
+    }
+    memcpy(w->buffer + w->used, data, len);
+    w->used += len;
+}
+
+static void write_record(const char *key, const char *value, uint64_t hash, void *arg) {
+    SnapshotWriter *w = (SnapshotWriter *)arg;
+    if (w->failed) return;
+    if (w->count + 1 >= w->slot_count) {
+        w->failed = 1; // More keys than counted: the index would fill up
+        return;
+    }
+
+    SnapshotRecord record = {hash, (uint32_t)strlen(key), (uint32_t)strlen(value)};
+    size_t size = record_size(record.key_len, record.value_len);
+    static const char padding[RECORD_ALIGN] = {0};
+    size_t pad = size - (sizeof(record) + record.key_len + 1 + record.value_len + 1);
+    buffer_write(w, &record, sizeof(record));
+    buffer_write(w, key, record.key_len + 1);
+    buffer_write(w, value, record.value_len + 1);
+    if (pad) buffer_write(w, padding, pad);
+    w->checksum = checksum_record(w->checksum, &record, key, value);
+
+    uint64_t mask = w->slot_count - 1;
+    uint64_t slot = hash & mask;
+    while (w->slots[slot]) slot = (slot + 1) & mask;
+    w->slots[slot] = w->offset;
+    w->offset += size;
+    w->count++;
+}
+
+int snapshot_writer_run(SnapshotWriter *w, MockDB *db, const char *path,
+                        uint64_t generation) {
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) return -1;
+
+    // Records first, then the header and the index they fill in
+    w->offset = sizeof(SnapshotHeader) + w->slot_count * sizeof(uint64_t);
+    if (lseek(w->fd, w->offset, SEEK_SET) < 0) w->failed = 1;
+    db_foreach(db, write_record, w);
+    flush_buffer(w);
+
+    w->checksum = hash_xxh64(w->slots, w->slot_count * sizeof(uint64_t), w->checksum);
+    SnapshotHeader header = {SNAPSHOT_MAGIC, generation, w->count, w->slot_count, w->checksum};
+    if (!w->failed) {
+        if (lseek(w->fd, 0, SEEK_SET) < 0 || write_all(w->fd, &header, sizeof(header)) < 0 ||
+            write_all(w->fd, w->slots, w->slot_count * sizeof(uint64_t)) < 0 ||
+            fsync(w->fd) < 0) {
+            w->failed = 1;
+        }
+    }
+    if (close(w->fd) < 0) w->failed = 1;
+    w->fd = -1;
+    return w->failed ? -1 : 0;
+}
+
+void snapshot_close(Snapshot *snap) {
+    if (!snap) return;
+    munmap((void *)snap->map, snap->size);
+    free(snap);
+}
@@ -0,0 +1,92 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC "DBSNAP2"
+
+struct MockDB;
+
+// File layout, all little-endian and 8-byte aligned so the file can be
+// used in place once mapped:
+//   SnapshotHeader
+//   uint64_t slots[slot_count]   Open-addressing index: file offset of a
+//                                record, 0 for an empty slot; probed
+//                                linearly from hash & (slot_count - 1)
+//   SnapshotRecord ...           key '\0' value '\0', padded to 8 bytes
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint64_t generation;   // Covers every write logged before log generation + 1
+    uint64_t count;        // Number of records
+    uint64_t slot_count;   // Power of two, at least twice count
+    uint64_t checksum;     // XXH64 chained over each record, then the index
+} SnapshotHeader;
+
+typedef struct SnapshotRecord {
+    uint64_t hash;         // XXH64 of the key
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[];
+} SnapshotRecord;
+
+// A snapshot mapped read-only; records are read straight from the mapping
+typedef struct Snapshot {
+    const char *map;
+    size_t size;
+    const SnapshotHeader *header;
+    const uint64_t *slots;
+} Snapshot;
+
+/**
+ * Map a snapshot file and check its header, checksum and every record
+ * the index points at.
+ * @return The snapshot, or NULL if the file is missing or invalid.
+ */
+Snapshot *snapshot_open(const char *path);
+
+/**
+ * Look up a key in a snapshot.
+ * @param hash XXH64 of the key.
+ * @return The value (NUL-terminated, inside the mapping), or NULL.
+ */
+const char *snapshot_get(const Snapshot *snap, const char *key, uint64_t hash);
+
+/**
+ * Record in an index slot.
+ * @return The record, or NULL if the slot is empty.
+ */
+const SnapshotRecord *snapshot_record(const Snapshot *snap, uint64_t slot);
+
+// A snapshot being written. Everything it needs is allocated by
+// snapshot_writer_create(), so snapshot_writer_run() can be called in a
+// child forked from a multithreaded process: it does no allocation and no
+// stdio, only open, lseek, write, fsync and close.
+typedef struct SnapshotWriter SnapshotWriter;
+
+/**
+ * Allocate a writer for a database, with the database locked.
+ * @param key_count Number of live keys (db->count) at the time of the write.
+ * @return The writer, or NULL if out of memory.
+ */
+SnapshotWriter *snapshot_writer_create(size_t key_count);
+
+/**
+ * Write every live key of a database to a new snapshot file and fsync it.
+ * The database must not change while this runs.
+ * @return 0 on success, -1 on failure.
+ */
+int snapshot_writer_run(SnapshotWriter *w, struct MockDB *db, const char *path,
+                        uint64_t generation);
+
+/**
+ * Free a writer.
+ */
+void snapshot_writer_free(SnapshotWriter *w);
+
+/**
+ * Unmap a snapshot.
+ */
+void snapshot_close(Snapshot *snap);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "wal.h"
+
+static uint32_t record_checksum(const char *record, size_t size) {
+    size_t skip = sizeof(uint32_t);
+    return (uint32_t)hash_xxh64(record + skip, size - skip, 0);
+}
+
+void wal_path(char *buf, size_t len, const char *dir, uint64_t generation) {
+    snprintf(buf, len, "%s/log.%llu", dir, (unsigned long long)generation);
+}
+
+static int create_log(const char *dir, uint64_t generation) {
+    char path[512];
+    wal_path(path, sizeof(path), dir, generation);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) perror("Failed to create log file");
+    return fd;
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            // Acknowledged writes can no longer be made durable
+            perror("Log write failed");
+            exit(EXIT_FAILURE);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void *sync_thread(void *arg) {
+    Wal *wal = (Wal *)arg;
+    NetBuf batch = {0};
+
+    pthread_mutex_lock(&wal->lock);
+    while (1) {
+        while (wal->pending.len == 0) pthread_cond_wait(&wal->work, &wal->lock);
+
+        // Take everything appended so far; appends continue into the
+        // emptied buffer while this batch is written
+        NetBuf taken = wal->pending;
+        wal->pending = batch;
+        batch = taken;
+        uint64_t target = wal->appended;
+        int fd = wal->fd;
+        wal->syncing = 1;
+        pthread_mutex_unlock(&wal->lock);
+
+        write_all(fd, NETBUF_PTR(&batch), batch.len);
+        if (fdatasync(fd) < 0) {
+            perror("Log fsync failed");
+            exit(EXIT_FAILURE);
+        }
+        netbuf_consume(&batch, batch.len);
+
+        pthread_mutex_lock(&wal->lock);
+        wal->synced = target;
+        wal->syncing = 0;
+        wal->syncs++;
+        pthread_cond_broadcast(&wal->durable);
+    }
+    return NULL;
+}
+
+Wal *wal_open(const char *dir, uint64_t generation) {
+    Wal *wal = (Wal *)calloc(1, sizeof(Wal));
+    if (!wal) return NULL;
+    snprintf(wal->dir, sizeof(wal->dir), "%s", dir);
+    wal->generation = generation;
+    wal->fd = create_log(dir, generation);
+    if (wal->fd < 0) {
+        free(wal);
+        return NULL;
+    }
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->work, NULL);
+    pthread_cond_init(&wal->durable, NULL);
+
+    if (pthread_create(&wal->thread, NULL, sync_thread, wal) != 0) {
+        perror("Failed to create log sync thread");
+        close(wal->fd);
+        free(wal);
+        return NULL;
+    }
+    pthread_detach(wal->thread);
+    return wal;
+}
+
+uint64_t wal_append(Wal *wal, uint8_t op, const char *key, const char *value) {
+    WalRecord header = {0, op, {0}, (uint32_t)strlen(key), value ? (uint32_t)strlen(value) : 0};
+    size_t size = sizeof(header) + header.key_len + header.value_len;
+
+    pthread_mutex_lock(&wal->lock);
+    size_t start = wal->pending.len;
+    netbuf_append(&wal->pending, (const char *)&header, sizeof(header));
+    netbuf_append(&wal->pending, key, header.key_len);
+    if (value) netbuf_append(&wal->pending, value, header.value_len);
+
+    char *record = NETBUF_PTR(&wal->pending) + start;
+    uint32_t checksum = record_checksum(record, size);
+    memcpy(record, &checksum, sizeof(checksum));
+
+    wal->appended += size;
+    wal->file_size += size;
+    wal->records++;
+    uint64_t lsn = wal->appended;
+    if (start == 0) pthread_cond_signal(&wal->work);
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+void wal_wait(Wal *wal, uint64_t lsn) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->synced < lsn) pthread_cond_wait(&wal->durable, &wal->lock);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+int wal_rotate(Wal *wal) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->pending.len > 0 || wal->syncing) {
+        pthread_cond_signal(&wal->work);
+        pthread_cond_wait(&wal->durable, &wal->lock);
+    }
+
+    int fd = create_log(wal->dir, wal->generation + 1);
+    if (fd < 0) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+    close(wal->fd);
+    wal->fd = fd;
+    wal->generation++;
+    wal->file_size = 0;
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+}
+
+long wal_replay(const char *path, MockDB *db) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open log file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char *map = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map log file");
+        close(fd);
+        return -1;
+    }
+
+    // Records are applied through C strings, so copy key and value out
+    NetBuf key = {0}, value = {0};
+    size_t pos = 0, end = st.st_size;
+    long applied = 0;
+    while (end - pos >= sizeof(WalRecord)) {
+        WalRecord header;
+        memcpy(&header, map + pos, sizeof(header));
+        size_t size = sizeof(header) + (size_t)header.key_len + header.value_len;
+        if (size > end - pos || record_checksum(map + pos, size) != header.checksum ||
+            (header.op != WAL_OP_SET && header.op != WAL_OP_DELETE)) {
+            break;
+        }
+
+        const char *data = map + pos + sizeof(header);
+        netbuf_consume(&key, key.len);
+        netbuf_append(&key, data, header.key_len);
+        netbuf_append(&key, "", 1);
+        if (header.op == WAL_OP_SET) {
+            netbuf_consume(&value, value.len);
+            netbuf_append(&value, data + header.key_len, header.value_len);
+            netbuf_append(&value, "", 1);
+            db_set(db, NETBUF_PTR(&key), NETBUF_PTR(&value));
+        } else {
+            db_delete(db, NETBUF_PTR(&key));
+        }
+        pos += size;
+        applied++;
+    }
+
+    if (pos < end) {
+        fprintf(stderr, "Log %s: dropping %zu bytes of torn or corrupt records\n", path, end - pos);
+        if (ftruncate(fd, pos) < 0) perror("Failed to truncate log file");
+    }
+    netbuf_free(&key);
+    netbuf_free(&value);
+    munmap((void *)map, st.st_size);
+    close(fd);
+    return applied;
+}
@@ -0,0 +1,82 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "mockdb.h"
+#include "netbuf.h"
+
+#define WAL_OP_SET 1
+#define WAL_OP_DELETE 2
+
+// Header of a log record, followed by the key and value bytes. A torn or
+// corrupted record at the end of a log fails its checksum on replay.
+typedef struct WalRecord {
+    uint32_t checksum;     // Low 32 bits of XXH64 over the rest of the record
+    uint8_t op;            // WAL_OP_*
+    uint8_t reserved[3];
+    uint32_t key_len;
+    uint32_t value_len;
+} WalRecord;
+
+// Append-only log of writes. Appends only copy the record into memory; a
+// sync thread writes and fsyncs everything appended so far in one go, so
+// writers that arrive while an fsync is running share the next one (group
+// commit). Log files are numbered by generation: <dir>/log.<generation>.
+typedef struct Wal {
+    char dir[256];
+    int fd;                    // Log file being appended to
+    uint64_t generation;       // Its generation
+    uint64_t file_size;        // Its size, including records not yet written
+    NetBuf pending;            // Records not yet picked up by the sync thread
+    uint64_t appended;         // Bytes appended since startup (log sequence number)
+    uint64_t synced;           // Bytes appended since startup that are durable
+    int syncing;               // Sync thread is writing a batch
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;       // Signals the sync thread
+    pthread_cond_t durable;    // Signals writers waiting for synced to advance
+    unsigned long long records; // Records appended
+    unsigned long long syncs;   // fsyncs done
+} Wal;
+
+/**
+ * Path of a log file.
+ */
+void wal_path(char *buf, size_t len, const char *dir, uint64_t generation);
+
+/**
+ * Create a new log file of the given generation and start the sync thread.
+ * @return The log, or NULL on failure.
+ */
+Wal *wal_open(const char *dir, uint64_t generation);
+
+/**
+ * Append a record. Callers append in the order they apply writes, so the
+ * database lock is held across both.
+ * @param value Value of a set; NULL for a delete.
+ * @return Log sequence number to pass to wal_wait() before acknowledging.
+ */
+uint64_t wal_append(Wal *wal, uint8_t op, const char *key, const char *value);
+
+/**
+ * Block until every record up to lsn is on disk.
+ */
+void wal_wait(Wal *wal, uint64_t lsn);
+
+/**
+ * Make everything appended durable and switch to a new log file of the
+ * next generation. Callers hold the database lock, so nothing is appended
+ * meanwhile.
+ * @return 0 on success, -1 if the new file cannot be created.
+ */
+int wal_rotate(Wal *wal);
+
+/**
+ * Apply the records of a log file to a database. A torn or corrupted tail
+ * is cut off the file.
+ * @return Number of records applied, or -1 if the file cannot be read.
+ */
+long wal_replay(const char *path, MockDB *db);
+
+#endif // WAL_H
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash.h"
+#include "proto.h"
+#include "writebehind.h"
+
+#define WB_BATCH_SIZE 256          // Most sets per MSET sent to the DB
+#define WB_FLUSH_DELAY_MS 50       // Longest a small batch waits for more writes
+#define WB_RETRY_DELAY_MS 200      // Pause before retrying a failed flush
+#define WB_SHUTDOWN_RETRIES 5      // Flush attempts at shutdown before giving up
+
+static int table_init(WbTable *table, size_t capacity) {
+    table->bucket_count = 16;
+    while (table->bucket_count < capacity) table->bucket_count *= 2;
+    table->buckets = (WbEntry **)calloc(table->bucket_count, sizeof(WbEntry *));
+    table->head = table->tail = NULL;
+    table->count = 0;
+    return table->buckets ? 0 : -1;
+}
+
+static WbEntry **table_slot(WbTable *table, const char *key) {
+    uint64_t h = hash_xxh64(key, strlen(key), 0);
+    return &table->buckets[h & (table->bucket_count - 1)];
+}
+
+static WbEntry *table_find(WbTable *table, const char *key) {
+    for (WbEntry *entry = *table_slot(table, key); entry; entry = entry->chain) {
+        if (strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+static void table_insert(WbTable *table, const char *key, const char *value) {
+    WbEntry *entry = (WbEntry *)malloc(sizeof(WbEntry));
+    entry->key = strdup(key);
+    entry->value = value ? strdup(value) : NULL;
+
+    WbEntry **slot = table_slot(table, key);
+    entry->chain = *slot;
+    *slot = entry;
+
+    entry->next = NULL;
+    if (table->tail) {
+        table->tail->next = entry;
+    } else {
+        table->head = entry;
+    }
+    table->tail = entry;
+    table->count++;
+}
+
+static void table_clear(WbTable *table) {
+    WbEntry *entry = table->head;
+    while (entry) {
+        WbEntry *next = entry->next;
+        free(entry->key);
+        free(entry->value);
+        free(entry);
+        entry = next;
+    }
+    memset(table->buckets, 0, table->bucket_count * sizeof(WbEntry *));
+    table->head = table->tail = NULL;
+    table->count = 0;
+}
+
+// Send every write in a table to the DB: sets in MSET batches, deletes one
+// by one. Sets and deletes are idempotent, so a failed flush can simply be
+// repeated. Returns -1 if any request failed.
+static int write_table(DbPool *pool, WbTable *table) {
+    DbConn *conn = dbpool_acquire(pool);
+    NetBuf body = {0};
+    int batched = 0, rc = 0;
+
+    for (WbEntry *entry = table->head; entry && rc == 0; entry = entry->next) {
+        if (!entry->value) {
+            if (dbpool_request(pool, conn, PROTO_OP_DELETE, entry->key, strlen(entry->key),
+                               NULL, 0, NULL) != PROTO_STATUS_OK) {
+                rc = -1;
+            }
+            continue;
+        }
+
+        proto_put_key(&body, entry->key, strlen(entry->key));
+        proto_put_value(&body, entry->value, strlen(entry->value));
+        if (++batched == WB_BATCH_SIZE) {
+            if (dbpool_request(pool, conn, PROTO_OP_MSET, "", 0, NETBUF_PTR(&body), body.len,
+                               NULL) != PROTO_STATUS_OK) {
+                rc = -1;
+            }
+            netbuf_consume(&body, body.len);
+            batched = 0;
+        }
+    }
+    if (rc == 0 && batched > 0 &&
+        dbpool_request(pool, conn, PROTO_OP_MSET, "", 0, NETBUF_PTR(&body), body.len, NULL) !=
+            PROTO_STATUS_OK) {
+        rc = -1;
+    }
+
+    netbuf_free(&body);
+    dbpool_release(pool, conn);
+    return rc;
+}
+
+static int is_stopping(WriteBehind *wb) {
+    pthread_mutex_lock(&wb->lock);
+    int stopping = wb->stopping;
+    pthread_mutex_unlock(&wb->lock);
+    return stopping;
+}
+
+static void *flush_thread(void *arg) {
+    WriteBehind *wb = (WriteBehind *)arg;
+
+    pthread_mutex_lock(&wb->lock);
+    while (1) {
+        if (wb->pending.count == 0) {
+            if (wb->stopping) break;
+            pthread_cond_wait(&wb->work, &wb->lock);
+            continue;
+        }
+
+        // Let a small batch grow for a moment: more writes per round trip,
+        // and repeated writes to a hot key collapse into one
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WB_FLUSH_DELAY_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (wb->pending.count < WB_BATCH_SIZE && !wb->stopping) {
+            if (pthread_cond_timedwait(&wb->work, &wb->lock, &deadline) != 0) break;
+        }
+
+        // The flushing table is empty here: swap the two tables
+        WbTable batch = wb->flushing;
+        wb->flushing = wb->pending;
+        wb->pending = batch;
+        pthread_cond_broadcast(&wb->space);
+        pthread_mutex_unlock(&wb->lock);
+
+        // Only this thread modifies the flushing table, so it is read
+        // without the lock; readers hold the lock and only read it too
+        int attempts = 0, lost = 0;
+        while (write_table(wb->pool, &wb->flushing) < 0) {
+            if (is_stopping(wb) && ++attempts >= WB_SHUTDOWN_RETRIES) {
+                fprintf(stderr, "Write-behind: giving up, %zu writes lost\n", wb->flushing.count);
+                lost = 1;
+                break;
+            }
+            fprintf(stderr, "Write-behind: flush of %zu writes failed, retrying\n", wb->flushing.count);
+            usleep(WB_RETRY_DELAY_MS * 1000);
+        }
+
+        pthread_mutex_lock(&wb->lock);
+        if (!lost) wb->flushed += wb->flushing.count;
+        table_clear(&wb->flushing);
+    }
+    wb->stopped = 1;
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+WriteBehind *writebehind_create(DbPool *pool, size_t capacity) {
+    WriteBehind *wb = (WriteBehind *)calloc(1, sizeof(WriteBehind));
+    if (!wb) return NULL;
+    wb->pool = pool;
+    wb->capacity = capacity;
+    if (table_init(&wb->pending, capacity) < 0 || table_init(&wb->flushing, capacity) < 0) {
+        free(wb->pending.buckets);
+        free(wb);
+        return NULL;
+    }
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->work, NULL);
+    pthread_cond_init(&wb->space, NULL);
+
+    if (pthread_create(&wb->thread, NULL, flush_thread, wb) != 0) {
+        perror("Failed to create write-behind thread");
+        free(wb->pending.buckets);
+        free(wb->flushing.buckets);
+        free(wb);
+        return NULL;
+    }
+    return wb;
+}
+
+static void queue_write(WriteBehind *wb, const char *key, const char *value) {
+    pthread_mutex_lock(&wb->lock);
+    if (wb->stopped) {
+        // Nothing will flush the log any more: write through
+        pthread_mutex_unlock(&wb->lock);
+        DbConn *conn = dbpool_acquire(wb->pool);
+        dbpool_request(wb->pool, conn, value ? PROTO_OP_SET : PROTO_OP_DELETE, key, strlen(key),
+                       value, value ? strlen(value) : 0, NULL);
+        dbpool_release(wb->pool, conn);
+        return;
+    }
+
+    // Overwriting a queued key needs no room; a new key waits for space
+    WbEntry *entry = table_find(&wb->pending, key);
+    if (!entry && wb->pending.count >= wb->capacity) {
+        wb->stalls++;
+        while (wb->pending.count >= wb->capacity) {
+            pthread_cond_signal(&wb->work);
+            pthread_cond_wait(&wb->space, &wb->lock);
+        }
+        entry = table_find(&wb->pending, key);
+    }
+
+    if (entry) {
+        free(entry->value);
+        entry->value = value ? strdup(value) : NULL;
+        wb->coalesced++;
+    } else {
+        table_insert(&wb->pending, key, value);
+        if (wb->pending.count == 1 || wb->pending.count >= WB_BATCH_SIZE) {
+            pthread_cond_signal(&wb->work);
+        }
+    }
+    wb->queued++;
+    pthread_mutex_unlock(&wb->lock);
+}
+
+void writebehind_set(WriteBehind *wb, const char *key, const char *value) {
+    queue_write(wb, key, value);
+}
+
+void writebehind_delete(WriteBehind *wb, const char *key) {
+    queue_write(wb, key, NULL);
+}
+
+int writebehind_lookup(WriteBehind *wb, const char *key, NetBuf *value) {
+    int found = -1;
+    pthread_mutex_lock(&wb->lock);
+    WbEntry *entry = table_find(&wb->pending, key);
+    if (!entry) entry = table_find(&wb->flushing, key);
+    if (entry && entry->value) {
+        netbuf_append(value, entry->value, strlen(entry->value) + 1);
+        value->len--; // NUL-terminated, but not counted
+        found = 1;
+    } else if (entry) {
+        found = 0;
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return found;
+}
+
+void writebehind_stats(WriteBehind *wb, NetBuf *out) {
+    pthread_mutex_lock(&wb->lock);
+    netbuf_printf(out, "Write-behind: pending %zu, flushing %zu, queued %llu, coalesced %llu, "
+                  "flushed %llu, stalls %llu\n",
+                  wb->pending.count, wb->flushing.count, wb->queued, wb->coalesced,
+                  wb->flushed, wb->stalls);
+    pthread_mutex_unlock(&wb->lock);
+}
+
+void writebehind_shutdown(WriteBehind *wb) {
+    pthread_mutex_lock(&wb->lock);
+    wb->stopping = 1;
+    pthread_cond_signal(&wb->work);
+    pthread_cond_broadcast(&wb->space);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->thread, NULL);
+}
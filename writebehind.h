@@ -0,0 +1,85 @@
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "dbpool.h"
+#include "netbuf.h"
+
+// A write waiting to reach db_server. Only the newest write per key is kept.
+typedef struct WbEntry {
+    char *key;
+    char *value;                 // NULL for a delete
+    struct WbEntry *chain;       // Next entry in the same hash bucket
+    struct WbEntry *next;        // Next entry in arrival order
+} WbEntry;
+
+// Coalescing set of writes, indexed by key and kept in arrival order
+typedef struct WbTable {
+    WbEntry **buckets;
+    size_t bucket_count;         // Power of two
+    WbEntry *head;
+    WbEntry *tail;
+    size_t count;
+} WbTable;
+
+// Write-behind log in front of db_server. Writes are acknowledged once
+// queued; a background thread sends them to the DB in batches. While a
+// batch is being written it stays readable, so readers always see the
+// latest acknowledged write.
+typedef struct WriteBehind {
+    DbPool *pool;
+    size_t capacity;             // Most writes queued before writers block
+    WbTable pending;             // Queued, not yet picked up by the flusher
+    WbTable flushing;            // Being written to the DB
+    int stopping;                // Shutdown requested: flush what is left
+    int stopped;                 // Flush thread has exited
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;         // Signals the flusher
+    pthread_cond_t space;        // Signals writers blocked on a full log
+    unsigned long long queued;   // Writes accepted
+    unsigned long long coalesced; // Writes that replaced a queued write to the same key
+    unsigned long long flushed;  // Writes that reached the DB
+    unsigned long long stalls;   // Writers that had to wait for space
+} WriteBehind;
+
+/**
+ * Create a write-behind log and start its flush thread.
+ * @param pool Connections to db_server; one is used by the flush thread.
+ * @param capacity Most distinct keys queued before writers block.
+ * @return Pointer to the log, or NULL on failure.
+ */
+WriteBehind *writebehind_create(DbPool *pool, size_t capacity);
+
+/**
+ * Queue a set, replacing any queued write to the same key. Blocks while
+ * the log is full.
+ */
+void writebehind_set(WriteBehind *wb, const char *key, const char *value);
+
+/**
+ * Queue a delete, replacing any queued write to the same key. Blocks while
+ * the log is full.
+ */
+void writebehind_delete(WriteBehind *wb, const char *key);
+
+/**
+ * Look up a write that has not reached the DB yet.
+ * @param value Receives the queued value (NUL-terminated) of a set.
+ * @return 1 for a queued set, 0 for a queued delete, -1 if there is none.
+ */
+int writebehind_lookup(WriteBehind *wb, const char *key, NetBuf *value);
+
+/**
+ * Append counters to a stats report.
+ */
+void writebehind_stats(WriteBehind *wb, NetBuf *out);
+
+/**
+ * Write everything still queued and stop the flush thread. Writes that
+ * arrive afterwards go straight to the DB.
+ */
+void writebehind_shutdown(WriteBehind *wb);
+
+#endif // WRITEBEHIND_H